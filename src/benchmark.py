@@ -0,0 +1,334 @@
+#!/usr/bin/env python3
+"""Benchmark driver for every transformation in this project.
+
+Runs each kernel over a range of process/thread counts with warmup and
+repeated measurements, then writes the samples to
+output/benchmark/results.json and a summary (median, p95, ...) to
+output/benchmark/results.csv, which main.ipynb loads for plotting.
+
+    python3 benchmark.py strong --kernels fft_openmp --workers 1-8
+    python3 benchmark.py weak --repetitions 10 --warmup 2
+
+strong: every run uses data/input.jpg.
+weak:   a run with p workers uses data/scaled_images/image_NxN.png where
+        N = 250 * sqrt(p), so the pixels per worker stay constant.
+
+Results are merged into the existing files, keyed by kernel, mode, worker
+count and image, so kernels can be benchmarked one at a time. The achieved
+GB/s and G(FL)OP/s each executable reports are collected as well, and with
+--roofline the STREAM bandwidth ceiling measured on the same machine. With
+PERF_COUNTERS=1 in the environment the MPI kernels also report the dTLB misses
+of their kernel phase, summed over the ranks.
+"""
+
+import argparse
+import csv
+import json
+import math
+import os
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+
+SRC_DIR = os.path.dirname(os.path.abspath(__file__))
+PROJECT_ROOT = os.path.dirname(SRC_DIR)
+DATA_DIR = os.path.join(PROJECT_ROOT, "data")
+DEFAULT_OUTPUT = os.path.join(PROJECT_ROOT, "output", "benchmark", "results")
+
+WEAK_BASE_SIZE = 250
+
+# name: (executable relative to src/, launcher, extra arguments)
+# launcher is "mpi" (workers = mpirun -np), "omp" (workers = OMP_NUM_THREADS)
+# or "seq" (always a single worker)
+KERNELS = {
+    "color_transformation": (
+        "color_transformation/parallel_color_transformation", "mpi",
+        ["23", "255", "52", "false"]),
+    "flip_horizontal": ("flipping/parallel_flip", "mpi", ["h", "false"]),
+    "flip_vertical": ("flipping/parallel_flip", "mpi", ["v", "false"]),
+    "rotation": ("rotation/parallel_rotate", "mpi", ["c", "false"]),
+    "fft_sequential": ("fft/sequential", "seq", []),
+    "fft_openmp": ("fft/parallel_openmp", "omp", []),
+    "fft_mpi": ("fft/parallel", "mpi", []),
+    "gaussian_blur_sequential": ("gaussian_blur/sequential", "seq", []),
+    "gaussian_blur_openmp": ("gaussian_blur/parallel_omp", "omp", []),
+    "resize_openmp": ("resize/parallel_omp", "omp", ["resize", "0.5", "area"]),
+    "resize_opencv": (
+        "resize/parallel_omp", "omp", ["resize", "0.5", "area", "opencv"]),
+    "resize_mpi": ("resize/parallel_resize", "mpi", ["resize", "0.5", "area"]),
+    "pyramid_openmp": (
+        "resize/parallel_omp", "omp", ["pyramid", "4", "gaussian"]),
+    "pyramid_mpi": (
+        "resize/parallel_resize", "mpi", ["pyramid", "4", "gaussian"]),
+    "histogram_stats": (
+        "histogram/parallel_histogram", "mpi", ["stats", "false"]),
+    "histogram_equalize": (
+        "histogram/parallel_histogram", "mpi", ["equalize", "false"]),
+    "histogram_clahe": (
+        "histogram/parallel_histogram", "mpi", ["clahe", "false"]),
+}
+
+# Matches the timing line every executable prints, e.g.
+#   "Parallel time: 5849 microseconds"
+#   "Parallel time with 4 threads: 914.672 milliseconds (double precision)"
+#   "Blur Processing Time: 0.56 seconds"
+#   "FFT time: 0.91 seconds (double precision)"
+TIME_PATTERN = re.compile(
+    r"(?:Parallel|Sequential|Processing|FFT) time[^:]*:\s*"
+    r"([0-9.eE+-]+)\s*(microseconds|milliseconds|seconds)",
+    re.IGNORECASE)
+UNIT_TO_MS = {"microseconds": 1e-3, "milliseconds": 1.0, "seconds": 1e3}
+
+# Roofline lines printed after the timing (see common/roofline.hpp), the STREAM
+# line only with ROOFLINE_PROBE=1
+ACHIEVED_PATTERN = re.compile(
+    r"Achieved: ([0-9.]+) GB/s(?:, ([0-9.]+) (?:GFLOP|Gop)/s)?")
+STREAM_PATTERN = re.compile(r"STREAM triad: ([0-9.]+) GB/s")
+
+# "kernel" row of the PERF_COUNTERS table (see common/perf_counters_mpi.hpp):
+# max ms, mean ms, cycles, instructions, LLC misses, dTLB misses, ...
+KERNEL_COUNTERS_PATTERN = re.compile(
+    r"^kernel\s+[0-9.]+\s+[0-9.]+\s+\S+\s+\S+\s+\S+\s+([0-9]+|n/a)",
+    re.MULTILINE)
+
+CSV_FIELDS = ["kernel", "mode", "launcher", "workers", "image", "width",
+              "height", "repetitions", "median_ms", "p95_ms", "min_ms",
+              "mean_ms", "stdev_ms", "gbps", "gops", "stream_gbps",
+              "dtlb_misses"]
+
+
+def parse_workers(text):
+    """Parse "1-10", "1,2,4,8" or a mix like "1-4,8,16" into a sorted list"""
+    workers = set()
+    for part in text.split(","):
+        if "-" in part:
+            low, high = part.split("-")
+            workers.update(range(int(low), int(high) + 1))
+        else:
+            workers.add(int(part))
+    if not workers or min(workers) < 1:
+        raise argparse.ArgumentTypeError("worker counts must be positive")
+    return sorted(workers)
+
+
+def weak_image(workers):
+    size = int(WEAK_BASE_SIZE * math.sqrt(workers))
+    path = os.path.join(DATA_DIR, "scaled_images", f"image_{size}x{size}.png")
+    return path, size, size
+
+
+def strong_image():
+    # The base image size is only recorded for the notebook, Pillow is
+    # already a plotting prerequisite
+    path = os.path.join(DATA_DIR, "input.jpg")
+    try:
+        from PIL import Image
+        with Image.open(path) as img:
+            return path, img.width, img.height
+    except (ImportError, OSError):
+        return path, 0, 0
+
+
+def parse_time_ms(output):
+    """Last timing line of the run in milliseconds, None if there is none"""
+    matches = TIME_PATTERN.findall(output)
+    if not matches:
+        return None
+    value, unit = matches[-1]
+    return float(value) * UNIT_TO_MS[unit.lower()]
+
+
+def parse_roofline(output):
+    """Achieved GB/s, G(FL)OP/s and STREAM GB/s of the run, None if missing"""
+    gbps = gops = stream_gbps = None
+    achieved = ACHIEVED_PATTERN.findall(output)
+    if achieved:
+        gbps = float(achieved[-1][0])
+        gops = float(achieved[-1][1]) if achieved[-1][1] else 0.0
+    stream = STREAM_PATTERN.findall(output)
+    if stream:
+        stream_gbps = float(stream[-1])
+    return gbps, gops, stream_gbps
+
+
+def parse_dtlb_misses(output):
+    """dTLB misses of the kernel phase, None without PERF_COUNTERS or perf"""
+    matches = KERNEL_COUNTERS_PATTERN.findall(output)
+    if not matches or matches[-1] == "n/a":
+        return None
+    return float(matches[-1])
+
+
+def run_once(command, env, timeout):
+    """Run one configuration, returning its time and roofline numbers"""
+    result = subprocess.run(command, env=env, capture_output=True, text=True,
+                            timeout=timeout)
+    if result.returncode != 0:
+        raise RuntimeError(f"{' '.join(command)} exited with "
+                           f"{result.returncode}:\n{result.stderr}")
+    time_ms = parse_time_ms(result.stdout)
+    if time_ms is None:
+        raise RuntimeError(f"no timing line in output of {' '.join(command)}:"
+                           f"\n{result.stdout}")
+    return ((time_ms,) + parse_roofline(result.stdout) +
+            (parse_dtlb_misses(result.stdout),))
+
+
+def percentile(samples, p):
+    """Nearest-rank percentile"""
+    ordered = sorted(samples)
+    rank = max(1, math.ceil(p / 100 * len(ordered)))
+    return ordered[rank - 1]
+
+
+def median_or_blank(values):
+    values = [v for v in values if v is not None]
+    return round(statistics.median(values), 4) if values else ""
+
+
+def summarize(record):
+    samples = record["samples_ms"]
+    summary = {key: record[key] for key in CSV_FIELDS[:7]}
+    summary.update({
+        "repetitions": len(samples),
+        "median_ms": round(statistics.median(samples), 4),
+        "p95_ms": round(percentile(samples, 95), 4),
+        "min_ms": round(min(samples), 4),
+        "mean_ms": round(statistics.mean(samples), 4),
+        "stdev_ms": round(statistics.stdev(samples), 4)
+        if len(samples) > 1 else 0.0,
+        "gbps": median_or_blank(record.get("gbps", [])),
+        "gops": median_or_blank(record.get("gops", [])),
+        "stream_gbps": median_or_blank(record.get("stream_gbps", [])),
+        "dtlb_misses": median_or_blank(record.get("dtlb_misses", [])),
+    })
+    return summary
+
+
+def record_key(record):
+    return (record["kernel"], record["mode"], record["workers"],
+            os.path.basename(record["image"]))
+
+
+def load_records(path):
+    if not os.path.exists(path):
+        return []
+    with open(path) as f:
+        return json.load(f)
+
+
+def save_results(output, records):
+    records.sort(key=lambda r: (r["kernel"], r["mode"], r["workers"]))
+    with open(output + ".json", "w") as f:
+        json.dump(records, f, indent=2)
+    with open(output + ".csv", "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=CSV_FIELDS)
+        writer.writeheader()
+        for record in records:
+            writer.writerow(summarize(record))
+
+
+def benchmark_kernel(name, args, env):
+    executable, launcher, extra_args = KERNELS[name]
+    executable = os.path.join(SRC_DIR, executable)
+    if not os.path.exists(executable):
+        print(f"Skipping {name}: {executable} not built", file=sys.stderr)
+        return []
+
+    worker_counts = [1] if launcher == "seq" else args.workers
+    records = []
+    for workers in worker_counts:
+        if args.mode == "weak":
+            image, width, height = weak_image(workers)
+        else:
+            image, width, height = strong_image()
+        if not os.path.exists(image):
+            print(f"Skipping {name} with {workers} workers: {image} missing",
+                  file=sys.stderr)
+            continue
+
+        command = [executable, image] + extra_args
+        run_env = dict(env)
+        if launcher == "mpi":
+            command = (["mpirun", "-np", str(workers)] +
+                       shlex.split(args.mpirun_args) + command)
+        elif launcher == "omp":
+            run_env["OMP_NUM_THREADS"] = str(workers)
+
+        for _ in range(args.warmup):
+            run_once(command, run_env, args.timeout)
+        runs = [run_once(command, run_env, args.timeout)
+                for _ in range(args.repetitions)]
+        samples, gbps, gops, stream_gbps, dtlb_misses = (
+            list(v) for v in zip(*runs))
+
+        record = {"kernel": name, "mode": args.mode, "launcher": launcher,
+                  "workers": workers, "image": os.path.relpath(image,
+                                                               PROJECT_ROOT),
+                  "width": width, "height": height, "samples_ms": samples,
+                  "gbps": gbps, "gops": gops, "stream_gbps": stream_gbps,
+                  "dtlb_misses": dtlb_misses}
+        summary = summarize(record)
+        print(f"{name:<26} {args.mode:<6} workers={workers:<3} "
+              f"median={summary['median_ms']:.3f} ms "
+              f"p95={summary['p95_ms']:.3f} ms"
+              + (f" {summary['gbps']} GB/s" if summary["gbps"] != "" else "")
+              + (f" {summary['dtlb_misses']:.0f} dTLB misses"
+                 if summary["dtlb_misses"] != "" else ""))
+        records.append(record)
+    return records
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run the scalability benchmarks and collect the timings "
+                    "as CSV/JSON")
+    parser.add_argument("mode", choices=["strong", "weak"])
+    parser.add_argument("--kernels", nargs="+", choices=sorted(KERNELS),
+                        default=sorted(KERNELS),
+                        help="kernels to run (default: all that are built)")
+    parser.add_argument("--workers", type=parse_workers, default="1-10",
+                        help="process/thread counts, e.g. 1-10 or 1,2,4,8")
+    parser.add_argument("--repetitions", type=int, default=5,
+                        help="measured runs per configuration")
+    parser.add_argument("--warmup", type=int, default=1,
+                        help="unmeasured runs before the measured ones")
+    parser.add_argument("--timeout", type=float, default=600,
+                        help="seconds before a single run is abandoned")
+    parser.add_argument("--roofline", action="store_true",
+                        help="run the STREAM bandwidth probe after every "
+                             "run (sets ROOFLINE_PROBE=1)")
+    parser.add_argument("--mpirun-args", default="",
+                        help="extra mpirun flags, e.g. '--oversubscribe'")
+    parser.add_argument("--output", default=DEFAULT_OUTPUT,
+                        help="output path without extension")
+    args = parser.parse_args()
+    if args.repetitions < 1 or args.warmup < 0:
+        parser.error("need at least one repetition and a non-negative warmup")
+
+    # The executables write their result images here instead of next to the
+    # timings the notebook reads
+    image_dir = os.path.join(os.path.dirname(args.output), "images")
+    os.makedirs(image_dir, exist_ok=True)
+    env = dict(os.environ, SEQ_OUTPUT_DIR=image_dir, PAR_OUTPUT_DIR=image_dir)
+    # A cached result or a dirty region update would replace the timed run
+    for name in ("RESULT_CACHE_DIR", "PREVIOUS_RESULT", "DIRTY_RECT"):
+        env.pop(name, None)
+    if args.roofline:
+        env["ROOFLINE_PROBE"] = "1"
+
+    records = {record_key(r): r for r in load_records(args.output + ".json")}
+    try:
+        for name in args.kernels:
+            for record in benchmark_kernel(name, args, env):
+                records[record_key(record)] = record
+    finally:
+        # Keep whatever finished if a run fails or is interrupted
+        save_results(args.output, list(records.values()))
+    print(f"Results written to {args.output}.csv and {args.output}.json")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,22 @@
+#!/bin/bash
+# Gain of the channel-count specialized kernels. Every kernel is run on the
+# scaled image set with RUNTIME_CHANNELS=1 (one instantiation per channel
+# type, looping over the channel count at run time) and without it (one
+# instantiation per channel count, moving whole pixels). Each setting is
+# written to output/benchmark/channels/<runtime|fixed>, extra flags such as
+# --workers are passed through to benchmark.py.
+cd "$(dirname "$0")"
+PROJECT_ROOT="$(cd .. && pwd)"
+OUTPUT_DIR="$PROJECT_ROOT/output/benchmark/channels"
+mkdir -p "$OUTPUT_DIR"
+
+KERNELS="color_transformation flip_vertical rotation gaussian_blur_sequential gaussian_blur_openmp"
+
+declare -A MODES=([runtime]=1 [fixed]=0)
+for mode in runtime fixed; do
+  echo "Start channel benchmark: $mode"
+  RUNTIME_CHANNELS=${MODES[$mode]} python3 benchmark.py weak \
+    --kernels $KERNELS --workers 1-10 \
+    --output "$OUTPUT_DIR/$mode" "$@"
+done
+echo "Finished channel benchmark, results in $OUTPUT_DIR"
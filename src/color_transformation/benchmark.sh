@@ -1,9 +1,10 @@
 #!/bin/bash
-export PROJECT_ROOT="/Users/joseph280996/Code/School/PHPC/Project"
+export PROJECT_ROOT="$(cd "$(dirname "$0")/../.." && pwd)"
 export SEQ_OUTPUT_DIR="$PROJECT_ROOT/output/sequential"
 export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/parallel"
+mkdir -p "$SEQ_OUTPUT_DIR" "$PAR_OUTPUT_DIR"
 
 echo "Start image color transform"
-mpirun -np 8 ./parallel_color_transformation /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg 23 255 52
+mpirun --bind-to core --map-by numa -np 8 ./parallel_color_transformation "$PROJECT_ROOT/data/input.jpg" 23 255 52
 echo "Finished color transformation"
 
@@ -1,69 +1,276 @@
+#include <array>
 #include <chrono>
+#include <cmath>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <mpi.h>
 #include <opencv2/opencv.hpp>
 #include <string>
+#include <type_traits>
 #include <unistd.h>
 
+#include "../common/batch_mpi.hpp"
+#include "../common/buffer_pool_mpi.hpp"
+#include "../common/node_comm.hpp"
+#include "../common/perf_counters_mpi.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/result_cache_mpi.hpp"
+#include "../common/roi.hpp"
+#include "../common/roofline.hpp"
+#include "../common/shared_window.hpp"
+#include "../common/stream_mpi.hpp"
+#include "../common/trace_mpi.hpp"
+
 using namespace cv;
 using namespace std;
 using namespace std::chrono;
 namespace fs = std::filesystem;
 
-// Clamp value between 0 and 255
-inline uchar clamp_color(int val) {
-  if (val < 0)
-    val = 0;
-  if (val > 255)
-    val = 255;
-  return (uchar)val;
+// Sum of a channel value and an increment, in which the clamp is done
+template <typename T>
+using channel_sum_t =
+    conditional_t<is_floating_point<T>::value, float, int>;
+
+// An increment given on the 8-bit scale, on the scale of T: 257 times as
+// large for 16-bit channels and a 255th for float ones
+template <typename T> channel_sum_t<T> scale_increment(double increment) {
+  if constexpr (is_floating_point<T>::value) {
+    return (float)(increment / 255);
+  } else {
+    return (int)lround(increment * (numeric_limits<T>::max() / 255));
+  }
 }
 
-void increase_channels_sequential(Mat &image, int red_inc, int green_inc,
-                                  int blue_inc) {
+// The increment of each channel of a pixel. OpenCV default is BGR order:
+// channel 0: Blue, channel 1: Green, channel 2: Red, and an alpha channel 3
+// is left as it is. A gray pixel gets the luma-weighted sum of the three.
+template <typename T>
+array<channel_sum_t<T>, 4> channel_increments(int channels, int red_inc,
+                                              int green_inc, int blue_inc) {
+  array<channel_sum_t<T>, 4> increments{};
+  if (channels == 1) {
+    increments[0] = scale_increment<T>(0.299 * red_inc + 0.587 * green_inc +
+                                       0.114 * blue_inc);
+  } else {
+    increments[0] = scale_increment<T>(blue_inc);
+    increments[1] = scale_increment<T>(green_inc);
+    increments[2] = scale_increment<T>(red_inc);
+  }
+  return increments;
+}
+
+template <typename T, int CN>
+void increase_channels_sequential(
+    Mat &image, const array<channel_sum_t<T>, 4> &increments) {
   int rows = image.rows;
   int cols = image.cols;
-  int channels = image.channels();
+  const int cn = channelCount<CN>(image.channels());
 
-  // OpenCV default is BGR order:
-  // channel 0: Blue, channel 1: Green, channel 2: Red (for a 3-channel image)
   for (int r = 0; r < rows; r++) {
-    uchar *row = image.ptr(r);
+    T *row = image.ptr<T>(r);
     for (int c = 0; c < cols; c++) {
-      int base_idx = c * channels;
-      int blue_val = row[base_idx + 0] + blue_inc;
-      int green_val = row[base_idx + 1] + green_inc;
-      int red_val = row[base_idx + 2] + red_inc;
-
-      row[base_idx + 0] = clamp_color(blue_val);
-      row[base_idx + 1] = clamp_color(green_val);
-      row[base_idx + 2] = clamp_color(red_val);
+      T *pixel = row + c * cn;
+      for (int k = 0; k < cn; k++) {
+        pixel[k] = clampChannel<T>(pixel[k] + increments[k]);
+      }
     }
   }
 }
 
-void increase_channels_parallel(uchar *shared_data, int rows, int cols,
-                                int channels, int rank, int num_processes,
-                                int red_inc, int green_inc, int blue_inc) {
-  int block_size = rows / num_processes;
-  int start_row = rank * block_size;
-  int end_row = (rank == num_processes - 1) ? rows : (rank + 1) * block_size;
+void increase_channels_sequential(Mat &image, int red_inc, int green_inc,
+                                  int blue_inc) {
+  dispatchPixelType(image.type(), [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    increase_channels_sequential<T, CN>(
+        image, channel_increments<T>(image.channels(), red_inc, green_inc,
+                                     blue_inc));
+  });
+}
+
+// Every channel value is read and written once, with one add and two clamp
+// comparisons
+KernelCost increase_channels_cost(int rows, int cols, int channels,
+                                  size_t channel_bytes) {
+  double values = (double)rows * cols * channels;
+  return {2 * values * channel_bytes, 3 * values, false};
+}
 
-  for (int r = start_row; r < end_row; r++) {
-    for (int c = 0; c < cols; c++) {
-      int base_idx = (r * cols + c) * channels;
-      int blue_val = shared_data[base_idx + 0] + blue_inc;
-      int green_val = shared_data[base_idx + 1] + green_inc;
-      int red_val = shared_data[base_idx + 2] + red_inc;
-
-      shared_data[base_idx + 0] = clamp_color(blue_val);
-      shared_data[base_idx + 1] = clamp_color(green_val);
-      shared_data[base_idx + 2] = clamp_color(red_val);
+// Pixels [start_pixel, end_pixel) of the image in row-major order
+template <typename T, int CN>
+void increase_channels_parallel(
+    uchar *shared_data, long start_pixel, long end_pixel, int channels,
+    const array<channel_sum_t<T>, 4> &increments) {
+  T *pixels = reinterpret_cast<T *>(shared_data);
+  const int cn = channelCount<CN>(channels);
+  for (long p = start_pixel; p < end_pixel; p++) {
+    T *pixel = pixels + p * cn;
+    for (int k = 0; k < cn; k++) {
+      pixel[k] = clampChannel<T>(pixel[k] + increments[k]);
     }
   }
 }
 
+// Increase the channels of rank 0's image in the node-shared windows of
+// workspace and hand the result to save on rank 0. Returns the kernel time.
+// Collective over MPI_COMM_WORLD.
+duration<double>
+increase_channels_shared(const NodeComms &nodes, PhaseCounters &counters,
+                         SharedWorkspace &workspace, Mat &image, int red_inc,
+                         int green_inc, int blue_inc,
+                         const function<void(const Mat &)> &save) {
+  int rank, num_processes;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+
+  int dims[3] = {image.rows, image.cols, image.type()};
+
+  // Broadcast dimensions and pixel type to all processes
+  MPI_Bcast(dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  long pixel_bytes = CV_ELEM_SIZE(dims[2]);
+
+  // The pixels are split into one balanced, page aligned part per rank. Each
+  // node holds the slab of its ranks' parts, which it splits again between
+  // them, and each rank's part of the shared slab is placed on its own NUMA
+  // node.
+  Partition partition((long)dims[0] * dims[1], pixel_bytes, num_processes);
+  WorkRange slab = nodes.slab(partition);
+  long slab_bytes = (slab.end - slab.begin) * pixel_bytes;
+  Partition node_partition(slab.end - slab.begin, pixel_bytes,
+                           nodes.node_size);
+  WorkRange part = node_partition.part(nodes.node_rank);
+  SharedImageWindow &window = workspace.window(
+      0, slab_bytes, {{part.begin * pixel_bytes, part.end * pixel_bytes}});
+  uchar *sharedData = window.data();
+  SharedChunkCounter &next_chunk = workspace.chunkCounter();
+  NodeBarrier &node_barrier = workspace.barrier();
+
+  // Bytes of the image on every node, known to the leaders
+  vector<WorkRange> node_bytes;
+  if (nodes.isLeader()) {
+    for (const WorkRange &node_slab : nodes.nodeSlabs(partition)) {
+      node_bytes.push_back(
+          {node_slab.begin * pixel_bytes, node_slab.end * pixel_bytes});
+    }
+  }
+
+  // Root scatters the slabs to the node leaders' shared memory
+  if (nodes.isLeader()) {
+    counters.begin("copy");
+    scatterSlabs(nodes, image.data, node_bytes, sharedData, slab_bytes);
+    counters.end();
+  }
+
+  // Ensure all processes see the initial data
+  node_barrier.wait({&window});
+
+  // Start parallel timing
+  auto start = high_resolution_clock::now();
+
+  // Each process increases its portion of red, green, and blue channels
+  counters.begin("kernel");
+  dispatchPixelType(dims[2], [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    int channels = CV_MAT_CN(dims[2]);
+    auto increments =
+        channel_increments<T>(channels, red_inc, green_inc, blue_inc);
+    runPartition(node_partition, nodes.node_rank, next_chunk.get(),
+                 [&](long begin, long end) {
+                   increase_channels_parallel<T, CN>(
+                       sharedData, begin, end, channels, increments);
+                 });
+  });
+  counters.end();
+
+  // Wait for all processes to complete
+  counters.begin("barrier");
+  node_barrier.wait({&window});
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    MPI_Barrier(nodes.leaders);
+  }
+  counters.end();
+  auto stop = high_resolution_clock::now();
+
+  // Root gathers the slabs of the other nodes, on a single node the shared
+  // slab is the whole image
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    counters.begin("gather");
+    gatherSlabs(nodes, sharedData, slab_bytes, node_bytes, image.data);
+    counters.end();
+  }
+
+  if (rank == 0) {
+    save(nodes.num_nodes > 1
+             ? image
+             : Mat(dims[0], dims[1], dims[2], sharedData));
+  }
+
+  return stop - start;
+}
+
+// The batch mode of batch_mpi.hpp, results are written as <name>_color.jpg,
+// or with the extension resultExtension picks for other pixel types
+int increase_channels_batch(const NodeComms &nodes, PhaseCounters &counters,
+                            const string &input, int red_inc, int green_inc,
+                            int blue_inc) {
+  // Windows of the split images, allocated again only for a larger one
+  SharedWorkspace workspace(nodes.node);
+  auto decode = [](const string &path) { return readPixels(path); };
+  auto split = [&](Mat &image, ImagePool<Mat> &pool) {
+    // Copied out of the window, the encode overlaps the next image
+    Mat result;
+    increase_channels_shared(nodes, counters, workspace, image, red_inc,
+                             green_inc, blue_inc,
+                             [&](const Mat &shared_result) {
+                               result = pool.acquire();
+                               shared_result.copyTo(result);
+                             });
+    return result;
+  };
+  auto whole = [&](Mat &image, ImagePool<Mat> &) {
+    TraceScope scope("kernel");
+    increase_channels_sequential(image, red_inc, green_inc, blue_inc);
+    return image;
+  };
+  auto encode = [](const Mat &result, const string &path) {
+    return imwrite(
+        batchOutputPath(path, "color", resultExtension(result.type())),
+        result);
+  };
+  int status = runBatchMPI<Mat>(input, decode, split, whole, encode);
+  workspace.free();
+  return status;
+}
+
+// The streaming mode of stream_mpi.hpp, the bands are written in place to
+// parallel_color_result.ppm
+int increase_channels_stream(const NodeComms &nodes, PhaseCounters &counters,
+                             const string &input, int red_inc, int green_inc,
+                             int blue_inc) {
+  // Windows of the first, largest band, reused by the others
+  SharedWorkspace workspace(nodes.node);
+  auto process = [&](StreamBand &band) {
+    Mat image;
+    if (band.data != nullptr) {
+      image = Mat(band.count, band.cols, CV_8UC(band.channels), band.data);
+    }
+    return increase_channels_shared(
+               nodes, counters, workspace, image, red_inc, green_inc, blue_inc,
+               [&](const Mat &result) {
+                 counters.begin("encode");
+                 band.writer.writeRows(band.first, band.count, result.data);
+                 counters.end();
+               })
+        .count();
+  };
+  int status = runStreamMPI(counters, input, "color", false, 0, process);
+  workspace.free();
+  return status;
+}
+
 int main(int argc, char **argv) {
   if (argc != 6) {
     cout << "Usage: " << argv[0]
@@ -71,7 +278,14 @@ int main(int argc, char **argv) {
             "<with_sequential_flag>"
          << endl;
     cout << "Example: " << argv[0] << " input.jpg 50 0 0" << endl
-         << "This would add 50 to the red channel." << endl;
+         << "This would add 50 to the red channel." << endl
+         << "Increments are on the 8-bit scale, for 16-bit and float images "
+            "they are scaled to match."
+         << endl;
+    cout << "image_path may also be a directory or a .txt manifest of images"
+         << endl
+         << "With STREAM_BAND_BYTES set, a .ppm image is streamed in bands"
+         << endl;
     return -1;
   }
 
@@ -80,24 +294,98 @@ int main(int argc, char **argv) {
   int green_inc = stoi(argv[3]);
   int blue_inc = stoi(argv[4]);
 
-  MPI_Init(&argc, &argv);
+  // Batch mode decodes and encodes on helper threads
+  initMPIThreads(&argc, &argv);
 
-  int rank, num_processes;
+  int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
 
-  MPI_Comm nodeComm;
-  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
-                      &nodeComm);
+  NodeComms nodes(MPI_COMM_WORLD);
 
-  // Variables for shared memory
-  MPI_Win win;
-  uchar *sharedData;
-  int dims[3] = {0, 0, 0};
+  // Optional hardware counters of each phase, PERF_COUNTERS=1
+  PhaseCounters counters(
+      perfCountersEnabled(MPI_COMM_WORLD),
+      {"decode", "copy", "kernel", "barrier", "gather", "encode"});
+
+  if (isBatchInput(image_path) || isStreamInput(image_path)) {
+    int status =
+        isBatchInput(image_path)
+            ? increase_channels_batch(nodes, counters, image_path, red_inc,
+                                      green_inc, blue_inc)
+            : increase_channels_stream(nodes, counters, image_path, red_inc,
+                                       green_inc, blue_inc);
+    reportPhaseCounters(counters, MPI_COMM_WORLD);
+    reportBufferPoolStats(MPI_COMM_WORLD);
+    writeTraceMPI(MPI_COMM_WORLD);
+    nodes.free();
+    MPI_Finalize();
+    return status;
+  }
+
+  // The result of an earlier run on the same image with the same increments
+  const string with_sequential_flag = argv[5];
+  ResultCache cache(image_path, "color_transformation " + to_string(red_inc) +
+                                    " " + to_string(green_inc) + " " +
+                                    to_string(blue_inc));
+  auto restore = [&] {
+    return !cache.restore(string(std::getenv("PAR_OUTPUT_DIR")) +
+                          "/parallel_color_result")
+                .empty() &&
+           (with_sequential_flag != "true" ||
+            !cache.restore(string(std::getenv("SEQ_OUTPUT_DIR")) +
+                           "/sequential_color_result")
+                 .empty());
+  };
+  if (lookupResult(cache, MPI_COMM_WORLD, restore)) {
+    if (rank == 0) {
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
+
+  // Only the edited rectangle on top of the previous result, see roi.hpp
+  int dirty_done = 0;
+  if (rank == 0) {
+    DirtyRegion dirty = dirtyRegion();
+    if (!dirty.previous_path.empty()) {
+      string output_path = updateDirtyRegion(
+          image_path, dirty, false,
+          string(std::getenv("PAR_OUTPUT_DIR")) + "/parallel_color_result",
+          [&](const Mat &input, Mat &result) {
+            Rect rect = dirty.rect & Rect(0, 0, input.cols, input.rows);
+            if (!rect.empty()) {
+              Mat region = input(rect).clone();
+              increase_channels_sequential(region, red_inc, green_inc,
+                                           blue_inc);
+              Mat target = result(rect);
+              region.copyTo(target);
+            }
+            return rect;
+          });
+      if (!output_path.empty()) {
+        dirty_done = 1;
+      }
+    }
+  }
+  MPI_Bcast(&dirty_done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (dirty_done) {
+    if (rank == 0) {
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
+
+  Mat image;
 
   if (rank == 0) {
     // Read image and do sequential version
-    Mat image = imread(image_path);
+    counters.begin("decode");
+    image = readPixels(image_path);
+    counters.end();
     if (image.empty()) {
       cout << "Error: Could not read the image." << endl;
       MPI_Abort(MPI_COMM_WORLD, 1);
@@ -105,86 +393,77 @@ int main(int argc, char **argv) {
     }
 
     // Do sequential version
-    const string with_sequential_flag = argv[5];
     if (with_sequential_flag == "true") {
-      Mat seqImage = image.clone();
+      // Copy into a pooled buffer rather than clone() a fresh allocation
+      PooledBuffer seqBuffer(image.total() * image.elemSize());
+      Mat seqImage(image.rows, image.cols, image.type(), seqBuffer.data());
+      image.copyTo(seqImage);
       auto start = high_resolution_clock::now();
       increase_channels_sequential(seqImage, red_inc, green_inc, blue_inc);
       auto stop = high_resolution_clock::now();
       cout << "Sequential time: "
            << duration_cast<microseconds>(stop - start).count()
            << " microseconds" << endl;
+      printRoofline(increase_channels_cost(image.rows, image.cols,
+                                           image.channels(), image.elemSize1()),
+                    duration<double>(stop - start).count());
 
       const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
-      string seq_out_path = string(output_dir) + "/sequential_color_result.jpg";
+      string seq_out_path = string(output_dir) + "/sequential_color_result" +
+                            resultExtension(image.type());
       bool success = imwrite(seq_out_path, seqImage);
       if (!success) {
         cout << "Error: Could not write " << seq_out_path << endl;
       }
     }
-
-    // Share dimensions
-    dims[0] = image.rows;
-    dims[1] = image.cols;
-    dims[2] = image.channels();
   }
 
-  // Broadcast dimensions to all processes
-  MPI_Bcast(dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
-
-  // Allocate shared memory - only root allocates real size
-  size_t total_image_size = (rank == 0) ? dims[0] * dims[1] * dims[2] : 0;
-  MPI_Win_allocate_shared(total_image_size, 1, MPI_INFO_NULL, nodeComm,
-                          &sharedData, &win);
+  // The windows of the one image, released before MPI_Finalize
+  SharedWorkspace workspace(nodes.node);
+  duration<double> elapsed = increase_channels_shared(
+      nodes, counters, workspace, image, red_inc, green_inc, blue_inc,
+      [&](const Mat &result) {
+        // Save result
+        const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+        string parallel_output = string(output_dir) +
+                                 "/parallel_color_result" +
+                                 updatableResultExtension(result.type());
+        counters.begin("encode");
+        bool success =
+            imwrite(parallel_output, result); // Changed seqImage to result
+        counters.end();
+        if (!success) {
+          cout << "Error: Could not write " << parallel_output << endl;
+        } else {
+          cache.store(parallel_output);
+        }
+      });
 
-  // Non-root processes get pointer to root's memory
-  if (rank != 0) {
-    MPI_Aint shared_memory_size;
-    int disp_unit;
-    MPI_Win_shared_query(win, 0, &shared_memory_size, &disp_unit, &sharedData);
+  // Bandwidth ceiling of every rank streaming at the same time
+  double stream_gbps = 0;
+  if (rooflineProbeEnabled()) {
+    double rank_gbps = streamTriadBandwidth();
+    MPI_Reduce(&rank_gbps, &stream_gbps, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
   }
 
-  // Root copies image data to shared memory
   if (rank == 0) {
-    Mat image = imread(image_path);
-    memcpy(sharedData, image.data, total_image_size);
-  }
-
-  // Ensure all processes see the initial data
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  // Start parallel timing
-  auto start = high_resolution_clock::now();
-
-  // Each process increases its portion of red, green, and blue channels
-  increase_channels_parallel(sharedData, dims[0], dims[1], dims[2], rank,
-                             num_processes, red_inc, green_inc, blue_inc);
-
-  // Wait for all processes to complete
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  if (rank == 0) {
-    auto stop = high_resolution_clock::now();
     cout << "Parallel time: "
-         << duration_cast<microseconds>(stop - start).count() << " microseconds"
+         << duration_cast<microseconds>(elapsed).count() << " microseconds"
          << endl;
-
-    // Save result
-    Mat result(dims[0], dims[1], CV_8UC(dims[2]), sharedData);
-    const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
-    string parallel_output =
-        string(output_dir) +
-        "/parallel_color_result.jpg"; // Also fixed "sequential" to "parallel"
-                                      // in the filename
-    bool success =
-        imwrite(parallel_output, result); // Changed seqImage to result
-    if (!success) {
-      cout << "Error: Could not write " << parallel_output << endl;
-    }
+    printRoofline(increase_channels_cost(image.rows, image.cols,
+                                         image.channels(), image.elemSize1()),
+                  elapsed.count(), stream_gbps);
+  }
+  if (rank == 0) {
+    cache.report();
   }
+  reportPhaseCounters(counters, MPI_COMM_WORLD);
+  reportBufferPoolStats(MPI_COMM_WORLD);
+  writeTraceMPI(MPI_COMM_WORLD);
 
-  MPI_Win_free(&win);
-  MPI_Comm_free(&nodeComm);
+  workspace.free();
+  nodes.free();
   MPI_Finalize();
   return 0;
 }
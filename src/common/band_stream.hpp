@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#include "batch.hpp"
+
+// Streaming mode of the tools, for images larger than memory. With
+// STREAM_BAND_BYTES set, an 8-bit binary PPM (P6) or PGM (P5) input is read in
+// bands of whole rows of at most that many bytes. Each band is processed like
+// an image of its own and written to its place in a PPM/PGM result, so memory
+// is bounded by a few bands whatever the size of the image. JPEG and PNG
+// cannot be decoded a band at a time through OpenCV, so they are converted
+// first, e.g. with `vips copy mosaic.tif mosaic.ppm`.
+
+inline long streamBandBytes() {
+  const char *bytes = std::getenv("STREAM_BAND_BYTES");
+  return bytes != nullptr ? std::strtol(bytes, nullptr, 10) : 0;
+}
+
+inline bool isStreamInput(const std::string &path) {
+  std::string extension = lowercaseExtension(path);
+  return streamBandBytes() > 0 &&
+         (extension == ".ppm" || extension == ".pgm" || extension == ".pnm");
+}
+
+// Rows per band for rows of row_bytes, leaving room for halo rows above and
+// below. At least one row.
+inline int streamBandRows(long row_bytes, int halo = 0) {
+  return (int)std::max(1L, streamBandBytes() / row_bytes - 2L * halo);
+}
+
+// PAR_OUTPUT_DIR/parallel_<tag>_result.ppm, or .pgm for one channel
+inline std::string streamOutputPath(const std::string &tag, int channels) {
+  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+  return std::string(output_dir) + "/parallel_" + tag + "_result" +
+         (channels == 1 ? ".pgm" : ".ppm");
+}
+
+// PPM stores RGB and OpenCV BGR, swap the first and third channel of count
+// pixels
+inline void swapRedBlue(unsigned char *data, long count, int channels) {
+  if (channels != 3) {
+    return;
+  }
+  for (long p = 0; p < count; p++) {
+    std::swap(data[p * 3], data[p * 3 + 2]);
+  }
+}
+
+// Reads rows of a binary PPM/PGM at any position, in OpenCV's channel order
+class PnmBandReader {
+private:
+  int fd = -1;
+  off_t data_offset = 0;
+
+public:
+  int rows = 0, cols = 0, channels = 0;
+
+  ~PnmBandReader() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  // False, with the reason on stderr, if path is not an 8-bit binary PPM/PGM
+  bool open(const std::string &path) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Error: Could not open " << path << std::endl;
+      return false;
+    }
+    char header[1024];
+    ssize_t length = pread(fd, header, sizeof(header), 0);
+    // Magic number, width, height and maximum value, separated by
+    // whitespace and comments, then a single whitespace before the pixels
+    ssize_t i = 2;
+    auto number = [&](long &value) {
+      while (i < length &&
+             (std::isspace((unsigned char)header[i]) || header[i] == '#')) {
+        if (header[i] == '#') {
+          while (i < length && header[i] != '\n') {
+            i++;
+          }
+        } else {
+          i++;
+        }
+      }
+      ssize_t start = i;
+      value = 0;
+      while (i < length && std::isdigit((unsigned char)header[i])) {
+        value = value * 10 + (header[i++] - '0');
+      }
+      return i > start;
+    };
+    long width, height, max_value;
+    bool binary = length > 2 && header[0] == 'P' &&
+                  (header[1] == '5' || header[1] == '6');
+    if (!binary || !number(width) || !number(height) || !number(max_value) ||
+        max_value != 255 || i >= length ||
+        !std::isspace((unsigned char)header[i])) {
+      std::cerr << "Error: " << path
+                << " is not an 8-bit binary PPM or PGM image" << std::endl;
+      return false;
+    }
+    cols = (int)width;
+    rows = (int)height;
+    channels = header[1] == '6' ? 3 : 1;
+    data_offset = i + 1;
+    return true;
+  }
+
+  long rowBytes() const { return (long)cols * channels; }
+
+  // Rows [first, first + count) into data
+  bool read(int first, int count, unsigned char *data) {
+    long bytes = rowBytes() * count;
+    off_t offset = data_offset + (off_t)rowBytes() * first;
+    for (long done = 0; done < bytes;) {
+      ssize_t n = pread(fd, data + done, bytes - done, offset + done);
+      if (n <= 0) {
+        std::cerr << "Error: Could not read rows " << first << " to "
+                  << first + count << std::endl;
+        return false;
+      }
+      done += n;
+    }
+    swapRedBlue(data, (long)cols * count, channels);
+    return true;
+  }
+};
+
+// Writes rows, or runs of pixels within a row, of a binary PPM/PGM at any
+// position. The file is sized up front, so bands may arrive in any order.
+class PnmBandWriter {
+private:
+  int fd = -1;
+  off_t data_offset = 0;
+  bool failed = false;
+  // The RGB copy of the pixels being written
+  std::vector<unsigned char> swapped;
+
+  // Swapped to RGB a piece at a time, so the copy stays small
+  static constexpr long PIECE_BYTES = 3 << 18;
+
+  bool writeAt(off_t offset, const unsigned char *data, long bytes) {
+    for (long piece = 0; piece < bytes; piece += PIECE_BYTES) {
+      long piece_bytes = std::min(PIECE_BYTES, bytes - piece);
+      const unsigned char *source = data + piece;
+      if (channels == 3) {
+        swapped.assign(source, source + piece_bytes);
+        swapRedBlue(swapped.data(), piece_bytes / 3, 3);
+        source = swapped.data();
+      }
+      for (long done = 0; done < piece_bytes;) {
+        ssize_t n = pwrite(fd, source + done, piece_bytes - done,
+                           offset + piece + done);
+        if (n <= 0) {
+          failed = true;
+          return false;
+        }
+        done += n;
+      }
+    }
+    return true;
+  }
+
+public:
+  int rows = 0, cols = 0, channels = 0;
+
+  ~PnmBandWriter() { close(); }
+
+  bool open(const std::string &path, int rows, int cols, int channels) {
+    this->rows = rows;
+    this->cols = cols;
+    this->channels = channels;
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      std::cerr << "Error: Could not write " << path << std::endl;
+      return false;
+    }
+    std::string header = std::string(channels == 3 ? "P6" : "P5") + "\n" +
+                         std::to_string(cols) + " " + std::to_string(rows) +
+                         "\n255\n";
+    data_offset = header.size();
+    return pwrite(fd, header.data(), header.size(), 0) ==
+               (ssize_t)header.size() &&
+           ftruncate(fd, data_offset + (off_t)rows * cols * channels) == 0;
+  }
+
+  // count rows of data as rows [first, first + count)
+  bool writeRows(int first, int count, const unsigned char *data) {
+    long row_bytes = (long)cols * channels;
+    return writeAt(data_offset + (off_t)row_bytes * first, data,
+                   row_bytes * count);
+  }
+
+  // count pixels of data as row row, starting at column col
+  bool writePixels(int row, int col, int count, const unsigned char *data) {
+    return writeAt(data_offset + ((off_t)row * cols + col) * channels, data,
+                   (long)count * channels);
+  }
+
+  // Whether every write so far succeeded
+  bool good() const { return !failed; }
+
+  void close() {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+};
+
+inline void printStreamReport(int bands, int band_rows, double seconds) {
+  std::cout << "Stream: " << bands << " bands of up to " << band_rows
+            << " rows in " << seconds * 1000 << " milliseconds" << std::endl;
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "trace.hpp"
+
+// Batch mode of the tools. The image path may name a directory of images or
+// a manifest (.txt or .lst, one image path per line, relative to the
+// manifest) instead of one image. Images whose file is at least
+// BATCH_SPLIT_BYTES (1 MB by default) are split across every worker one after
+// another like a single image. Smaller images are processed whole, one image
+// per worker, so they do not pay for the synchronisation of a split. Each
+// worker runs a three-stage pipeline: a decoder thread reads ahead, the
+// worker computes, and an encoder thread writes the results behind it, with
+// bounded queues in between so memory stays limited to a few images. Without
+// threads, e.g. when MPI does not allow them, the stages run in turn on the
+// worker.
+
+struct BatchItem {
+  std::string path;
+  uintmax_t file_bytes;
+};
+
+inline std::string lowercaseExtension(const std::filesystem::path &path) {
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return extension;
+}
+
+inline bool isImageFile(const std::filesystem::path &path) {
+  static const std::vector<std::string> extensions = {
+      ".jpg", ".jpeg", ".png", ".bmp", ".ppm", ".pgm", ".tif", ".tiff"};
+  std::string extension = lowercaseExtension(path);
+  return std::find(extensions.begin(), extensions.end(), extension) !=
+         extensions.end();
+}
+
+inline bool isBatchInput(const std::string &path) {
+  std::string extension = lowercaseExtension(path);
+  return std::filesystem::is_directory(path) || extension == ".txt" ||
+         extension == ".lst";
+}
+
+// The images of a directory in name order, or of a manifest in its order.
+// Blank lines and lines starting with '#' in a manifest are skipped. Paths
+// that cannot be read are left out with a warning.
+inline std::vector<BatchItem> batchItems(const std::string &input) {
+  namespace fs = std::filesystem;
+  std::vector<fs::path> paths;
+  if (fs::is_directory(input)) {
+    for (const fs::directory_entry &entry : fs::directory_iterator(input)) {
+      if (entry.is_regular_file() && isImageFile(entry.path())) {
+        paths.push_back(entry.path());
+      }
+    }
+    std::sort(paths.begin(), paths.end());
+  } else {
+    std::ifstream manifest(input);
+    fs::path base = fs::path(input).parent_path();
+    std::string line;
+    while (std::getline(manifest, line)) {
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      fs::path path(line);
+      paths.push_back(path.is_absolute() ? path : base / path);
+    }
+  }
+
+  std::vector<BatchItem> items;
+  for (const fs::path &path : paths) {
+    std::error_code error;
+    uintmax_t bytes = fs::file_size(path, error);
+    if (error) {
+      std::cerr << "Warning: skipping " << path.string() << ": "
+                << error.message() << std::endl;
+      continue;
+    }
+    items.push_back({path.string(), bytes});
+  }
+  return items;
+}
+
+inline uintmax_t batchSplitBytes() {
+  const char *bytes = std::getenv("BATCH_SPLIT_BYTES");
+  return bytes != nullptr ? std::strtoull(bytes, nullptr, 10) : 1 << 20;
+}
+
+// Images at least split_bytes large first, then the rest
+inline std::pair<std::vector<BatchItem>, std::vector<BatchItem>>
+splitBatch(const std::vector<BatchItem> &items, uintmax_t split_bytes) {
+  std::pair<std::vector<BatchItem>, std::vector<BatchItem>> parts;
+  for (const BatchItem &item : items) {
+    (item.file_bytes >= split_bytes ? parts.first : parts.second)
+        .push_back(item);
+  }
+  return parts;
+}
+
+// Images processed whole, largest first to the least loaded of num_workers
+// workers by file size. Deterministic, so every worker can compute it.
+inline std::vector<std::vector<std::string>>
+assignWhole(std::vector<BatchItem> items, int num_workers) {
+  std::stable_sort(items.begin(), items.end(),
+                   [](const BatchItem &a, const BatchItem &b) {
+                     return a.file_bytes > b.file_bytes;
+                   });
+  std::vector<std::vector<std::string>> assignment(num_workers);
+  std::vector<uintmax_t> load(num_workers, 0);
+  for (const BatchItem &item : items) {
+    int worker = std::min_element(load.begin(), load.end()) - load.begin();
+    assignment[worker].push_back(item.path);
+    load[worker] += item.file_bytes;
+  }
+  return assignment;
+}
+
+// PAR_OUTPUT_DIR/<input name>_<tag><extension>
+inline std::string batchOutputPath(const std::string &input,
+                                   const std::string &tag,
+                                   const std::string &extension = ".jpg") {
+  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+  return std::string(output_dir) + "/" +
+         std::filesystem::path(input).stem().string() + "_" + tag + extension;
+}
+
+// Blocking queue of at most capacity items between pipeline stages
+template <typename T> class BoundedQueue {
+private:
+  size_t capacity;
+  std::deque<T> items;
+  bool closed = false;
+  std::mutex mutex;
+  std::condition_variable changed;
+
+public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+  // Waits for room, false if the queue was closed instead
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return items.size() < capacity || closed; });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    changed.notify_all();
+    return true;
+  }
+
+  // Waits for an item, false once the queue is closed and drained
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return !items.empty() || closed; });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    changed.notify_all();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    changed.notify_all();
+  }
+};
+
+// Image buffers recycled between the images of a batch. An image of the
+// same size reuses a released buffer instead of allocating, e.g. through
+// cv::Mat::create. Only images nothing else refers to may be released.
+template <typename Image> class ImagePool {
+private:
+  static constexpr size_t MAX_SPARE = 4;
+
+  std::vector<Image> spare;
+  std::mutex mutex;
+
+public:
+  Image acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spare.empty()) {
+      return Image();
+    }
+    Image image = std::move(spare.back());
+    spare.pop_back();
+    return image;
+  }
+
+  void release(Image image) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spare.size() < MAX_SPARE) {
+      spare.push_back(std::move(image));
+    }
+  }
+};
+
+// Decoder stage: decodes paths in order on a thread of its own. With the
+// one image queued, it works on image N+2 while the caller computes image
+// N+1 and the Encoder writes image N. Unthreaded, next() decodes the image
+// itself.
+template <typename Image> class Prefetcher {
+private:
+  std::vector<std::string> paths;
+  std::function<Image(const std::string &)> decode;
+  BoundedQueue<std::pair<Image, std::string>> decoded;
+  std::thread worker;
+  size_t next_path = 0; // unthreaded
+
+  void run() {
+    for (const std::string &path : paths) {
+      Image image;
+      {
+        TraceScope scope("decode", "io");
+        image = decode(path);
+      }
+      if (!decoded.push({std::move(image), path})) {
+        return;
+      }
+    }
+    decoded.close();
+  }
+
+public:
+  Prefetcher(std::vector<std::string> paths,
+             std::function<Image(const std::string &)> decode,
+             size_t depth = 1, bool threaded = true)
+      : paths(std::move(paths)), decode(std::move(decode)), decoded(depth) {
+    if (threaded) {
+      worker = std::thread(&Prefetcher::run, this);
+    }
+  }
+
+  ~Prefetcher() {
+    decoded.close();
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  Prefetcher(const Prefetcher &) = delete;
+  Prefetcher &operator=(const Prefetcher &) = delete;
+
+  // The next image and its path, false once every image has been taken
+  bool next(Image &image, std::string &path) {
+    if (!worker.joinable()) {
+      if (next_path == paths.size()) {
+        return false;
+      }
+      path = paths[next_path++];
+      TraceScope scope("decode", "io");
+      image = decode(path);
+      return true;
+    }
+    std::pair<Image, std::string> item;
+    if (!decoded.pop(item)) {
+      return false;
+    }
+    image = std::move(item.first);
+    path = std::move(item.second);
+    return true;
+  }
+};
+
+// Encoder stage: encodes submitted images on a thread of its own and
+// releases them to the pool afterwards, so the caller can go on with the
+// next image. submit() only waits when depth images are already queued.
+// Unthreaded, submit() encodes the image itself.
+template <typename Image> class Encoder {
+private:
+  std::function<bool(const Image &, const std::string &)> encode;
+  ImagePool<Image> &pool;
+  BoundedQueue<std::pair<Image, std::string>> pending;
+  std::atomic<long> failed{0};
+  std::thread worker;
+
+  bool threaded;
+
+  void write(std::pair<Image, std::string> &item) {
+    bool success;
+    {
+      TraceScope scope("encode", "io");
+      success = encode(item.first, item.second);
+    }
+    if (!success) {
+      std::cerr << "Error: Could not write the result of " << item.second
+                << std::endl;
+      failed++;
+    }
+    pool.release(std::move(item.first));
+  }
+
+  void run() {
+    std::pair<Image, std::string> item;
+    while (pending.pop(item)) {
+      write(item);
+    }
+  }
+
+public:
+  Encoder(std::function<bool(const Image &, const std::string &)> encode,
+          ImagePool<Image> &pool, size_t depth = 2, bool threaded = true)
+      : encode(std::move(encode)), pool(pool), pending(depth),
+        threaded(threaded) {
+    if (threaded) {
+      worker = std::thread(&Encoder::run, this);
+    }
+  }
+
+  ~Encoder() { finish(); }
+
+  Encoder(const Encoder &) = delete;
+  Encoder &operator=(const Encoder &) = delete;
+
+  void submit(Image image, const std::string &path) {
+    if (!threaded) {
+      std::pair<Image, std::string> item{std::move(image), path};
+      write(item);
+      return;
+    }
+    pending.push({std::move(image), path});
+  }
+
+  // Waits for every submitted image, returns how many failed to encode
+  long finish() {
+    pending.close();
+    if (worker.joinable()) {
+      worker.join();
+    }
+    return failed;
+  }
+};
+
+inline void printBatchReport(long images, long split_images, long failed,
+                             double seconds) {
+  std::cout << "Batch: " << images << " images (" << split_images
+            << " split across workers, " << failed << " failed) in "
+            << seconds * 1000 << " milliseconds, " << images / seconds
+            << " images/sec" << std::endl;
+}
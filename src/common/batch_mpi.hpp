@@ -0,0 +1,157 @@
+#pragma once
+
+#include <chrono>
+#include <mpi.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "batch.hpp"
+#include "trace.hpp"
+
+// MPI_Init for tools with helper threads that make no MPI calls, such as the
+// batch mode's decoder and encoder. Returns the thread level MPI provides.
+inline int initMPIThreads(int *argc, char ***argv) {
+  int provided;
+  MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+  return provided;
+}
+
+// Batch mode of the MPI tools, see batch.hpp. Large images are processed one
+// after another by every rank through process_split(image, pool), which is
+// collective over MPI_COMM_WORLD with the image only decoded on rank 0 and
+// returns the result there. Small images are divided between the ranks and
+// each rank runs process_whole(image, pool) on its own. Results are written
+// with encode(result, path) on a helper thread, so ranks go on computing
+// while rank 0 decodes and encodes the split images. decode(path) returns an
+// empty image when the file cannot be decoded. The helper threads need
+// MPI_THREAD_FUNNELED, see initMPIThreads(). With a lower thread level the
+// codec work runs in turn on the ranks instead. Rank 0 prints the throughput.
+// Returns 0, or -1 if the batch is empty or an image failed, on every rank.
+// Collective over MPI_COMM_WORLD.
+template <typename Image, typename Decode, typename Split, typename Whole,
+          typename Encode>
+int runBatchMPI(const std::string &input, Decode decode, Split process_split,
+                Whole process_whole, Encode encode) {
+  int rank, num_processes;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+
+  // Rank 0 lists the batch and shares it as "<bytes> <path>" lines
+  std::string listing;
+  if (rank == 0) {
+    std::ostringstream lines;
+    for (const BatchItem &item : batchItems(input)) {
+      lines << item.file_bytes << ' ' << item.path << '\n';
+    }
+    listing = lines.str();
+  }
+  long length = (long)listing.size();
+  MPI_Bcast(&length, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+  listing.resize(length);
+  MPI_Bcast(&listing[0], (int)length, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+  std::vector<BatchItem> items;
+  std::istringstream lines(listing);
+  BatchItem item;
+  while (lines >> item.file_bytes && lines.get() == ' ' &&
+         std::getline(lines, item.path)) {
+    items.push_back(item);
+  }
+  if (items.empty()) {
+    if (rank == 0) {
+      std::cerr << "Error: No images in " << input << std::endl;
+    }
+    return -1;
+  }
+  auto [split_items, whole_items] = splitBatch(items, batchSplitBytes());
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  auto start = std::chrono::steady_clock::now();
+
+  // Helper threads only where MPI allows threads beside the one calling it
+  int thread_level;
+  MPI_Query_thread(&thread_level);
+  bool threaded = thread_level >= MPI_THREAD_FUNNELED;
+  if (!threaded && rank == 0) {
+    std::cerr << "Warning: MPI provides no thread support, batch decoding "
+                 "and encoding run without helper threads"
+              << std::endl;
+  }
+
+  ImagePool<Image> pool;
+  Encoder<Image> encoder(encode, pool, 2, threaded);
+
+  // Large images: rank 0's helper threads decode the next one and encode
+  // the previous one during the split of the current one
+  std::vector<std::string> split_paths;
+  if (rank == 0) {
+    for (const BatchItem &split_item : split_items) {
+      split_paths.push_back(split_item.path);
+    }
+  }
+  Prefetcher<Image> split_prefetch(split_paths, decode, 1, threaded);
+  long split_failed = 0;
+  for (size_t i = 0; i < split_items.size(); i++) {
+    Image image;
+    std::string path = split_items[i].path;
+    int decoded = 1;
+    if (rank == 0) {
+      TraceScope scope("decode wait", "io");
+      split_prefetch.next(image, path);
+      decoded = image.empty() ? 0 : 1;
+    }
+    MPI_Bcast(&decoded, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!decoded) {
+      if (rank == 0) {
+        std::cerr << "Error: Could not read " << path << std::endl;
+      }
+      split_failed++;
+      continue;
+    }
+    Image result = process_split(image, pool);
+    if (rank == 0) {
+      encoder.submit(std::move(result), path);
+    }
+  }
+
+  // Small images: each rank computes one while its helper threads decode the
+  // next and encode the previous one
+  Prefetcher<Image> whole_prefetch(
+      assignWhole(whole_items, num_processes)[rank], decode, 1, threaded);
+  Image image;
+  std::string path;
+  long rank_failed = 0;
+  while (true) {
+    {
+      TraceScope scope("decode wait", "io");
+      if (!whole_prefetch.next(image, path)) {
+        break;
+      }
+    }
+    if (image.empty()) {
+      std::cerr << "Error: Could not read " << path << std::endl;
+      rank_failed++;
+      continue;
+    }
+    encoder.submit(process_whole(image, pool), path);
+  }
+  {
+    TraceScope scope("encode wait", "io");
+    rank_failed += encoder.finish();
+  }
+  long all_failed = 0;
+  MPI_Reduce(&rank_failed, &all_failed, 1, MPI_LONG, MPI_SUM, 0,
+             MPI_COMM_WORLD);
+  long failed = split_failed + all_failed;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  auto stop = std::chrono::steady_clock::now();
+  if (rank == 0) {
+    printBatchReport((long)items.size() - failed,
+                     (long)split_items.size() - split_failed, failed,
+                     std::chrono::duration<double>(stop - start).count());
+  }
+  MPI_Bcast(&failed, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+  return failed == 0 ? 0 : -1;
+}
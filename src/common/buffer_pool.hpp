@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "huge_pages.hpp"
+
+// Pool of image-sized buffers shared by the kernels of a process. Freed
+// buffers are kept in size classes, a quarter of a power of two apart, and
+// handed out again to the next request of that class, so a batch of images
+// of the same size allocates, and page faults on, its scratch buffers only
+// once. Buffers of 2 MB and up are aligned to 2 MB so they can be backed by
+// huge pages, see huge_pages.hpp. Requests below POOL_MIN_BYTES go straight
+// to the heap.
+// BUFFER_POOL_STATS=1 prints allocation statistics at exit of the tools.
+
+constexpr size_t POOL_MIN_BYTES = 64 << 10;
+
+struct BufferPoolStats {
+  long requests = 0;
+  long hits = 0;           // served from a freed buffer
+  long direct = 0;         // below POOL_MIN_BYTES, not pooled
+  long fresh = 0;          // newly allocated
+  long fresh_bytes = 0;    // bytes newly allocated
+  long huge_bytes = 0;     // of which madvise()d for huge pages
+  long in_use_bytes = 0;   // handed out and not yet returned
+  long peak_in_use_bytes = 0;
+  long cached_bytes = 0;   // returned and kept for reuse
+};
+
+inline bool bufferPoolStatsEnabled() {
+  const char *stats = std::getenv("BUFFER_POOL_STATS");
+  return stats != nullptr && std::string(stats) == "1";
+}
+
+class BufferPool {
+private:
+  // Returned buffers beyond this are released to the system
+  static constexpr size_t MAX_CACHED_BYTES = size_t(1) << 30;
+
+  HugePageMode huge_page_mode = hugePageMode();
+  std::mutex mutex;
+  // Free buffers of each size class
+  std::vector<std::vector<void *>> free_lists;
+  BufferPoolStats stats;
+
+  // Size classes 2^k, 1.25 * 2^k, 1.5 * 2^k and 1.75 * 2^k
+  static int sizeClass(size_t bytes) {
+    int k = 0;
+    while ((size_t(1) << (k + 1)) < bytes) {
+      k++;
+    }
+    size_t base = size_t(1) << k;
+    int quarter = (int)((bytes - base + base / 4 - 1) / (base / 4));
+    return k * 4 + quarter;
+  }
+
+  static size_t classBytes(int size_class) {
+    size_t base = size_t(1) << (size_class / 4);
+    return base + base / 4 * (size_class % 4);
+  }
+
+  void *allocateFresh(size_t bytes) {
+    bool huge = bytes >= HUGE_PAGE_BYTES;
+    size_t alignment = huge ? HUGE_PAGE_BYTES : CACHE_LINE;
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    void *p = std::aligned_alloc(alignment, bytes);
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    if (huge) {
+      stats.huge_bytes += adviseHugePages(p, bytes, huge_page_mode);
+    }
+    stats.fresh++;
+    stats.fresh_bytes += bytes;
+    return p;
+  }
+
+public:
+  static constexpr size_t CACHE_LINE = 64;
+
+  void *allocate(size_t bytes) {
+    if (bytes < POOL_MIN_BYTES) {
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.requests++;
+      stats.direct++;
+      return ::operator new(bytes, std::align_val_t(CACHE_LINE));
+    }
+    int size_class = sizeClass(bytes);
+    size_t class_bytes = classBytes(size_class);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.requests++;
+    stats.in_use_bytes += class_bytes;
+    stats.peak_in_use_bytes =
+        std::max(stats.peak_in_use_bytes, stats.in_use_bytes);
+    if (size_class < (int)free_lists.size() &&
+        !free_lists[size_class].empty()) {
+      void *p = free_lists[size_class].back();
+      free_lists[size_class].pop_back();
+      stats.hits++;
+      stats.cached_bytes -= class_bytes;
+      return p;
+    }
+    return allocateFresh(class_bytes);
+  }
+
+  void release(void *p, size_t bytes) {
+    if (p == nullptr) {
+      return;
+    }
+    if (bytes < POOL_MIN_BYTES) {
+      ::operator delete(p, std::align_val_t(CACHE_LINE));
+      return;
+    }
+    int size_class = sizeClass(bytes);
+    size_t class_bytes = classBytes(size_class);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.in_use_bytes -= class_bytes;
+    if (stats.cached_bytes + class_bytes > MAX_CACHED_BYTES) {
+      std::free(p);
+      return;
+    }
+    if (size_class >= (int)free_lists.size()) {
+      free_lists.resize(size_class + 1);
+    }
+    free_lists[size_class].push_back(p);
+    stats.cached_bytes += class_bytes;
+  }
+
+  BufferPoolStats statistics() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+  ~BufferPool() {
+    for (std::vector<void *> &free_list : free_lists) {
+      for (void *p : free_list) {
+        std::free(p);
+      }
+    }
+  }
+};
+
+inline BufferPool &bufferPool() {
+  static BufferPool pool;
+  return pool;
+}
+
+inline void printBufferPoolStats(const BufferPoolStats &stats) {
+  double mb = 1.0 / (1 << 20);
+  long pooled = stats.requests - stats.direct;
+  std::ios::fmtflags flags = std::cout.flags();
+  std::streamsize precision = std::cout.precision();
+  std::cout << std::fixed << std::setprecision(1)
+            << "Buffer pool: " << stats.requests << " requests, "
+            << stats.hits << " reused ("
+            << (pooled > 0 ? 100.0 * stats.hits / pooled : 0.0)
+            << "% of pooled), " << stats.direct << " below "
+            << (POOL_MIN_BYTES >> 10) << " KB" << std::endl
+            << "Buffer pool: " << stats.fresh << " allocations of "
+            << stats.fresh_bytes * mb << " MB (" << stats.huge_bytes * mb
+            << " MB huge page advised), peak in use "
+            << stats.peak_in_use_bytes * mb << " MB" << std::endl;
+  std::cout.flags(flags);
+  std::cout.precision(precision);
+}
+
+// This process's statistics, when BUFFER_POOL_STATS=1
+inline void reportBufferPoolStats() {
+  if (bufferPoolStatsEnabled()) {
+    printBufferPoolStats(bufferPool().statistics());
+  }
+}
+
+// Standard allocator over the pool, for std::vector scratch buffers
+template <typename T> struct PoolAllocator {
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <typename U> PoolAllocator(const PoolAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(bufferPool().allocate(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t n) { bufferPool().release(p, n * sizeof(T)); }
+
+  template <typename U> bool operator==(const PoolAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const PoolAllocator<U> &) const {
+    return false;
+  }
+};
+
+template <typename T> using PooledVector = std::vector<T, PoolAllocator<T>>;
+
+// Uninitialized pooled buffer of a fixed size, e.g. to back a cv::Mat header
+class PooledBuffer {
+private:
+  void *p = nullptr;
+  size_t bytes = 0;
+
+public:
+  PooledBuffer() = default;
+  explicit PooledBuffer(size_t bytes)
+      : p(bufferPool().allocate(bytes)), bytes(bytes) {}
+  ~PooledBuffer() { bufferPool().release(p, bytes); }
+
+  PooledBuffer(PooledBuffer &&other) noexcept
+      : p(std::exchange(other.p, nullptr)), bytes(other.bytes) {}
+  PooledBuffer &operator=(PooledBuffer &&other) noexcept {
+    std::swap(p, other.p);
+    std::swap(bytes, other.bytes);
+    return *this;
+  }
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+  unsigned char *data() const { return static_cast<unsigned char *>(p); }
+  size_t size() const { return bytes; }
+};
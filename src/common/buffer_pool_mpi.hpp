@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+#include <mpi.h>
+
+#include "buffer_pool.hpp"
+
+// Aggregation of the buffer pool statistics across the ranks of an MPI job
+
+// Whether to report, decided on the root so every rank agrees
+inline bool bufferPoolStatsEnabled(MPI_Comm comm, int root = 0) {
+  int enabled = bufferPoolStatsEnabled() ? 1 : 0;
+  MPI_Bcast(&enabled, 1, MPI_INT, root, comm);
+  return enabled != 0;
+}
+
+// Print the pool statistics summed over the ranks on the root, with the peak
+// in use of the largest rank. Collective over comm.
+inline void reportBufferPoolStats(MPI_Comm comm, int root = 0) {
+  if (!bufferPoolStatsEnabled(comm, root)) {
+    return;
+  }
+  BufferPoolStats local = bufferPool().statistics();
+  long counts[6] = {local.requests, local.hits,        local.direct,
+                    local.fresh,    local.fresh_bytes, local.huge_bytes};
+  long sums[6];
+  long peak = 0;
+  MPI_Reduce(counts, sums, 6, MPI_LONG, MPI_SUM, root, comm);
+  MPI_Reduce(&local.peak_in_use_bytes, &peak, 1, MPI_LONG, MPI_MAX, root,
+             comm);
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (rank != root) {
+    return;
+  }
+  BufferPoolStats total;
+  total.requests = sums[0];
+  total.hits = sums[1];
+  total.direct = sums[2];
+  total.fresh = sums[3];
+  total.fresh_bytes = sums[4];
+  total.huge_bytes = sums[5];
+  total.peak_in_use_bytes = peak;
+  printBufferPoolStats(total);
+}
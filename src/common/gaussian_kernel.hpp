@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+// Normalized 1D Gaussian kernel of 2 * radius + 1 taps, shared by both
+// Gaussian blurs and the Gaussian pyramid of the resize tools
+inline std::vector<float> createGaussianKernel(int radius, float sigma) {
+  int size = 2 * radius + 1;
+  std::vector<float> kernel(size);
+  float sum = 0.0f;
+
+  for (int x = -radius; x <= radius; x++) {
+    float exponent = -(x * x) / (2.0f * sigma * sigma);
+    kernel[x + radius] = std::exp(exponent) / (std::sqrt(2.0f * M_PI) * sigma);
+    sum += kernel[x + radius];
+  }
+
+  // Normalize kernel
+  for (int i = 0; i < size; i++) {
+    kernel[i] /= sum;
+  }
+
+  return kernel;
+}
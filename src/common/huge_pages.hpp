@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+
+// 2 MB transparent huge pages for the large buffers: the shared image windows
+// of the MPI tools and the buffer pool's scratch buffers. A strided pass over
+// a large image, like the rotation's column writes or an FFT column pass,
+// touches a new 4 KB page every few accesses, and one huge page covers 512 of
+// them in a single TLB entry. HUGE_PAGES=1 madvise()s the buffers for huge
+// pages, HUGE_PAGES=0 opts them out even where THP is "always", and without
+// it the kernel's THP setting decides.
+
+constexpr size_t HUGE_PAGE_BYTES = 2 << 20;
+
+enum HugePageMode {
+  HUGE_PAGES_SYSTEM = 0,
+  HUGE_PAGES_ON = 1,
+  HUGE_PAGES_OFF = 2
+};
+
+inline HugePageMode hugePageMode() {
+  const char *mode = std::getenv("HUGE_PAGES");
+  if (mode == nullptr) {
+    return HUGE_PAGES_SYSTEM;
+  }
+  return std::string(mode) == "0" ? HUGE_PAGES_OFF : HUGE_PAGES_ON;
+}
+
+// Advise the whole huge pages inside [p, p + bytes) according to mode, before
+// they are first touched. Returns the bytes advised for huge pages.
+inline size_t adviseHugePages(void *p, size_t bytes, HugePageMode mode) {
+  uintptr_t begin = reinterpret_cast<uintptr_t>(p);
+  uintptr_t first = (begin + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES *
+                    HUGE_PAGE_BYTES;
+  uintptr_t last = (begin + bytes) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+  if (mode == HUGE_PAGES_SYSTEM || last <= first) {
+    return 0;
+  }
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+  int advice = mode == HUGE_PAGES_ON ? MADV_HUGEPAGE : MADV_NOHUGEPAGE;
+  if (madvise(reinterpret_cast<void *>(first), last - first, advice) == 0 &&
+      mode == HUGE_PAGES_ON) {
+    return last - first;
+  }
+#endif
+  return 0;
+}
+
+// The selected value of a THP setting such as "shmem_enabled", e.g. "advise"
+// out of "always within_size [advise] never deny force", empty if unknown
+inline std::string transparentHugePageSetting(const std::string &name) {
+  std::ifstream file("/sys/kernel/mm/transparent_hugepage/" + name);
+  std::string word;
+  while (file >> word) {
+    if (word.size() > 2 && word.front() == '[' && word.back() == ']') {
+      return word.substr(1, word.size() - 2);
+    }
+  }
+  return "";
+}
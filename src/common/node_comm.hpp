@@ -0,0 +1,132 @@
+#pragma once
+
+#include <mpi.h>
+#include <vector>
+
+#include "partition.hpp"
+
+// Two-level layout of a multi-node MPI job. The ranks sharing memory form a
+// node and work on one slab of the image in a node-shared window. Node rank 0
+// is the node's leader, and the leaders have a communicator of their own
+// through which the root scatters the slabs and gathers the results. On a
+// single node the slab is the whole image.
+class NodeComms {
+public:
+  MPI_Comm node = MPI_COMM_NULL;
+  // MPI_COMM_NULL on the ranks that are not leaders
+  MPI_Comm leaders = MPI_COMM_NULL;
+  int node_rank = 0;
+  int node_size = 1;
+  int num_nodes = 1;
+  // A world-wide Partition has one part per rank. The ranks of a node take
+  // consecutive parts, starting at first_part.
+  int first_part = 0;
+  // Leaders only: the ranks and first part of every node
+  std::vector<int> node_sizes, node_first_parts;
+
+  // Collective over comm
+  explicit NodeComms(MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                        &node);
+    MPI_Comm_rank(node, &node_rank);
+    MPI_Comm_size(node, &node_size);
+    // Ordered by rank, so the root (rank 0) is also leader 0
+    MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+
+    if (isLeader()) {
+      int leader_rank;
+      MPI_Comm_rank(leaders, &leader_rank);
+      MPI_Comm_size(leaders, &num_nodes);
+      node_sizes.resize(num_nodes);
+      node_first_parts.resize(num_nodes);
+      MPI_Allgather(&node_size, 1, MPI_INT, node_sizes.data(), 1, MPI_INT,
+                    leaders);
+      for (int n = 1; n < num_nodes; n++) {
+        node_first_parts[n] = node_first_parts[n - 1] + node_sizes[n - 1];
+      }
+      first_part = node_first_parts[leader_rank];
+    }
+    int layout[2] = {num_nodes, first_part};
+    MPI_Bcast(layout, 2, MPI_INT, 0, node);
+    num_nodes = layout[0];
+    first_part = layout[1];
+  }
+
+  ~NodeComms() { free(); }
+
+  NodeComms(const NodeComms &) = delete;
+  NodeComms &operator=(const NodeComms &) = delete;
+
+  bool isLeader() const { return leaders != MPI_COMM_NULL; }
+
+  // Items of a world-wide partition on this node
+  WorkRange slab(const Partition &partition) const {
+    return {partition.part(first_part).begin,
+            partition.part(first_part + node_size - 1).end};
+  }
+
+  // Leaders only: the items of every node
+  std::vector<WorkRange> nodeSlabs(const Partition &partition) const {
+    std::vector<WorkRange> slabs;
+    for (int n = 0; n < num_nodes; n++) {
+      slabs.push_back(
+          {partition.part(node_first_parts[n]).begin,
+           partition.part(node_first_parts[n] + node_sizes[n] - 1).end});
+    }
+    return slabs;
+  }
+
+  // Collective, must be called before MPI_Finalize
+  void free() {
+    if (leaders != MPI_COMM_NULL) {
+      MPI_Comm_free(&leaders);
+    }
+    if (node != MPI_COMM_NULL) {
+      MPI_Comm_free(&node);
+    }
+  }
+};
+
+// Byte ranges of a root buffer per node, as MPI_Scatterv/Gatherv counts and
+// displacements. Slabs are limited to 2 GB by the int counts.
+inline void slabCounts(const std::vector<WorkRange> &byte_ranges,
+                       std::vector<int> &counts, std::vector<int> &displs) {
+  counts.clear();
+  displs.clear();
+  for (const WorkRange &range : byte_ranges) {
+    counts.push_back((int)(range.end - range.begin));
+    displs.push_back((int)range.begin);
+  }
+}
+
+// The root sends byte_ranges[n] of buffer to the slab of node n's leader.
+// buffer and byte_ranges are only read on the root. Collective over the
+// leaders, a no-op on the other ranks.
+inline void scatterSlabs(const NodeComms &nodes, const unsigned char *buffer,
+                         const std::vector<WorkRange> &byte_ranges,
+                         unsigned char *slab, long slab_bytes) {
+  if (!nodes.isLeader()) {
+    return;
+  }
+  std::vector<int> counts, displs;
+  slabCounts(byte_ranges, counts, displs);
+  MPI_Scatterv(buffer, counts.data(), displs.data(), MPI_BYTE, slab,
+               (int)slab_bytes, MPI_BYTE, 0, nodes.leaders);
+}
+
+// The reverse of scatterSlabs: every leader's slab into byte_ranges[n] of the
+// root's buffer
+inline void gatherSlabs(const NodeComms &nodes, const unsigned char *slab,
+                        long slab_bytes,
+                        const std::vector<WorkRange> &byte_ranges,
+                        unsigned char *buffer) {
+  if (!nodes.isLeader()) {
+    return;
+  }
+  std::vector<int> counts, displs;
+  slabCounts(byte_ranges, counts, displs);
+  MPI_Gatherv(slab, (int)slab_bytes, MPI_BYTE, buffer, counts.data(),
+              displs.data(), MPI_BYTE, 0, nodes.leaders);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+
+#include "trace.hpp"
+
+// Split of a kernel's work across ranks. Work is a sequence of items of equal
+// size in bytes (pixels, rows, row pairs), split by the bytes each part
+// writes: parts are balanced to within one alignment quantum and every
+// boundary falls on a 4 KB page or, for small images, a 64-byte cache line
+// boundary of the written buffer, so neighbouring ranks never write the same
+// line. Items whose size shares few factors of two with 64 (odd row lengths)
+// would need a quantum of up to 64 items, and are only aligned when the
+// image is large enough for that to stay balanced.
+
+constexpr size_t CACHE_LINE_BYTES = 64;
+constexpr size_t PAGE_BYTES = 4096;
+
+// PARTITION=dynamic self-schedules the work in chunks instead of the static
+// split, which absorbs ranks slowed down by other jobs on a shared node at
+// the cost of NUMA locality
+inline bool dynamicPartitionEnabled() {
+  const char *partition = std::getenv("PARTITION");
+  return partition != nullptr && std::string(partition) == "dynamic";
+}
+
+// Items [begin, end)
+struct WorkRange {
+  long begin;
+  long end;
+};
+
+class Partition {
+private:
+  long items;
+  int num_parts;
+  long quantum;
+  long chunk_items;
+
+  // Fewest items whose bytes are a multiple of alignment
+  static long quantumFor(size_t item_bytes, size_t alignment) {
+    return (long)(alignment / std::gcd(item_bytes, alignment));
+  }
+
+  long roundToQuantum(long item) const {
+    return std::min(items, (item + quantum / 2) / quantum * quantum);
+  }
+
+public:
+  // The coarsest alignment that still keeps each part within 1/16 of its
+  // fair share is used, falling back to no alignment for tiny inputs
+  Partition(long items, size_t item_bytes, int num_parts)
+      : items(items), num_parts(num_parts), quantum(1) {
+    for (size_t alignment : {PAGE_BYTES, CACHE_LINE_BYTES}) {
+      long candidate = quantumFor(item_bytes, alignment);
+      if (candidate * num_parts * 16 <= items) {
+        quantum = candidate;
+        break;
+      }
+    }
+    // About 8 chunks per part when the work is self-scheduled
+    chunk_items =
+        std::max(quantum, items / ((long)num_parts * 8) / quantum * quantum);
+  }
+
+  long numItems() const { return items; }
+
+  int numParts() const { return num_parts; }
+
+  // Static share of part p
+  WorkRange part(int p) const {
+    long begin = p == 0 ? 0 : roundToQuantum(p * items / num_parts);
+    long end = p == num_parts - 1 ? items
+                                  : roundToQuantum((p + 1) * items / num_parts);
+    return {begin, end};
+  }
+
+  long numChunks() const { return (items + chunk_items - 1) / chunk_items; }
+
+  WorkRange chunk(long c) const {
+    return {c * chunk_items, std::min(items, (c + 1) * chunk_items)};
+  }
+};
+
+// Run body(begin, end) over the work of part p: its static range, or, when
+// next_chunk is given, chunks claimed from that counter until none are left
+// so faster parts take over the work of slower ones. Every part sharing the
+// counter must start from the same zeroed counter.
+template <typename Body>
+void runPartition(const Partition &partition, int p,
+                  std::atomic<long> *next_chunk, Body body) {
+  if (next_chunk == nullptr) {
+    WorkRange range = partition.part(p);
+    body(range.begin, range.end);
+    return;
+  }
+  long num_chunks = partition.numChunks();
+  for (long c = next_chunk->fetch_add(1, std::memory_order_relaxed);
+       c < num_chunks;
+       c = next_chunk->fetch_add(1, std::memory_order_relaxed)) {
+    TraceScope scope("chunk");
+    WorkRange range = partition.chunk(c);
+    body(range.begin, range.end);
+  }
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "trace.hpp"
+
+// Optional hardware counter instrumentation of the phases of a run (decode,
+// copy, kernel, ...) through Linux perf_event_open. Enabled with
+// PERF_COUNTERS=1 in the environment. Counters the machine or the
+// perf_event_paranoid setting refuses read as unavailable, and on other
+// platforms only the wall time of each phase is recorded.
+
+enum PerfEvent {
+  CYCLES = 0,
+  INSTRUCTIONS = 1,
+  LLC_MISSES = 2,
+  DTLB_MISSES = 3,
+  STALLED_CYCLES = 4,
+  NUM_PERF_EVENTS = 5
+};
+
+inline const char *perfEventName(int event) {
+  static const char *names[NUM_PERF_EVENTS] = {
+      "cycles", "instructions", "LLC misses", "dTLB misses",
+      "stalled cycles"};
+  return names[event];
+}
+
+inline bool perfCountersEnabled() {
+  const char *enabled = std::getenv("PERF_COUNTERS");
+  return enabled != nullptr && std::string(enabled) != "0";
+}
+
+// Wall time and counter totals of one phase. A counter that could not be
+// opened holds -1.
+struct PhaseCounts {
+  std::string name;
+  double seconds = 0;
+  std::array<double, NUM_PERF_EVENTS> values{};
+};
+
+// Counts user-space events of the calling thread between begin(phase) and
+// end(). Phases are declared up front so every rank of an MPI job reports
+// the same list, including the phases it has no work in. With TRACE_FILE set
+// every phase is also recorded as a trace span, counters or not.
+class PhaseCounters {
+private:
+  bool enabled;
+  std::array<int, NUM_PERF_EVENTS> fds;
+  std::vector<PhaseCounts> phases;
+
+  int current = -1;
+  int64_t trace_begin = -1;
+  std::chrono::steady_clock::time_point start_time;
+  std::array<double, NUM_PERF_EVENTS> start_values{};
+
+#ifdef __linux__
+  static int openEvent(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    // User space only, so it works with the default perf_event_paranoid
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  static uint64_t cacheEvent(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+  }
+#endif
+
+  // Current value of a counter, scaled up when the kernel multiplexed it
+  double readEvent(int event) const {
+#ifdef __linux__
+    uint64_t data[3];
+    if (fds[event] < 0 || read(fds[event], data, sizeof(data)) !=
+                              (ssize_t)sizeof(data)) {
+      return -1;
+    }
+    if (data[2] == 0) {
+      return 0;
+    }
+    return (double)data[0] * ((double)data[1] / data[2]);
+#else
+    (void)event;
+    return -1;
+#endif
+  }
+
+public:
+  PhaseCounters(bool enabled, std::initializer_list<const char *> names)
+      : enabled(enabled) {
+    fds.fill(-1);
+    for (const char *name : names) {
+      PhaseCounts phase;
+      phase.name = name;
+      phases.push_back(phase);
+    }
+    if (!enabled) {
+      return;
+    }
+
+#ifdef __linux__
+    fds[CYCLES] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[INSTRUCTIONS] =
+        openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    // The generic cache miss event counts last level cache misses
+    fds[LLC_MISSES] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[DTLB_MISSES] = openEvent(
+        PERF_TYPE_HW_CACHE,
+        cacheEvent(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                   PERF_COUNT_HW_CACHE_RESULT_MISS));
+    fds[STALLED_CYCLES] =
+        openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND);
+#endif
+  }
+
+  ~PhaseCounters() {
+#ifdef __linux__
+    for (int fd : fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+  PhaseCounters(const PhaseCounters &) = delete;
+  PhaseCounters &operator=(const PhaseCounters &) = delete;
+
+  bool isEnabled() const { return enabled; }
+
+  bool isAvailable(int event) const { return fds[event] >= 0; }
+
+  void begin(const std::string &name) {
+    if (!enabled && !traceEnabled()) {
+      return;
+    }
+    current = -1;
+    for (size_t i = 0; i < phases.size(); i++) {
+      if (phases[i].name == name) {
+        current = (int)i;
+      }
+    }
+    if (traceEnabled()) {
+      trace_begin = traceNow();
+    }
+    if (!enabled) {
+      return;
+    }
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+      start_values[e] = readEvent(e);
+    }
+    start_time = std::chrono::steady_clock::now();
+  }
+
+  // Add the time and counts since begin() to the phase. A phase entered
+  // more than once accumulates.
+  void end() {
+    if (current < 0) {
+      return;
+    }
+    if (trace_begin >= 0) {
+      // The phase names live as long as the counters, which outlive the
+      // trace written before MPI_Finalize
+      threadTraceBuffer().push(
+          {phases[current].name.c_str(), "phase", trace_begin, traceNow()});
+      trace_begin = -1;
+    }
+    if (!enabled) {
+      current = -1;
+      return;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_time;
+    PhaseCounts &phase = phases[current];
+    phase.seconds += elapsed.count();
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+      double value = readEvent(e);
+      if (value < 0 || start_values[e] < 0) {
+        phase.values[e] = -1;
+      } else if (phase.values[e] >= 0) {
+        phase.values[e] += value - start_values[e];
+      }
+    }
+    current = -1;
+  }
+
+  const std::vector<PhaseCounts> &results() const { return phases; }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <mpi.h>
+#include <vector>
+
+#include "perf_counters.hpp"
+
+// Aggregation of PhaseCounters across the ranks of an MPI job
+
+// Whether to collect counters, decided on the root so every rank agrees even
+// when the launcher does not forward PERF_COUNTERS to remote ranks
+inline bool perfCountersEnabled(MPI_Comm comm, int root = 0) {
+  int enabled = perfCountersEnabled() ? 1 : 0;
+  MPI_Bcast(&enabled, 1, MPI_INT, root, comm);
+  return enabled != 0;
+}
+
+// Gather every rank's phases on the root and print one line per phase: the
+// slowest and mean rank wall time, and each counter summed over the ranks.
+// A counter missing on any rank prints as n/a. Collective over comm.
+inline void reportPhaseCounters(const PhaseCounters &counters, MPI_Comm comm,
+                                int root = 0) {
+  if (!counters.isEnabled()) {
+    return;
+  }
+  int rank, num_processes;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &num_processes);
+
+  const std::vector<PhaseCounts> &phases = counters.results();
+  const int stride = 1 + NUM_PERF_EVENTS;
+  std::vector<double> local(phases.size() * stride);
+  for (size_t p = 0; p < phases.size(); p++) {
+    local[p * stride] = phases[p].seconds;
+    std::copy(phases[p].values.begin(), phases[p].values.end(),
+              local.begin() + p * stride + 1);
+  }
+
+  std::vector<double> all(rank == root ? local.size() * num_processes : 0);
+  MPI_Gather(local.data(), (int)local.size(), MPI_DOUBLE, all.data(),
+             (int)local.size(), MPI_DOUBLE, root, comm);
+  if (rank != root) {
+    return;
+  }
+
+  std::ios::fmtflags flags = std::cout.flags();
+  std::streamsize precision = std::cout.precision();
+  std::cout << "Perf counters over " << num_processes
+            << " ranks (wall time of the slowest and mean rank, counters "
+               "summed):"
+            << std::endl;
+  std::cout << std::left << std::setw(10) << "phase" << std::right
+            << std::setw(11) << "max ms" << std::setw(11) << "mean ms";
+  for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+    std::cout << std::setw(16) << perfEventName(e);
+  }
+  std::cout << std::setw(7) << "IPC" << std::endl;
+
+  std::cout << std::fixed;
+  for (size_t p = 0; p < phases.size(); p++) {
+    double max_seconds = 0, sum_seconds = 0;
+    double totals[NUM_PERF_EVENTS] = {};
+    for (int r = 0; r < num_processes; r++) {
+      const double *row = &all[(r * phases.size() + p) * stride];
+      max_seconds = std::max(max_seconds, row[0]);
+      sum_seconds += row[0];
+      for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+        totals[e] = (row[1 + e] < 0 || totals[e] < 0) ? -1
+                                                      : totals[e] + row[1 + e];
+      }
+    }
+
+    std::cout << std::left << std::setw(10) << phases[p].name << std::right
+              << std::setprecision(3) << std::setw(11) << max_seconds * 1e3
+              << std::setw(11) << sum_seconds * 1e3 / num_processes
+              << std::setprecision(0);
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) {
+      if (totals[e] < 0) {
+        std::cout << std::setw(16) << "n/a";
+      } else {
+        std::cout << std::setw(16) << totals[e];
+      }
+    }
+    if (totals[CYCLES] > 0 && totals[INSTRUCTIONS] >= 0) {
+      std::cout << std::setprecision(2) << std::setw(7)
+                << totals[INSTRUCTIONS] / totals[CYCLES] << std::endl;
+    } else {
+      std::cout << std::setw(7) << "n/a" << std::endl;
+    }
+  }
+  std::cout.flags(flags);
+  std::cout.precision(precision);
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Pixel types of the kernels: 8-bit, 16-bit or float channels, 1, 3 or 4 of
+// them. The kernels are templates on the channel type T and the channel count
+// CN, so every combination is its own instantiation with the channel loop
+// unrolled, and dispatchPixelType picks it by Mat::type() once per call.
+// Integer channels are clamped to their range, float channels have no fixed
+// range and are kept as they are.
+
+// Channel count of the instantiations that take it at run time instead
+constexpr int ANY_CHANNELS = 0;
+
+template <typename T, int CN> struct PixelType {
+  using Channel = T;
+  static constexpr int channels = CN;
+};
+
+// RUNTIME_CHANNELS=1 dispatches to the ANY_CHANNELS instantiations, which
+// loop over a channel count only known at run time like the kernels did
+// before they were specialized. channel_benchmark.sh compares the two.
+inline bool runtimeChannelsEnabled() {
+  static const bool enabled = [] {
+    const char *runtime = std::getenv("RUNTIME_CHANNELS");
+    return runtime != nullptr && std::string(runtime) == "1";
+  }();
+  return enabled;
+}
+
+// The channel count of a PixelType<T, CN> kernel: CN, or channels for
+// ANY_CHANNELS
+template <int CN> constexpr int channelCount(int channels) {
+  return CN != ANY_CHANNELS ? CN : channels;
+}
+
+// Copy one pixel of cn channels. With CN known it moves as one fixed-size
+// unit, which the compiler loads and stores at once.
+template <typename T, int CN>
+inline void copyPixel(T *dst, const T *src, int cn) {
+  if constexpr (CN != ANY_CHANNELS) {
+    std::memcpy(dst, src, CN * sizeof(T));
+  } else {
+    for (int c = 0; c < cn; c++) {
+      dst[c] = src[c];
+    }
+  }
+}
+
+template <typename T, int CN> inline void swapPixels(T *a, T *b, int cn) {
+  if constexpr (CN != ANY_CHANNELS) {
+    T temp[CN];
+    std::memcpy(temp, a, CN * sizeof(T));
+    std::memcpy(a, b, CN * sizeof(T));
+    std::memcpy(b, temp, CN * sizeof(T));
+  } else {
+    for (int c = 0; c < cn; c++) {
+      std::swap(a[c], b[c]);
+    }
+  }
+}
+
+// Calls f(PixelType<T, CN>()) for a Mat of the given type, with CN
+// ANY_CHANNELS under RUNTIME_CHANNELS=1. False, and f not called, for any
+// other type.
+template <typename F> bool dispatchPixelType(int type, F &&f) {
+  int channels = CV_MAT_CN(type);
+  if (runtimeChannelsEnabled() &&
+      (channels == 1 || channels == 3 || channels == 4)) {
+    switch (CV_MAT_DEPTH(type)) {
+    case CV_8U:
+      f(PixelType<uchar, ANY_CHANNELS>());
+      return true;
+    case CV_16U:
+      f(PixelType<ushort, ANY_CHANNELS>());
+      return true;
+    case CV_32F:
+      f(PixelType<float, ANY_CHANNELS>());
+      return true;
+    default:
+      return false;
+    }
+  }
+  switch (type) {
+  case CV_8UC1:
+    f(PixelType<uchar, 1>());
+    return true;
+  case CV_8UC3:
+    f(PixelType<uchar, 3>());
+    return true;
+  case CV_8UC4:
+    f(PixelType<uchar, 4>());
+    return true;
+  case CV_16UC1:
+    f(PixelType<ushort, 1>());
+    return true;
+  case CV_16UC3:
+    f(PixelType<ushort, 3>());
+    return true;
+  case CV_16UC4:
+    f(PixelType<ushort, 4>());
+    return true;
+  case CV_32FC1:
+    f(PixelType<float, 1>());
+    return true;
+  case CV_32FC3:
+    f(PixelType<float, 3>());
+    return true;
+  case CV_32FC4:
+    f(PixelType<float, 4>());
+    return true;
+  default:
+    return false;
+  }
+}
+
+inline bool isSupportedPixelType(int type) {
+  return dispatchPixelType(type, [](auto) {});
+}
+
+// e.g. "16UC3"
+inline std::string pixelTypeName(int type) {
+  const char *depths[] = {"8U", "8S", "16U", "16S", "32S", "32F", "64F", "16F"};
+  return std::string(depths[CV_MAT_DEPTH(type)]) + "C" +
+         std::to_string(CV_MAT_CN(type));
+}
+
+// value clamped to the range of T and truncated, float as it is
+template <typename T, typename V> inline T clampChannel(V value) {
+  if constexpr (std::is_floating_point<T>::value) {
+    return static_cast<T>(value);
+  } else {
+    return static_cast<T>(std::min(
+        std::max(value, V(0)), V(std::numeric_limits<T>::max())));
+  }
+}
+
+// Value rounded to the nearest value of T and clamped to its range, float as
+// it is
+template <typename T> inline T roundChannel(float value) {
+  if constexpr (std::is_floating_point<T>::value) {
+    return static_cast<T>(value);
+  } else {
+    return clampChannel<T>(value + 0.5f);
+  }
+}
+
+// Whether the file at path is a JPEG, which has no alpha channel but may
+// carry an EXIF orientation
+inline bool isJpegPath(const std::string &path) {
+  std::string extension = path.substr(std::min(path.rfind('.'), path.size()));
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return extension == ".jpg" || extension == ".jpeg" || extension == ".jpe";
+}
+
+// The image at path with the depth and channels of the file, converted to the
+// nearest supported pixel type: gray with alpha to BGRA, and 8-bit signed,
+// 16-bit signed, 32-bit integer, half and double channels to float with their
+// values kept. A JPEG is read with IMREAD_ANYDEPTH | IMREAD_ANYCOLOR, which
+// turns it by its EXIF orientation like the default imread. Other files are
+// read unchanged to keep their alpha. Returns an empty Mat, with the reason
+// on stderr, if the image has more than 4 channels.
+inline cv::Mat readPixels(const std::string &path) {
+  cv::Mat image =
+      cv::imread(path, isJpegPath(path)
+                           ? cv::IMREAD_ANYDEPTH | cv::IMREAD_ANYCOLOR
+                           : cv::IMREAD_UNCHANGED);
+  if (image.empty()) {
+    return image;
+  }
+  if (image.channels() == 2) {
+    std::vector<cv::Mat> planes;
+    cv::split(image, planes);
+    cv::merge(std::vector<cv::Mat>{planes[0], planes[0], planes[0], planes[1]},
+              image);
+  }
+  int depth = image.depth();
+  if (depth != CV_8U && depth != CV_16U && depth != CV_32F) {
+    image.convertTo(image, CV_32F);
+  }
+  if (!isSupportedPixelType(image.type())) {
+    std::cerr << "Error: " << path << " has unsupported pixel type "
+              << pixelTypeName(image.type()) << std::endl;
+    return cv::Mat();
+  }
+  return image;
+}
+
+// Extension of a result in a format that can hold the type: JPEG for 8-bit
+// gray and color, PNG to keep an alpha channel and TIFF for 16-bit and float.
+// JPEG is lossy, so an 8-bit gray or color result does not keep every bit.
+inline std::string resultExtension(int type) {
+  if (CV_MAT_DEPTH(type) != CV_8U) {
+    return ".tif";
+  }
+  return CV_MAT_CN(type) == 4 ? ".png" : ".jpg";
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+
+#include "pixel_types.hpp"
+
+// Planar (structure of arrays) layout for the spatial filters. OpenCV stores
+// the channels of a pixel next to each other, so a loop along a row steps
+// over the other channels and cannot load the neighbouring pixels of one
+// channel as a vector. PIXEL_LAYOUT=planar deinterleaves the image into one
+// contiguous plane per channel first, filters each plane as a single channel
+// image, and interleaves the result back. The FFT tools already work on
+// planes, split once by cv::split.
+
+enum PixelLayout { INTERLEAVED = 0, PLANAR = 1 };
+
+inline PixelLayout pixelLayout() {
+  const char *layout = std::getenv("PIXEL_LAYOUT");
+  return layout != nullptr && std::string(layout) == "planar" ? PLANAR
+                                                              : INTERLEAVED;
+}
+
+// Pixels [begin, end) of an interleaved image with channels values of type T
+// per pixel into planes, plane c starting plane_size values after plane c - 1.
+// A plane at a time, so with CN known each loop has a constant stride and
+// vectorizes. Called on a row or so at a time, the pixels stay in cache for
+// every plane.
+template <typename T, int CN>
+void deinterleave(const T *interleaved, T *planes, int channels,
+                  long plane_size, long begin, long end) {
+  const int cn = channelCount<CN>(channels);
+  for (int c = 0; c < cn; c++) {
+    T *plane = planes + c * plane_size;
+#pragma omp simd
+    for (long p = begin; p < end; p++) {
+      plane[p] = interleaved[p * cn + c];
+    }
+  }
+}
+
+// The inverse of deinterleave, pixels [begin, end) of the planes back into
+// the interleaved image
+template <typename T, int CN>
+void interleave(const T *planes, T *interleaved, int channels,
+                long plane_size, long begin, long end) {
+  const int cn = channelCount<CN>(channels);
+  for (int c = 0; c < cn; c++) {
+    const T *plane = planes + c * plane_size;
+#pragma omp simd
+    for (long p = begin; p < end; p++) {
+      interleaved[p * cn + c] = plane[p];
+    }
+  }
+}
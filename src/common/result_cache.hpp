@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/file.h>
+#include <unistd.h>
+#include <vector>
+
+// Content-addressed cache of the tools' results on disk. With
+// RESULT_CACHE_DIR=<dir> a run looks up its result under a key made of a hash
+// of the input file's bytes and of the operation with its parameters, e.g.
+// "rotate 0". On a hit the encoded result is copied to the output path and
+// the image is neither decoded nor processed; on a miss the written result
+// is added. Entries are evicted least recently used first once they take up
+// more than RESULT_CACHE_BYTES (default 1 GB), a hit counting as a use. The
+// lookups, hits and bytes of results served from the cache are counted over
+// all runs sharing the directory.
+
+constexpr long RESULT_CACHE_DEFAULT_BYTES = 1L << 30;
+
+inline std::string resultCacheDir() {
+  const char *dir = std::getenv("RESULT_CACHE_DIR");
+  return dir != nullptr ? dir : "";
+}
+
+inline long resultCacheLimit() {
+  const char *limit = std::getenv("RESULT_CACHE_BYTES");
+  return limit != nullptr ? std::atol(limit) : RESULT_CACHE_DEFAULT_BYTES;
+}
+
+// 64-bit hash of size bytes, a word at a time: each word is mixed by the
+// MurmurHash3 finalizer and folded in FNV-1a style, the length last. Fast
+// enough to be cheap next to decoding, not meant to resist crafted inputs.
+inline uint64_t contentHash(const char *data, size_t size) {
+  auto mix = [](uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  };
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    hash = (hash ^ mix(word)) * prime;
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, data + i, size - i);
+  hash = (hash ^ mix(tail)) * prime;
+  return mix(hash ^ size);
+}
+
+struct ResultCacheStats {
+  long lookups = 0;
+  long hits = 0;
+  long saved_bytes = 0; // of results copied from the cache
+};
+
+class ResultCache {
+private:
+  std::filesystem::path dir;
+  std::string input_path;
+  std::string operation;
+  std::string key;
+  std::filesystem::path entry; // the cached result, once found
+  long entry_bytes = 0;
+  enum { NOT_LOOKED_UP, HIT, MISS, STORED } outcome = NOT_LOOKED_UP;
+  ResultCacheStats totals;
+
+  // Results have one of the extensions of resultExtension() or ".jpg"
+  static bool isEntry(const std::filesystem::path &path) {
+    std::string extension = path.extension().string();
+    return extension == ".jpg" || extension == ".png" || extension == ".tif";
+  }
+
+  static std::string hex(uint64_t value) {
+    std::ostringstream text;
+    text << std::hex << std::setw(16) << std::setfill('0') << value;
+    return text.str();
+  }
+
+  // Add lookups, hits and saved bytes to the counts of the directory, under a
+  // file lock since several runs may share it, and keep the new totals
+  void count(long lookups, long hits, long bytes) {
+    int fd = ::open((dir / "stats").c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return;
+    }
+    flock(fd, LOCK_EX);
+    char text[96] = {};
+    ssize_t length = pread(fd, text, sizeof(text) - 1, 0);
+    ResultCacheStats stats;
+    if (length > 0) {
+      std::sscanf(text, "%ld %ld %ld", &stats.lookups, &stats.hits,
+                  &stats.saved_bytes);
+    }
+    stats.lookups += lookups;
+    stats.hits += hits;
+    stats.saved_bytes += bytes;
+    length = std::snprintf(text, sizeof(text), "%ld %ld %ld\n", stats.lookups,
+                           stats.hits, stats.saved_bytes);
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, text, length, 0) == length) {
+      totals = stats;
+    }
+    flock(fd, LOCK_UN);
+    ::close(fd);
+  }
+
+  // Remove the least recently used entries until they fit the limit
+  void evict() {
+    namespace fs = std::filesystem;
+    std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+    long total = 0;
+    std::error_code error;
+    for (const auto &file : fs::directory_iterator(dir, error)) {
+      if (file.is_regular_file(error) && isEntry(file.path())) {
+        total += file.file_size(error);
+        entries.emplace_back(file.last_write_time(error), file.path());
+      }
+    }
+    std::sort(entries.begin(), entries.end());
+    long limit = resultCacheLimit();
+    for (const auto &[time, path] : entries) {
+      if (total <= limit) {
+        break;
+      }
+      long bytes = fs::file_size(path, error);
+      if (fs::remove(path, error)) {
+        total -= bytes;
+      }
+    }
+  }
+
+public:
+  // operation names the tool's operation and every parameter that changes
+  // its result, e.g. "blur_parallel_omp 5 2.000000"
+  ResultCache(const std::string &input_path, const std::string &operation)
+      : dir(resultCacheDir()), input_path(input_path), operation(operation) {}
+
+  bool enabled() const { return !dir.empty(); }
+
+  // Whether the result of the operation on the input is cached. Reads and
+  // hashes the whole input file and counts the lookup.
+  bool lookup() {
+    namespace fs = std::filesystem;
+    if (!enabled()) {
+      return false;
+    }
+    std::ifstream file(input_path, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+    std::string content((std::istreambuf_iterator<char>(file)),
+                        std::istreambuf_iterator<char>());
+    key = hex(contentHash(content.data(), content.size())) + "-" +
+          hex(contentHash(operation.data(), operation.size()));
+
+    std::error_code error;
+    fs::create_directories(dir, error);
+    outcome = MISS;
+    for (const char *extension : {".jpg", ".png", ".tif"}) {
+      fs::path candidate = dir / (key + extension);
+      if (fs::is_regular_file(candidate, error)) {
+        entry = candidate;
+        entry_bytes = fs::file_size(candidate, error);
+        outcome = HIT;
+        break;
+      }
+    }
+    count(1, outcome == HIT ? 1 : 0, outcome == HIT ? entry_bytes : 0);
+    return outcome == HIT;
+  }
+
+  // After a hit, copy the cached result to output_stem plus its extension,
+  // returning that path, or an empty string if it failed, e.g. because a
+  // concurrent run evicted the entry. A failed copy turns the hit into a miss,
+  // so the tool computes the result and stores it again.
+  std::string restore(const std::string &output_stem) {
+    namespace fs = std::filesystem;
+    std::string output_path = output_stem + entry.extension().string();
+    std::error_code error;
+    fs::copy_file(entry, output_path, fs::copy_options::overwrite_existing,
+                  error);
+    if (error) {
+      std::cerr << "Error: Could not copy cached result to " << output_path
+                << ": " << error.message() << std::endl;
+      if (outcome == HIT) {
+        outcome = MISS;
+        count(0, -1, -entry_bytes);
+      }
+      return "";
+    }
+    // A use for the eviction order
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), error);
+    return output_path;
+  }
+
+  // After a miss, add the result written to output_path
+  void store(const std::string &output_path) {
+    namespace fs = std::filesystem;
+    if (outcome != MISS) {
+      return;
+    }
+    fs::path target = dir / (key + fs::path(output_path).extension().string());
+    if (!isEntry(target)) {
+      return;
+    }
+    // Copied under a temporary name and renamed, so a concurrent lookup never
+    // sees a partial entry
+    fs::path temporary = target;
+    temporary += ".tmp" + std::to_string(getpid());
+    std::error_code error;
+    fs::copy_file(output_path, temporary, fs::copy_options::overwrite_existing,
+                  error);
+    if (!error) {
+      fs::rename(temporary, target, error);
+    }
+    if (error) {
+      fs::remove(temporary, error);
+      return;
+    }
+    outcome = STORED;
+    evict();
+  }
+
+  // This run's outcome and the counts of all runs on the directory
+  void report() const {
+    if (outcome == NOT_LOOKED_UP) {
+      return;
+    }
+    double mb = 1.0 / (1 << 20);
+    const char *outcomes[] = {"", "hit", "miss", "miss, stored"};
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(1)
+              << "Result cache: " << outcomes[outcome] << ", "
+              << totals.hits << " of " << totals.lookups << " lookups hit ("
+              << (totals.lookups > 0 ? 100.0 * totals.hits / totals.lookups
+                                     : 0.0)
+              << "%), " << totals.saved_bytes * mb << " MB saved" << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+  }
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <mpi.h>
+
+#include "result_cache.hpp"
+
+// Result cache lookup of the MPI tools
+
+// Whether the cached result is in place: looked up on the root and copied to
+// the outputs by restore(), which returns false if a copy failed, and
+// broadcast so every rank skips the run together, or computes it if the
+// result could not be restored. Collective over comm.
+template <typename Restore>
+bool lookupResult(ResultCache &cache, MPI_Comm comm, Restore restore,
+                  int root = 0) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  int hit = rank == root && cache.lookup() && restore() ? 1 : 0;
+  MPI_Bcast(&hit, 1, MPI_INT, root, comm);
+  return hit != 0;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <string>
+
+#include "buffer_pool.hpp"
+#include "pixel_types.hpp"
+
+// Incremental reprocessing of an image of which only a rectangle changed.
+// With PREVIOUS_RESULT=<path>, the result of the same tool and parameters on
+// the image before the edit, and DIRTY_RECT=x,y,width,height, the edited
+// rectangle in input pixels, a tool starts from the previous result and only
+// recomputes the output pixels the edit can reach: the rectangle for the color
+// transformation, its mirror image or rotation for the flips and rotation, and
+// the rectangle grown by the kernel radius for the blur. Only the kernel runs
+// on the edit: decoding the input and the previous result and encoding the
+// output still cover the whole image, and the time reported includes them.
+// Results of this mode are PNG or TIFF, and a JPEG previous result is refused,
+// so that a chain of updates loses nothing to compression. If the previous
+// result is lossy, missing or of another size or type, the whole image is
+// processed.
+
+struct DirtyRegion {
+  std::string previous_path; // empty if not requested
+  cv::Rect rect;             // in input pixels
+};
+
+// The region from the environment, with an empty previous_path unless both
+// variables are set and DIRTY_RECT is well formed
+inline DirtyRegion dirtyRegion() {
+  DirtyRegion region;
+  const char *previous = std::getenv("PREVIOUS_RESULT");
+  const char *rect = std::getenv("DIRTY_RECT");
+  if (previous == nullptr || rect == nullptr) {
+    return region;
+  }
+  int x, y, width, height;
+  if (std::sscanf(rect, "%d,%d,%d,%d", &x, &y, &width, &height) != 4 ||
+      width < 0 || height < 0) {
+    std::cerr << "Warning: DIRTY_RECT must be x,y,width,height, processing "
+                 "the whole image"
+              << std::endl;
+    return region;
+  }
+  region.previous_path = previous;
+  region.rect = cv::Rect(x, y, width, height);
+  return region;
+}
+
+// Extension of a result that a later run can update: resultExtension, but
+// PNG or TIFF instead of JPEG when PREVIOUS_RESULT is set, so that the full
+// run a chain of updates starts from and the updates themselves are lossless
+inline std::string updatableResultExtension(int type) {
+  if (std::getenv("PREVIOUS_RESULT") == nullptr) {
+    return resultExtension(type);
+  }
+  return CV_MAT_DEPTH(type) == CV_8U ? ".png" : ".tif";
+}
+
+// The previous result, or an empty Mat with the reason on stderr if it is
+// lossy or not a result of the expected size and type
+inline cv::Mat readPreviousResult(const std::string &path, cv::Size size,
+                                  int type) {
+  if (isJpegPath(path)) {
+    std::cerr << "Warning: " << path
+              << " is a JPEG and would add its compression loss to the "
+                 "update, processing the whole image"
+              << std::endl;
+    return cv::Mat();
+  }
+  cv::Mat previous = readPixels(path);
+  if (previous.empty() || previous.size() != size ||
+      previous.type() != type) {
+    std::cerr << "Warning: " << path << " is not a " << size.width << "x"
+              << size.height << " " << pixelTypeName(type)
+              << " result, processing the whole image" << std::endl;
+    return cv::Mat();
+  }
+  return previous;
+}
+
+// rect grown by margin on every side and clipped to an image of size
+inline cv::Rect grownRect(const cv::Rect &rect, int margin, cv::Size size) {
+  cv::Rect grown(rect.x - margin, rect.y - margin, rect.width + 2 * margin,
+                 rect.height + 2 * margin);
+  return grown & cv::Rect(0, 0, size.width, size.height);
+}
+
+// The incremental mode of a tool: reads the input and the previous result,
+// of the input's size or, transposed, of its size turned by 90 degrees.
+// update(input, result) recomputes the pixels of result the edit reaches and
+// returns the rectangle of them, and result is written to output_stem plus
+// updatableResultExtension. Returns the path written, or an empty string if
+// the previous result cannot be used.
+template <typename F>
+std::string updateDirtyRegion(const std::string &input_path,
+                              const DirtyRegion &dirty, bool transposed,
+                              const std::string &output_stem, F update) {
+  auto start = std::chrono::high_resolution_clock::now();
+  cv::Mat input = readPixels(input_path);
+  if (input.empty()) {
+    return "";
+  }
+  cv::Size size =
+      transposed ? cv::Size(input.rows, input.cols) : input.size();
+  cv::Mat result = readPreviousResult(dirty.previous_path, size, input.type());
+  if (result.empty()) {
+    return "";
+  }
+
+  auto update_start = std::chrono::high_resolution_clock::now();
+  cv::Rect recomputed = update(input, result);
+  auto update_stop = std::chrono::high_resolution_clock::now();
+
+  std::string output_path =
+      output_stem + updatableResultExtension(input.type());
+  if (!cv::imwrite(output_path, result)) {
+    std::cerr << "Error: Could not write " << output_path << std::endl;
+    return "";
+  }
+  auto stop = std::chrono::high_resolution_clock::now();
+  std::cout << "Dirty region time: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(stop -
+                                                                     start)
+                   .count()
+            << " microseconds with decoding and encoding, "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   update_stop - update_start)
+                   .count()
+            << " microseconds for the update of " << recomputed.width << "x"
+            << recomputed.height << " of " << size.width << "x" << size.height
+            << " pixels" << std::endl;
+  return output_path;
+}
+
+// The update of the blurs: the output pixels within radius of the edited
+// rectangle, recomputed in result from the input pixels within twice the
+// radius. Those are all the taps they read, and where the region meets the
+// image border it clamps like the whole image, so they come out as when
+// blurring the whole image. Returns the rectangle recomputed.
+template <typename Blur>
+cv::Rect blurDirtyRegion(Blur &blur, const cv::Mat &input, cv::Mat &result,
+                         const cv::Rect &rect, int radius, float sigma) {
+  cv::Rect edited = rect & cv::Rect(0, 0, input.cols, input.rows);
+  if (edited.empty()) {
+    return edited;
+  }
+  cv::Rect target = grownRect(edited, radius, input.size());
+  cv::Rect source = grownRect(target, radius, input.size());
+
+  PooledVector<unsigned char> region((size_t)source.area() *
+                                     input.elemSize());
+  cv::Mat regionImage(source.height, source.width, input.type(),
+                      region.data());
+  input(source).copyTo(regionImage);
+  blur.applyBlur(region, source.width, source.height, input.type(), radius,
+                 sigma);
+  cv::Mat blurred = regionImage(cv::Rect(target.x - source.x,
+                                         target.y - source.y, target.width,
+                                         target.height));
+  cv::Mat out = result(target);
+  blurred.copyTo(out);
+  return target;
+}
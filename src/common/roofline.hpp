@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// Roofline-style reporting shared by every tool. A kernel describes how many
+// bytes it has to move and how many arithmetic operations it does, and the
+// measured time turns that into achieved GB/s and GFLOP/s. With
+// ROOFLINE_PROBE=1 in the environment, a STREAM triad is also run on the same
+// machine as the memory bandwidth ceiling to compare against.
+
+// Work done by one run of a kernel. bytes is the compulsory memory traffic
+// of the algorithm (every input read once, every output written once, plus
+// the passes the algorithm cannot avoid), not what a given implementation
+// happens to move, so implementations of the same kernel are comparable.
+struct KernelCost {
+  double bytes = 0;
+  double ops = 0;
+  // Integer kernels report Gop/s instead of GFLOP/s
+  bool floating_point = true;
+};
+
+inline KernelCost operator*(double times, const KernelCost &cost) {
+  return {times * cost.bytes, times * cost.ops, cost.floating_point};
+}
+
+inline bool rooflineProbeEnabled() {
+  const char *probe = std::getenv("ROOFLINE_PROBE");
+  return probe != nullptr && std::string(probe) != "0";
+}
+
+// STREAM triad a[i] = b[i] + s * c[i] on arrays of `elements` doubles, best
+// of `repetitions`. The default 3 x 32 MB is well past any last level cache.
+// Bandwidth counts 3 doubles per element like STREAM does, so write-allocate
+// traffic is not included. With `threaded` and an OpenMP build the triad runs
+// on all OpenMP threads; sequential kernels compare against a single thread.
+// MPI tools run it on every rank at once and add the results up.
+inline double streamTriadBandwidth(bool threaded = true,
+                                   size_t elements = size_t(1) << 22,
+                                   int repetitions = 5) {
+  std::unique_ptr<double[]> a(new double[elements]);
+  std::unique_ptr<double[]> b(new double[elements]);
+  std::unique_ptr<double[]> c(new double[elements]);
+  const double scalar = 3.0;
+  long n = (long)elements;
+  (void)threaded;
+
+  // First touch on the threads that run the triad
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) if (threaded)
+#endif
+  for (long i = 0; i < n; i++) {
+    a[i] = 0;
+    b[i] = 1;
+    c[i] = 2;
+  }
+
+  double best = 0;
+  for (int r = 0; r < repetitions; r++) {
+    auto start = std::chrono::steady_clock::now();
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (threaded)
+#endif
+    for (long i = 0; i < n; i++) {
+      a[i] = b[i] + scalar * c[i];
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::max(best, 3 * sizeof(double) * elements / elapsed.count());
+  }
+
+  // Keep the stores from being optimized away
+  if (a[n / 2] != b[n / 2] + scalar * c[n / 2]) {
+    std::cerr << "STREAM triad produced a wrong result" << std::endl;
+  }
+  return best / 1e9;
+}
+
+// Print the achieved rates of one run. stream_gbps is the measured bandwidth
+// ceiling, or 0 when the probe was not run.
+inline void printRoofline(const KernelCost &cost, double seconds,
+                          double stream_gbps = 0) {
+  if (seconds <= 0) {
+    return;
+  }
+  const char *unit = cost.floating_point ? "GFLOP/s" : "Gop/s";
+  double gbps = cost.bytes / seconds / 1e9;
+  double gops = cost.ops / seconds / 1e9;
+
+  std::ios::fmtflags flags = std::cout.flags();
+  std::streamsize precision = std::cout.precision();
+  std::cout << std::fixed << std::setprecision(3) << "Achieved: " << gbps
+            << " GB/s";
+  if (cost.ops > 0) {
+    const char *op = cost.floating_point ? "FLOP" : "op";
+    std::cout << ", " << gops << " " << unit << " (" << cost.bytes / 1e6
+              << " MB, " << cost.ops / 1e6 << " M" << op << ", "
+              << cost.ops / cost.bytes << " " << op << "/byte)" << std::endl;
+  } else {
+    // Pure data movement, e.g. flips and rotations
+    std::cout << " (" << cost.bytes / 1e6 << " MB, no arithmetic)"
+              << std::endl;
+  }
+
+  if (stream_gbps > 0) {
+    std::cout << "STREAM triad: " << stream_gbps << " GB/s, kernel at "
+              << std::setprecision(1) << 100 * gbps / stream_gbps
+              << "% of the bandwidth ceiling";
+    if (cost.ops > 0) {
+      // Attainable rate if the kernel ran at the bandwidth ceiling with its
+      // arithmetic intensity
+      std::cout << ", bandwidth bound " << std::setprecision(3)
+                << stream_gbps * cost.ops / cost.bytes << " " << unit;
+    }
+    std::cout << std::endl;
+  }
+  std::cout.flags(flags);
+  std::cout.precision(precision);
+}
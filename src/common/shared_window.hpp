@@ -0,0 +1,361 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mpi.h>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "huge_pages.hpp"
+#include "partition.hpp"
+
+// Node-shared image buffers for the MPI tools. The buffer is one contiguous
+// MPI_Win_allocate_shared window, but every rank of the node allocates a
+// segment the size of the part it writes and first-touches that part, so on
+// a multi-socket node the pages each rank writes land on its own NUMA node.
+// SHARED_WINDOW_PLACEMENT=root restores the old layout, where rank 0
+// allocates and touches the whole image, for comparison.
+// With HUGE_PAGES=1 the window starts on a 2 MB boundary and is advised for
+// transparent huge pages, which needs shmem_enabled=advise (or always) in
+// /sys/kernel/mm/transparent_hugepage. First touch then places whole 2 MB
+// pages, so a page shared by the parts of two ranks lands on one NUMA node.
+// The boundary is node rank 0's, the tools warn when another rank maps the
+// window at an address that does not share it and so keeps 4 KB pages.
+
+enum WindowPlacement { PLACE_LOCAL = 0, PLACE_ROOT = 1 };
+
+inline WindowPlacement windowPlacement() {
+  const char *placement = std::getenv("SHARED_WINDOW_PLACEMENT");
+  return (placement != nullptr && std::string(placement) == "root")
+             ? PLACE_ROOT
+             : PLACE_LOCAL;
+}
+
+inline const char *windowPlacementName(WindowPlacement placement) {
+  return placement == PLACE_ROOT ? "root" : "local";
+}
+
+inline unsigned char *alignUp(unsigned char *pointer, size_t alignment) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+  return pointer + (alignment - address % alignment) % alignment;
+}
+
+class SharedImageWindow {
+private:
+  MPI_Win win = MPI_WIN_NULL;
+  unsigned char *base = nullptr;
+  size_t bytes = 0;
+
+public:
+  // bytes shared by every rank of node_comm, starting on a page boundary so
+  // the Partition alignment holds in memory. written are the byte ranges
+  // this rank will write. Collective over node_comm.
+  SharedImageWindow(MPI_Comm node_comm, size_t bytes,
+                    const std::vector<WorkRange> &written,
+                    WindowPlacement placement = windowPlacement())
+      : bytes(bytes) {
+    int node_rank;
+    MPI_Comm_rank(node_comm, &node_rank);
+    // Node rank 0 decides, the launcher may not forward HUGE_PAGES
+    int huge_page_mode = hugePageMode();
+    MPI_Bcast(&huge_page_mode, 1, MPI_INT, 0, node_comm);
+    size_t alignment =
+        huge_page_mode == HUGE_PAGES_ON ? HUGE_PAGE_BYTES : PAGE_BYTES;
+
+    long local_bytes = 0;
+    if (placement == PLACE_LOCAL) {
+      for (const WorkRange &range : written) {
+        local_bytes += range.end - range.begin;
+      }
+    }
+    long all_bytes = 0;
+    MPI_Allreduce(&local_bytes, &all_bytes, 1, MPI_LONG, MPI_SUM, node_comm);
+
+    // Segments are laid out contiguously in rank order. Rank 0's also holds
+    // whatever nobody writes and the slack to align the start.
+    size_t segment_bytes = local_bytes;
+    if (node_rank == 0) {
+      segment_bytes += std::max(0L, (long)bytes - all_bytes) + alignment;
+    }
+    unsigned char *segment;
+    MPI_Win_allocate_shared(segment_bytes, 1, MPI_INFO_NULL, node_comm,
+                            &segment, &win);
+    MPI_Aint size;
+    int disp_unit;
+    MPI_Win_shared_query(win, 0, &size, &disp_unit, &base);
+    // Each rank maps the window at an address of its own, so the start is
+    // aligned in node rank 0's mapping and every rank uses that offset
+    long offset = alignUp(base, alignment) - base;
+    MPI_Bcast(&offset, 1, MPI_LONG, 0, node_comm);
+    base += offset;
+    // A passive target epoch for the whole run, so sync() can be called
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+
+    // Shared memory only gets a huge page where it is mapped at a 2 MB
+    // boundary. A rank whose mapping is not congruent with node rank 0's
+    // cannot map the window with huge pages, so the pages it first-touches
+    // stay 4 KB.
+    bool misaligned = huge_page_mode == HUGE_PAGES_ON &&
+                      reinterpret_cast<uintptr_t>(base) % HUGE_PAGE_BYTES != 0;
+    if (huge_page_mode != HUGE_PAGES_SYSTEM && !misaligned) {
+      adviseHugePages(base, bytes, (HugePageMode)huge_page_mode);
+    }
+    if (huge_page_mode == HUGE_PAGES_ON) {
+      int rank_misaligned = misaligned ? 1 : 0, misaligned_ranks = 0;
+      MPI_Reduce(&rank_misaligned, &misaligned_ranks, 1, MPI_INT, MPI_SUM, 0,
+                 node_comm);
+      static bool warned = false;
+      if (node_rank == 0 && !warned) {
+        std::string shmem = transparentHugePageSetting("shmem_enabled");
+        if (shmem == "never" || shmem == "deny") {
+          warned = true;
+          std::cerr << "Warning: HUGE_PAGES=1 has no effect on the shared "
+                       "window with transparent_hugepage/shmem_enabled="
+                    << shmem << std::endl;
+        } else if (misaligned_ranks > 0) {
+          warned = true;
+          int node_size;
+          MPI_Comm_size(node_comm, &node_size);
+          std::cerr << "Warning: HUGE_PAGES=1: the shared window is not 2 MB "
+                       "aligned in the mappings of "
+                    << misaligned_ranks << " of " << node_size
+                    << " ranks, their parts stay on 4 KB pages" << std::endl;
+        }
+      }
+    }
+
+    // First touch: the writing rank's NUMA node gets the pages. Nobody may
+    // write the image in before every part has been touched.
+    if (placement == PLACE_LOCAL) {
+      for (const WorkRange &range : written) {
+        std::memset(base + range.begin, 0, range.end - range.begin);
+      }
+    } else if (node_rank == 0) {
+      std::memset(base, 0, bytes);
+    }
+    MPI_Barrier(node_comm);
+  }
+
+  ~SharedImageWindow() { free(); }
+
+  SharedImageWindow(const SharedImageWindow &) = delete;
+  SharedImageWindow &operator=(const SharedImageWindow &) = delete;
+
+  unsigned char *data() const { return base; }
+
+  size_t size() const { return bytes; }
+
+  // Memory fence between this rank's plain loads/stores to the window and
+  // those of the other ranks, see NodeBarrier::wait
+  void sync() const { MPI_Win_sync(win); }
+
+  // Collective, must be called before MPI_Finalize
+  void free() {
+    if (win != MPI_WIN_NULL) {
+      MPI_Win_unlock_all(win);
+      MPI_Win_free(&win);
+      base = nullptr;
+    }
+  }
+};
+
+// Sense-reversing barrier between the ranks of a node, spinning on two flags
+// in a node-shared window instead of going through MPI_Barrier, which costs
+// as much as a microsecond-scale kernel. Ranks yield after a while of
+// spinning so an oversubscribed node still makes progress. Collective over
+// node_comm.
+class NodeBarrier {
+private:
+  static constexpr int SPINS_BEFORE_YIELD = 1 << 12;
+
+  MPI_Win win = MPI_WIN_NULL;
+  std::atomic<int> *count = nullptr;
+  std::atomic<int> *sense = nullptr;
+  int num_ranks;
+  int local_sense = 0;
+
+  static_assert(std::atomic<int>::is_always_lock_free,
+                "flags shared between processes must be lock free");
+
+public:
+  explicit NodeBarrier(MPI_Comm node_comm) {
+    int node_rank;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &num_ranks);
+
+    // The counter and the flag on cache lines of their own
+    unsigned char *segment;
+    MPI_Win_allocate_shared(node_rank == 0 ? 3 * CACHE_LINE_BYTES : 0, 1,
+                            MPI_INFO_NULL, node_comm, &segment, &win);
+    MPI_Aint size;
+    int disp_unit;
+    MPI_Win_shared_query(win, 0, &size, &disp_unit, &segment);
+    unsigned char *line = alignUp(segment, CACHE_LINE_BYTES);
+    if (node_rank == 0) {
+      new (line) std::atomic<int>(0);
+      new (line + CACHE_LINE_BYTES) std::atomic<int>(0);
+    }
+    MPI_Barrier(node_comm);
+    count = reinterpret_cast<std::atomic<int> *>(line);
+    sense = reinterpret_cast<std::atomic<int> *>(line + CACHE_LINE_BYTES);
+  }
+
+  ~NodeBarrier() { free(); }
+
+  NodeBarrier(const NodeBarrier &) = delete;
+  NodeBarrier &operator=(const NodeBarrier &) = delete;
+
+  // Wait for every rank of the node. The windows are synced on both sides,
+  // so what any rank stored to them before the barrier is visible to every
+  // rank after it.
+  void wait(std::initializer_list<const SharedImageWindow *> windows = {}) {
+    for (const SharedImageWindow *window : windows) {
+      window->sync();
+    }
+    local_sense = 1 - local_sense;
+    if (count->fetch_add(1, std::memory_order_acq_rel) == num_ranks - 1) {
+      // Last to arrive, reset for the next round before releasing the rest
+      count->store(0, std::memory_order_relaxed);
+      sense->store(local_sense, std::memory_order_release);
+    } else {
+      for (int spins = 0; sense->load(std::memory_order_acquire) != local_sense;
+           spins++) {
+        if (spins >= SPINS_BEFORE_YIELD) {
+          std::this_thread::yield();
+        }
+      }
+    }
+    for (const SharedImageWindow *window : windows) {
+      window->sync();
+    }
+  }
+
+  // Collective, must be called before MPI_Finalize
+  void free() {
+    if (win != MPI_WIN_NULL) {
+      MPI_Win_free(&win);
+      count = sense = nullptr;
+    }
+  }
+};
+
+// The chunk counter of PARTITION=dynamic self-scheduling, on a cache line of
+// its own in a node-shared window. Holds no counter for static partitioning.
+// Collective over node_comm.
+class SharedChunkCounter {
+private:
+  MPI_Win win = MPI_WIN_NULL;
+  std::atomic<long> *counter = nullptr;
+
+  static_assert(std::atomic<long>::is_always_lock_free,
+                "a counter shared between processes must be lock free");
+
+public:
+  explicit SharedChunkCounter(MPI_Comm node_comm) {
+    // Node rank 0 decides, the launcher may not forward PARTITION
+    int node_rank;
+    MPI_Comm_rank(node_comm, &node_rank);
+    int enabled = dynamicPartitionEnabled() ? 1 : 0;
+    MPI_Bcast(&enabled, 1, MPI_INT, 0, node_comm);
+    if (!enabled) {
+      return;
+    }
+
+    unsigned char *segment;
+    MPI_Win_allocate_shared(node_rank == 0 ? 2 * CACHE_LINE_BYTES : 0, 1,
+                            MPI_INFO_NULL, node_comm, &segment, &win);
+    MPI_Aint size;
+    int disp_unit;
+    MPI_Win_shared_query(win, 0, &size, &disp_unit, &segment);
+    void *line = alignUp(segment, CACHE_LINE_BYTES);
+    if (node_rank == 0) {
+      new (line) std::atomic<long>(0);
+    }
+    MPI_Barrier(node_comm);
+    counter = static_cast<std::atomic<long> *>(line);
+  }
+
+  ~SharedChunkCounter() { free(); }
+
+  SharedChunkCounter(const SharedChunkCounter &) = delete;
+  SharedChunkCounter &operator=(const SharedChunkCounter &) = delete;
+
+  // nullptr for static partitioning, see runPartition
+  std::atomic<long> *get() const { return counter; }
+
+  // Zero the counter for another pass. Only once every rank is done with the
+  // last pass, and a NodeBarrier must follow before the next one starts.
+  void reset() {
+    if (counter != nullptr) {
+      counter->store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Collective, must be called before MPI_Finalize
+  void free() {
+    if (win != MPI_WIN_NULL) {
+      MPI_Win_free(&win);
+      counter = nullptr;
+    }
+  }
+};
+
+// The windows, chunk counter and barrier of a tool's *_shared function, kept
+// across the calls on a series of images such as the bands of a streamed
+// image, so they are allocated and first-touched once instead of per call.
+// A window is only allocated again when a call needs more bytes than it has.
+// Collective over node_comm.
+class SharedWorkspace {
+private:
+  MPI_Comm node_comm;
+  std::vector<std::unique_ptr<SharedImageWindow>> windows;
+  SharedChunkCounter next_chunk;
+  NodeBarrier node_barrier;
+
+public:
+  explicit SharedWorkspace(MPI_Comm node_comm)
+      : node_comm(node_comm), next_chunk(node_comm), node_barrier(node_comm) {}
+
+  SharedWorkspace(const SharedWorkspace &) = delete;
+  SharedWorkspace &operator=(const SharedWorkspace &) = delete;
+
+  // Window index of at least bytes, see SharedImageWindow. written only
+  // applies when the window is allocated. bytes must be the same on every
+  // rank of the node.
+  SharedImageWindow &window(size_t index, size_t bytes,
+                            const std::vector<WorkRange> &written) {
+    if (windows.size() <= index) {
+      windows.resize(index + 1);
+    }
+    std::unique_ptr<SharedImageWindow> &window = windows[index];
+    if (window == nullptr || window->size() < bytes) {
+      window.reset();
+      window = std::make_unique<SharedImageWindow>(node_comm, bytes, written);
+    }
+    return *window;
+  }
+
+  // The chunk counter, zeroed for a pass that starts after the next
+  // barrier()
+  SharedChunkCounter &chunkCounter() {
+    next_chunk.reset();
+    return next_chunk;
+  }
+
+  NodeBarrier &barrier() { return node_barrier; }
+
+  // Collective, must be called before MPI_Finalize
+  void free() {
+    node_barrier.free();
+    next_chunk.free();
+    windows.clear();
+  }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mpi.h>
+#include <string>
+#include <thread>
+
+#include "band_stream.hpp"
+#include "buffer_pool.hpp"
+#include "perf_counters.hpp"
+
+// One band of the streamed image: rows [first, first + count) of an image of
+// rows x cols. data is nullptr and writer closed on every rank but 0.
+struct StreamBand {
+  unsigned char *data;
+  int first, count;
+  int rows, cols, channels;
+  PnmBandWriter &writer;
+};
+
+// Streaming mode of the MPI tools, see band_stream.hpp. Rank 0 reads the
+// input a band at a time, and every rank runs process(band) on it, which is
+// collective, returns the kernel time and writes the band's result through
+// band.writer on rank 0. The result is written to streamOutputPath(tag),
+// with rows and columns swapped if transposed. channels is the number of
+// channels the tool needs, 0 for any. Where MPI allows a helper thread, see
+// initMPIThreads(), rank 0 reads the next band into a second buffer while
+// the ranks process the current one. process should keep its windows across
+// the bands in a SharedWorkspace. Rank 0 prints the summed kernel time.
+// Returns 0, or -1 if the image could not be read or written, on every rank.
+// Collective over MPI_COMM_WORLD.
+template <typename Process>
+int runStreamMPI(PhaseCounters &counters, const std::string &input,
+                 const std::string &tag, bool transposed, int channels,
+                 Process process) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  PnmBandReader reader;
+  PnmBandWriter writer;
+  int dims[3] = {0, 0, 0};
+  if (rank == 0 && reader.open(input)) {
+    if (channels != 0 && reader.channels != channels) {
+      std::cerr << "Error: " << input << " has " << reader.channels
+                << " channels, " << channels << " are needed" << std::endl;
+    } else if (writer.open(streamOutputPath(tag, reader.channels),
+                           transposed ? reader.cols : reader.rows,
+                           transposed ? reader.rows : reader.cols,
+                           reader.channels)) {
+      dims[0] = reader.rows;
+      dims[1] = reader.cols;
+      dims[2] = reader.channels;
+    }
+  }
+  MPI_Bcast(dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  if (dims[0] == 0) {
+    return -1;
+  }
+
+  long row_bytes = (long)dims[1] * dims[2];
+  int band_rows = std::min(streamBandRows(row_bytes), dims[0]);
+  int thread_level;
+  MPI_Query_thread(&thread_level);
+  bool read_ahead = thread_level >= MPI_THREAD_FUNNELED;
+  size_t band_bytes = rank == 0 ? (size_t)band_rows * row_bytes : 0;
+  PooledBuffer band_buffers[2] = {PooledBuffer(band_bytes),
+                                  PooledBuffer(read_ahead ? band_bytes : 0)};
+  int current = 0;
+  std::thread next_read;
+  int next_ok = 1;
+  auto start = std::chrono::steady_clock::now();
+  double kernel_seconds = 0;
+  int bands = 0;
+  int ok = 1;
+  for (int first = 0; first < dims[0] && ok; first += band_rows) {
+    int count = std::min(band_rows, dims[0] - first);
+    if (rank == 0) {
+      // Only the read time not hidden behind the last band counts here
+      counters.begin("decode");
+      if (next_read.joinable()) {
+        next_read.join();
+        ok = next_ok;
+      } else {
+        ok = reader.read(first, count, band_buffers[current].data());
+      }
+      counters.end();
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!ok) {
+      break;
+    }
+    int next_first = first + band_rows;
+    if (rank == 0 && read_ahead && next_first < dims[0]) {
+      int next_count = std::min(band_rows, dims[0] - next_first);
+      unsigned char *next_data = band_buffers[1 - current].data();
+      next_read = std::thread([&reader, &next_ok, next_first, next_count,
+                               next_data] {
+        next_ok = reader.read(next_first, next_count, next_data);
+      });
+    }
+    StreamBand band{rank == 0 ? band_buffers[current].data() : nullptr,
+                    first,
+                    count,
+                    dims[0],
+                    dims[1],
+                    dims[2],
+                    writer};
+    kernel_seconds += process(band);
+    bands++;
+    // A failed write on rank 0 stops every rank
+    if (rank == 0) {
+      ok = writer.good();
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (read_ahead) {
+      current = 1 - current;
+    }
+  }
+  if (next_read.joinable()) {
+    next_read.join();
+  }
+  writer.close();
+  auto stop = std::chrono::steady_clock::now();
+
+  if (rank == 0) {
+    if (!ok) {
+      std::cerr << "Error: Could not stream " << input << std::endl;
+    }
+    std::cout << "Parallel time: " << (long)(kernel_seconds * 1e6)
+              << " microseconds" << std::endl;
+    printStreamReport(bands, band_rows,
+                      std::chrono::duration<double>(stop - start).count());
+  }
+  return ok ? 0 : -1;
+}
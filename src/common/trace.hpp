@@ -0,0 +1,163 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Timeline tracing of begin/end spans per thread, written as Chrome trace
+// event JSON that chrome://tracing and ui.perfetto.dev open. Enabled with
+// TRACE_FILE=<path>; otherwise a TraceScope costs one branch. Each thread
+// records into its own fixed size ring buffer, so recording takes no lock
+// and a long run keeps its most recent events.
+
+struct TraceEvent {
+  // Must outlive the trace, string literals in practice
+  const char *name;
+  const char *category;
+  int64_t begin_ns;
+  int64_t end_ns;
+};
+
+class TraceBuffer {
+private:
+  static constexpr size_t CAPACITY = size_t(1) << 16;
+  std::vector<TraceEvent> events;
+  size_t count = 0;
+
+public:
+  const int tid;
+
+  explicit TraceBuffer(int tid) : events(CAPACITY), tid(tid) {}
+
+  void push(const TraceEvent &event) {
+    events[count % CAPACITY] = event;
+    count++;
+  }
+
+  // Oldest first
+  template <typename Visit> void forEach(Visit visit) const {
+    size_t first = count > CAPACITY ? count - CAPACITY : 0;
+    for (size_t i = first; i < count; i++) {
+      visit(events[i % CAPACITY]);
+    }
+  }
+};
+
+inline const char *traceFile() {
+  static const char *path = std::getenv("TRACE_FILE");
+  return (path != nullptr && *path != '\0') ? path : nullptr;
+}
+
+inline bool traceEnabled() { return traceFile() != nullptr; }
+
+inline int64_t traceNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Every thread's buffer, kept after the thread exits so its events still get
+// written
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+inline TraceRegistry &traceRegistry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+inline TraceBuffer &threadTraceBuffer() {
+  thread_local TraceBuffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    TraceRegistry &registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.buffers.push_back(
+        std::make_unique<TraceBuffer>((int)registry.buffers.size()));
+    buffer = registry.buffers.back().get();
+  }
+  return *buffer;
+}
+
+// Records the span from construction to end() or destruction on the calling
+// thread
+class TraceScope {
+private:
+  const char *name;
+  const char *category;
+  int64_t begin = -1;
+
+public:
+  explicit TraceScope(const char *name, const char *category = "compute")
+      : name(name), category(category) {
+    if (traceEnabled()) {
+      begin = traceNow();
+    }
+  }
+
+  ~TraceScope() { end(); }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+  void end() {
+    if (begin >= 0) {
+      threadTraceBuffer().push({name, category, begin, traceNow()});
+      begin = -1;
+    }
+  }
+};
+
+// This process' events as comma separated trace event objects, timestamps
+// shifted back by offset_ns onto the reference clock
+inline std::string traceEventsJson(int pid, const std::string &process_name,
+                                   int64_t offset_ns) {
+  std::ostringstream json;
+  json.precision(3);
+  json << std::fixed;
+  json << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+       << ",\"args\":{\"name\":\"" << process_name << "\"}}";
+
+  TraceRegistry &registry = traceRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto &buffer : registry.buffers) {
+    json << ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+         << ",\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"thread "
+         << buffer->tid << "\"}}";
+    buffer->forEach([&](const TraceEvent &event) {
+      json << ",{\"name\":\"" << event.name << "\",\"cat\":\""
+           << event.category << "\",\"ph\":\"X\",\"pid\":" << pid
+           << ",\"tid\":" << buffer->tid
+           << ",\"ts\":" << (event.begin_ns - offset_ns) / 1e3
+           << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1e3 << "}";
+    });
+  }
+  return json.str();
+}
+
+inline void writeTraceFile(const std::string &events) {
+  std::ofstream out(traceFile());
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << events << "]}"
+      << std::endl;
+  if (!out) {
+    std::cerr << "Error: Could not write trace " << traceFile() << std::endl;
+    return;
+  }
+  std::cout << "Trace written to " << traceFile() << std::endl;
+}
+
+// Write the trace of a single process program, a no-op unless TRACE_FILE is
+// set
+inline void writeTrace(const std::string &process_name) {
+  if (traceEnabled()) {
+    writeTraceFile(traceEventsJson(0, process_name, 0));
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mpi.h>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+// Merge the trace of every rank into the single TRACE_FILE written by the
+// root. Ranks on one node share the monotonic clock; across nodes the
+// clocks are aligned on the instant every rank leaves a barrier, which is
+// accurate to the barrier's exit skew. Collective over comm.
+inline void writeTraceMPI(MPI_Comm comm, int root = 0) {
+  // The root decides, the launcher may not forward TRACE_FILE to every rank
+  int enabled = traceEnabled() ? 1 : 0;
+  MPI_Bcast(&enabled, 1, MPI_INT, root, comm);
+  if (!enabled) {
+    return;
+  }
+
+  int rank, num_processes;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &num_processes);
+
+  MPI_Barrier(comm);
+  int64_t local_now = traceNow();
+  int64_t root_now = local_now;
+  MPI_Bcast(&root_now, 1, MPI_INT64_T, root, comm);
+
+  std::string events = traceEventsJson(rank, "rank " + std::to_string(rank),
+                                       local_now - root_now);
+  int length = (int)events.size();
+  std::vector<int> lengths(num_processes), offsets(num_processes);
+  MPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, root, comm);
+
+  std::string merged;
+  if (rank == root) {
+    int total = 0;
+    for (int r = 0; r < num_processes; r++) {
+      offsets[r] = total;
+      total += lengths[r];
+    }
+    merged.resize(total);
+  }
+  MPI_Gatherv(events.data(), length, MPI_CHAR, &merged[0], lengths.data(),
+              offsets.data(), MPI_CHAR, root, comm);
+
+  if (rank == root) {
+    // Each rank's events are a comma separated list, join them the same way
+    std::string joined;
+    for (int r = 0; r < num_processes; r++) {
+      if (r > 0) {
+        joined += ',';
+      }
+      joined.append(merged, offsets[r], lengths[r]);
+    }
+    writeTraceFile(joined);
+  }
+}
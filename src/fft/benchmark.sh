@@ -1,11 +1,12 @@
 #!/bin/bash
-export PROJECT_ROOT="/Users/joseph280996/Code/School/PHPC/Project"
+export PROJECT_ROOT="$(cd "$(dirname "$0")/../.." && pwd)"
 export SEQ_OUTPUT_DIR="$PROJECT_ROOT/output/sequential"
 export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/parallel"
+mkdir -p "$SEQ_OUTPUT_DIR" "$PAR_OUTPUT_DIR"
 
 echo "Start fft transform"
-# mpirun -np 8 ./parallel ~/Code/School/PHPC/Project/data/input.jpg > output.log 2>&1
+# mpirun -np 8 ./parallel "$PROJECT_ROOT/data/input.jpg" > output.log 2>&1
 export OMP_NUM_THREADS=10
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-./sequential ~/Code/School/PHPC/Project/data/input.jpg
+./parallel_openmp "$PROJECT_ROOT/data/input.jpg"
+./sequential "$PROJECT_ROOT/data/input.jpg"
 echo "Finished fft transform"
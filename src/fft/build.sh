@@ -6,3 +6,7 @@ make
 
 mv parallel_openmp ..
 mv sequential ..
+# Only built when MPI is available
+if [ -f parallel ]; then
+  mv parallel ..
+fi
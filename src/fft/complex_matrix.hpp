@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <complex>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "../common/buffer_pool.hpp"
+
+// Row-major complex matrix backed by a single 64-byte aligned allocation from
+// the buffer pool, so the matrices of the next channel or image reuse it.
+// Rows are contiguous, so the column pass of a 2D FFT is done as a row pass
+// after a transpose instead of a strided gather.
+template <typename T> class ComplexMatrix {
+private:
+  // Square tiles of 32 complex<double> rows are 512 bytes wide, two tiles
+  // fit comfortably in L1
+  static constexpr int TILE = 32;
+
+  struct PoolDeleter {
+    size_t bytes = 0;
+    void operator()(std::complex<T> *p) const {
+      bufferPool().release(p, bytes);
+    }
+  };
+  using Storage = std::unique_ptr<std::complex<T>[], PoolDeleter>;
+
+  int rows, cols;
+  Storage data;
+
+  static Storage allocate(int rows, int cols) {
+    size_t bytes = (size_t)rows * cols * sizeof(std::complex<T>);
+    void *p = bufferPool().allocate(bytes);
+    return Storage(static_cast<std::complex<T> *>(p), PoolDeleter{bytes});
+  }
+
+  // Scratch destination of a rectangular transpose in progress
+  Storage transposed;
+
+public:
+  // Contents are left uninitialized so the first write can happen on the
+  // thread that uses the row
+  ComplexMatrix(int rows, int cols)
+      : rows(rows), cols(cols), data(allocate(rows, cols)) {}
+
+  ComplexMatrix(ComplexMatrix &&) = default;
+  ComplexMatrix &operator=(ComplexMatrix &&) = default;
+  ComplexMatrix(const ComplexMatrix &) = delete;
+  ComplexMatrix &operator=(const ComplexMatrix &) = delete;
+
+  int numRows() const { return rows; }
+  int numCols() const { return cols; }
+
+  std::complex<T> *row(int i) { return data.get() + (size_t)i * cols; }
+  const std::complex<T> *row(int i) const {
+    return data.get() + (size_t)i * cols;
+  }
+
+  // The blocked transpose is split into tile rows so callers can schedule
+  // them as independent tasks: beginTranspose(), transposeTileRow(t) for
+  // every t < numTileRows(), then finishTranspose().
+  int numTileRows() const { return (rows + TILE - 1) / TILE; }
+
+  void beginTranspose() {
+    if (rows != cols) {
+      transposed = allocate(cols, rows);
+    }
+  }
+
+  void transposeTileRow(int tile_row) {
+    int bi = tile_row * TILE;
+    int i_end = std::min(bi + TILE, rows);
+    std::complex<T> *m = data.get();
+
+    if (rows == cols) {
+      // In place: tiles right of the diagonal are swapped with their mirror,
+      // the diagonal tile is transposed on itself
+      int n = rows;
+      for (int bj = bi; bj < n; bj += TILE) {
+        int j_end = std::min(bj + TILE, n);
+        for (int i = bi; i < i_end; i++) {
+          int j_start = (bi == bj) ? i + 1 : bj;
+          for (int j = j_start; j < j_end; j++) {
+            std::swap(m[(size_t)i * n + j], m[(size_t)j * n + i]);
+          }
+        }
+      }
+      return;
+    }
+
+    // Rectangular: out of place into the scratch matrix
+    std::complex<T> *dst = transposed.get();
+    for (int bj = 0; bj < cols; bj += TILE) {
+      int j_end = std::min(bj + TILE, cols);
+      for (int i = bi; i < i_end; i++) {
+        for (int j = bj; j < j_end; j++) {
+          dst[(size_t)j * rows + i] = m[(size_t)i * cols + j];
+        }
+      }
+    }
+  }
+
+  void finishTranspose() {
+    if (rows != cols) {
+      data = std::move(transposed);
+    }
+    std::swap(rows, cols);
+  }
+
+  // Serial transpose, swapping the row and column counts
+  void transpose() {
+    beginTranspose();
+    for (int t = 0; t < numTileRows(); t++) {
+      transposeTileRow(t);
+    }
+    finishTranspose();
+  }
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cmath>
+
+#include "../common/roofline.hpp"
+#include "frequency_filter.hpp"
+
+// Roofline cost of one FFT operation over num_channels 8-bit channels, the
+// same model for the sequential, OpenMP and MPI versions. A radix-2
+// transform of n points counts as 5 n log2(n) flops. The traffic is the
+// 8-bit input and output plus one read and one write of the complex matrix
+// per 1D pass (rows, then columns), which is what a transform that keeps a
+// whole row or column in cache has to move; transposes and copies on top of
+// that show up as lower achieved bandwidth.
+inline KernelCost fftOperationCost(const FilterSpec &spec, int rows, int cols,
+                                   int num_channels, size_t complex_bytes) {
+  // Same padding as padChannel
+  int margin = filterMargin(spec);
+  double padded_rows = 1, padded_cols = 1;
+  while (padded_rows < rows + 2 * margin) {
+    padded_rows *= 2;
+  }
+  while (padded_cols < cols + 2 * margin) {
+    padded_cols *= 2;
+  }
+
+  double pixels = (double)rows * cols;
+  double points = padded_rows * padded_cols;
+  double matrix_bytes = points * complex_bytes;
+  double transform_flops = 5 * points * std::log2(points);
+
+  KernelCost cost;
+  if (spec.operation == SPECTRUM) {
+    // Forward transform, then magnitude, log and normalization at 8 flops
+    // per point (sqrt and log count as one), written at the padded size
+    cost.bytes = pixels + 4 * matrix_bytes + points;
+    cost.ops = transform_flops + 8 * points;
+  } else {
+    // Forward transform, complex by real filter multiply, inverse transform
+    // and scaling back to 8-bit pixels
+    cost.bytes = pixels + 8 * matrix_bytes + pixels;
+    cost.ops = 2 * transform_flops + 2 * points + 3 * pixels;
+  }
+  return num_channels * cost;
+}
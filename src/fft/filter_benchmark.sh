@@ -0,0 +1,19 @@
+#!/bin/bash
+# Compare the spatial Gaussian blur against FFT convolution over growing
+# radii. The spatial blur costs O(radius) per pixel, the FFT blur is flat.
+export PROJECT_ROOT="$(cd "$(dirname "$0")/../.." && pwd)"
+export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/parallel"
+INPUT="$PROJECT_ROOT/data/input.jpg"
+mkdir -p "$PAR_OUTPUT_DIR"
+
+export OMP_NUM_THREADS=10
+echo "Start blur radius sweep"
+for radius in 2 5 10 20 40 80; do
+  sigma=$(awk "BEGIN { print $radius / 2.5 }")
+  echo "radius=$radius"
+  echo -n "Spatial blur: "
+  ../gaussian_blur/parallel_omp "$INPUT" $radius $sigma | grep "Parallel time"
+  echo -n "FFT blur: "
+  ./parallel_openmp "$INPUT" float blur $radius $sigma | grep "Parallel time"
+done
+echo "Finished blur radius sweep"
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Frequency-domain filtering shared by the OpenMP fft2D and MPI PencilFFT
+// paths: forward FFT, pointwise multiply with a filter response, inverse FFT.
+
+enum Operation { SPECTRUM = 0, LOWPASS = 1, HIGHPASS = 2, BANDPASS = 3, BLUR = 4 };
+enum FilterShape { GAUSSIAN = 0, BUTTERWORTH = 1 };
+
+// Frequency-domain operation requested on the command line. Cutoffs are
+// normalized frequencies in cycles/pixel (0 - 0.5) so they do not depend on
+// how much the image gets padded.
+struct FilterSpec {
+  Operation operation = SPECTRUM;
+  FilterShape shape = GAUSSIAN;
+  double cutoff = 0;      // lowpass/highpass cutoff, bandpass lower edge
+  double cutoff_high = 0; // bandpass upper edge
+  int order = 2;          // Butterworth order
+  int radius = 0;         // blur kernel radius
+  float sigma = 0;        // blur kernel sigma
+};
+
+inline FilterShape parseFilterShape(const std::string &shape) {
+  if (shape == "g" || shape == "gaussian") {
+    return GAUSSIAN;
+  } else if (shape == "b" || shape == "butterworth") {
+    return BUTTERWORTH;
+  } else {
+    throw std::invalid_argument(
+        "Invalid filter shape. Use 'g'/'gaussian' or 'b'/'butterworth'");
+  }
+}
+
+// Parse "<operation> <params...>" starting at argv[first]
+inline FilterSpec parseFilterSpec(int argc, char **argv, int first) {
+  FilterSpec spec;
+  if (first >= argc) {
+    return spec;
+  }
+
+  std::string operation = argv[first];
+  int params = argc - first - 1;
+  if (operation == "spectrum" && params == 0) {
+    spec.operation = SPECTRUM;
+  } else if ((operation == "lowpass" || operation == "highpass") &&
+             (params == 2 || params == 3)) {
+    spec.operation = operation == "lowpass" ? LOWPASS : HIGHPASS;
+    spec.shape = parseFilterShape(argv[first + 1]);
+    spec.cutoff = std::stod(argv[first + 2]);
+    if (params == 3) {
+      spec.order = std::stoi(argv[first + 3]);
+    }
+  } else if (operation == "bandpass" && (params == 3 || params == 4)) {
+    spec.operation = BANDPASS;
+    spec.shape = parseFilterShape(argv[first + 1]);
+    spec.cutoff = std::stod(argv[first + 2]);
+    spec.cutoff_high = std::stod(argv[first + 3]);
+    if (params == 4) {
+      spec.order = std::stoi(argv[first + 4]);
+    }
+  } else if (operation == "blur" && params == 2) {
+    spec.operation = BLUR;
+    spec.radius = std::stoi(argv[first + 1]);
+    spec.sigma = std::stof(argv[first + 2]);
+  } else {
+    throw std::invalid_argument("Invalid operation. Use 'spectrum', "
+                                "'lowpass|highpass <shape> <cutoff> [order]', "
+                                "'bandpass <shape> <low> <high> [order]' or "
+                                "'blur <radius> <sigma>'");
+  }
+
+  if (spec.cutoff < 0 || spec.cutoff_high < 0 || spec.order < 1 ||
+      (spec.operation == BANDPASS && spec.cutoff_high <= spec.cutoff) ||
+      (spec.operation == BLUR && (spec.radius < 0 || spec.sigma <= 0))) {
+    throw std::invalid_argument("Invalid filter parameters");
+  }
+  return spec;
+}
+
+inline void printFilterUsage(std::ostream &out) {
+  out << "operation: 'spectrum' (default) magnitude spectrum" << std::endl;
+  out << "           'lowpass|highpass <gaussian|butterworth> <cutoff> "
+         "[order]'"
+      << std::endl;
+  out << "           'bandpass <gaussian|butterworth> <low> <high> [order]'"
+      << std::endl;
+  out << "           'blur <radius> <sigma>' Gaussian blur by FFT "
+         "convolution"
+      << std::endl;
+  out << "cutoffs are normalized frequencies in cycles/pixel (0 - 0.5)"
+      << std::endl;
+}
+
+// Output file name for the requested operation
+inline std::string operationName(const FilterSpec &spec) {
+  switch (spec.operation) {
+  case LOWPASS:
+    return "lowpass";
+  case HIGHPASS:
+    return "highpass";
+  case BANDPASS:
+    return "bandpass";
+  case BLUR:
+    return "fft_blurred";
+  default:
+    return "fft";
+  }
+}
+
+// The operation with all of its parameters, e.g. for a result cache key
+inline std::string filterKey(const FilterSpec &spec) {
+  return operationName(spec) + " " + std::to_string(spec.shape) + " " +
+         std::to_string(spec.cutoff) + " " + std::to_string(spec.cutoff_high) +
+         " " + std::to_string(spec.order) + " " + std::to_string(spec.radius) +
+         " " + std::to_string(spec.sigma);
+}
+
+// Border added around each channel before the transform. Blur needs a full
+// kernel radius of replicated pixels so the circular convolution matches the
+// clamped spatial one.
+inline int filterMargin(const FilterSpec &spec) {
+  return spec.operation == BLUR ? spec.radius : 0;
+}
+
+// Highpass and bandpass remove the DC term, so they are offset to mid-grey
+inline double filterOffset(const FilterSpec &spec) {
+  return (spec.operation == HIGHPASS || spec.operation == BANDPASS) ? 128 : 0;
+}
+
+// Pad a channel to power of 2 dimensions with a replicated border so the
+// circular convolution does not wrap the opposite edge into the image
+inline cv::Mat padChannel(const cv::Mat &channel, int margin) {
+  int padded_rows = 1, padded_cols = 1;
+  while (padded_rows < channel.rows + 2 * margin) {
+    padded_rows *= 2;
+  }
+  while (padded_cols < channel.cols + 2 * margin) {
+    padded_cols *= 2;
+  }
+
+  cv::Mat padded;
+  cv::copyMakeBorder(channel, padded, margin,
+                     padded_rows - channel.rows - margin, margin,
+                     padded_cols - channel.cols - margin, cv::BORDER_REPLICATE);
+  return padded;
+}
+
+// Filter response on an unshifted padded_rows x padded_cols spectrum
+class FrequencyFilter {
+private:
+  FilterSpec spec;
+  int padded_rows, padded_cols;
+  std::vector<double> row_spectrum, col_spectrum;
+
+  // Same normalized 1D Gaussian kernel as common/gaussian_kernel.hpp, in
+  // double precision
+  static std::vector<double> createGaussianKernel(int radius, float sigma) {
+    std::vector<double> kernel(2 * radius + 1);
+    double sum = 0;
+    for (int x = -radius; x <= radius; x++) {
+      kernel[x + radius] = std::exp(-(x * x) / (2.0 * sigma * sigma));
+      sum += kernel[x + radius];
+    }
+    for (double &k : kernel) {
+      k /= sum;
+    }
+    return kernel;
+  }
+
+  // DFT of the kernel wrapped around index 0 of an n-point signal. The
+  // kernel is symmetric so the spectrum is a real cosine sum, and it only
+  // has 2 * radius + 1 taps so the direct sum is cheap.
+  static std::vector<double> kernelSpectrum(const std::vector<double> &kernel,
+                                            int radius, int n) {
+    const double PI = 3.14159265358979323846;
+    std::vector<double> spectrum(n);
+    for (int u = 0; u < n; u++) {
+      double sum = kernel[radius];
+      for (int x = 1; x <= radius; x++) {
+        sum += 2 * kernel[radius + x] * std::cos(2 * PI * u * x / n);
+      }
+      spectrum[u] = sum;
+    }
+    return spectrum;
+  }
+
+  double lowpass(double d, double cutoff) const {
+    if (cutoff == 0) {
+      return d == 0 ? 1 : 0;
+    }
+    if (spec.shape == GAUSSIAN) {
+      return std::exp(-(d * d) / (2 * cutoff * cutoff));
+    }
+    return 1 / (1 + std::pow(d / cutoff, 2 * spec.order));
+  }
+
+public:
+  FrequencyFilter(const FilterSpec &spec, int padded_rows, int padded_cols)
+      : spec(spec), padded_rows(padded_rows), padded_cols(padded_cols) {
+    // The 2D Gaussian kernel is separable so its spectrum is the outer
+    // product of the row and column spectrums
+    if (spec.operation == BLUR) {
+      std::vector<double> kernel = createGaussianKernel(spec.radius, spec.sigma);
+      row_spectrum = kernelSpectrum(kernel, spec.radius, padded_rows);
+      col_spectrum = kernelSpectrum(kernel, spec.radius, padded_cols);
+    }
+  }
+
+  double response(int i, int j) const {
+    if (spec.operation == BLUR) {
+      return row_spectrum[i] * col_spectrum[j];
+    }
+
+    double u = (double)(i < padded_rows / 2 ? i : i - padded_rows) / padded_rows;
+    double v = (double)(j < padded_cols / 2 ? j : j - padded_cols) / padded_cols;
+    double d = std::sqrt(u * u + v * v);
+    if (spec.operation == LOWPASS) {
+      return lowpass(d, spec.cutoff);
+    } else if (spec.operation == HIGHPASS) {
+      return 1 - lowpass(d, spec.cutoff);
+    }
+    return lowpass(d, spec.cutoff_high) * (1 - lowpass(d, spec.cutoff));
+  }
+};
@@ -6,50 +6,100 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "fft_cost.hpp"
+#include "frequency_filter.hpp"
+#include "../common/buffer_pool_mpi.hpp"
+#include "../common/result_cache_mpi.hpp"
+#include "../common/trace_mpi.hpp"
+
 const double PI = 3.14159265358979323846;
-using Complex = std::complex<double>;
+template <typename T> using Complex = std::complex<T>;
+
+enum Precision { DOUBLE = 0, SINGLE = 1, MIXED = 2, COMPARE = 3 };
+
+Precision parsePrecision(const std::string &type) {
+  if (type == "d" || type == "double") {
+    return DOUBLE;
+  } else if (type == "f" || type == "float") {
+    return SINGLE;
+  } else if (type == "m" || type == "mixed") {
+    return MIXED;
+  } else if (type == "c" || type == "compare") {
+    return COMPARE;
+  } else {
+    throw std::invalid_argument("Invalid precision. Use 'double', 'float', "
+                                "'mixed' or 'compare'");
+  }
+}
+
+// MPI datatype matching Complex<T>, so the transpose traffic shrinks with the
+// precision
+template <typename T> struct MPIComplex;
+template <> struct MPIComplex<float> {
+  static MPI_Datatype type() { return MPI_CXX_FLOAT_COMPLEX; }
+};
+template <> struct MPIComplex<double> {
+  static MPI_Datatype type() { return MPI_CXX_DOUBLE_COMPLEX; }
+};
 
 // 1D FFT implementation
-// Pure forward 1D FFT implementation
-std::vector<Complex> fft1D(std::vector<Complex> &x) {
+// Recursive radix-2 FFT, the inverse transform is left unscaled
+// T is the data precision, TW the precision of the twiddle recurrence
+template <typename T, typename TW = T>
+std::vector<Complex<T>> fft1D(std::vector<Complex<T>> &x,
+                              bool inverse = false) {
   int n = x.size();
   if (n <= 1)
     return x;
 
   // Split into even and odd
-  std::vector<Complex> even(n / 2), odd(n / 2);
+  std::vector<Complex<T>> even(n / 2), odd(n / 2);
   for (int i = 0; i < n / 2; i++) {
     even[i] = x[2 * i];
     odd[i] = x[2 * i + 1];
   }
 
   // Recursive FFT
-  even = fft1D(even);
-  odd = fft1D(odd);
+  even = fft1D<T, TW>(even, inverse);
+  odd = fft1D<T, TW>(odd, inverse);
 
   // Combine
-  std::vector<Complex> result(n);
-  Complex w = 1;
-  Complex wn = std::polar(1.0, -2 * PI / n); // Only forward FFT
+  std::vector<Complex<T>> result(n);
+  Complex<TW> w = 1;
+  Complex<TW> wn = std::polar(TW(1), TW((inverse ? 2 : -2) * PI / n));
 
   for (int i = 0; i < n / 2; i++) {
-    result[i] = even[i] + w * odd[i];
-    result[i + n / 2] = even[i] - w * odd[i];
+    Complex<T> t = Complex<T>(w) * odd[i];
+    result[i] = even[i] + t;
+    result[i + n / 2] = even[i] - t;
     w *= wn;
   }
 
   return result;
 }
 
-class PencilFFT {
+// Diagnostic output of the distributed data after every step of the
+// transform. It synchronizes all ranks several times per transform, so it is
+// only compiled in with -DPENCIL_FFT_DEBUG (cmake -DPENCIL_FFT_DEBUG=ON).
+#ifdef PENCIL_FFT_DEBUG
+constexpr bool PENCIL_FFT_DEBUG_OUTPUT = true;
+#else
+constexpr bool PENCIL_FFT_DEBUG_OUTPUT = false;
+#endif
+
+template <typename T, typename TW = T> class PencilFFT {
 private:
   int rank, size;
   int rows, cols;
   int local_rows;
   MPI_Comm comm;
-  std::vector<Complex> local_data;
+  MPI_Datatype complex_type = MPIComplex<T>::type();
+  PooledVector<Complex<T>> local_data;
 
   void debugPrint(const std::string &message) {
+    if constexpr (!PENCIL_FFT_DEBUG_OUTPUT) {
+      return;
+    }
     MPI_Barrier(comm); // Synchronize for cleaner output
     if (rank == 0)
       std::cout << "\n=== " << message << " ===" << std::endl;
@@ -64,6 +114,22 @@ private:
     MPI_Barrier(comm);
   }
 
+  // Print the magnitudes of the first 5x5 local values of rank 0
+  void debugCorner(const std::string &title) {
+    if constexpr (!PENCIL_FFT_DEBUG_OUTPUT) {
+      return;
+    }
+    if (rank == 0) {
+      std::cout << title << " (first 5x5):" << std::endl;
+      for (int i = 0; i < std::min(5, local_rows); i++) {
+        for (int j = 0; j < std::min(5, cols); j++) {
+          std::cout << std::abs(local_data[i * cols + j]) << " ";
+        }
+        std::cout << std::endl;
+      }
+    }
+  }
+
 public:
   PencilFFT(int total_rows, int total_cols, MPI_Comm comm = MPI_COMM_WORLD)
       : rows(total_rows), cols(total_cols), comm(comm) {
@@ -84,6 +150,7 @@ public:
   }
 
   void distributeData(const cv::Mat &channel) {
+    TraceScope scope("distribute", "comm");
     // Create pencil distribution
     int base_rows = rows / size;
     int my_rows = (rank == size - 1) ? rows - rank * base_rows : base_rows;
@@ -95,150 +162,115 @@ public:
       // Copy own portion
       for (int i = 0; i < local_rows; i++) {
         for (int j = 0; j < cols; j++) {
-          local_data[i * cols + j] = Complex(channel.at<uchar>(i, j), 0);
+          local_data[i * cols + j] = Complex<T>(channel.at<uchar>(i, j), 0);
         }
       }
 
       // Send to other processes
       for (int p = 1; p < size; p++) {
         int p_rows = (p == size - 1) ? rows - p * base_rows : base_rows;
-        std::vector<Complex> temp_buffer(p_rows * cols);
+        PooledVector<Complex<T>> temp_buffer(p_rows * cols);
 
         for (int i = 0; i < p_rows; i++) {
           for (int j = 0; j < cols; j++) {
             temp_buffer[i * cols + j] =
-                Complex(channel.at<uchar>(p * base_rows + i, j), 0);
+                Complex<T>(channel.at<uchar>(p * base_rows + i, j), 0);
           }
         }
 
-        MPI_Send(temp_buffer.data(), p_rows * cols, MPI_DOUBLE_COMPLEX, p, 0,
+        MPI_Send(temp_buffer.data(), p_rows * cols, complex_type, p, 0,
                  comm);
       }
     } else {
       // Receive data
       MPI_Status status;
-      MPI_Recv(local_data.data(), local_rows * cols, MPI_DOUBLE_COMPLEX, 0, 0,
+      MPI_Recv(local_data.data(), local_rows * cols, complex_type, 0, 0,
                comm, &status);
     }
   }
 
-  void computeFFT() {
-    if (rank == 0) {
-      std::cout << "Starting FFT computation" << std::endl;
-    }
-
-    // Debug: Print first few values before any operation
-    if (rank == 0) {
-      std::cout << "Initial values (first 5x5):" << std::endl;
-      for (int i = 0; i < std::min(5, local_rows); i++) {
-        for (int j = 0; j < std::min(5, cols); j++) {
-          std::cout << std::abs(local_data[i * cols + j]) << " ";
-        }
-        std::cout << std::endl;
-      }
+  void computeFFT(bool inverse = false) {
+    if (PENCIL_FFT_DEBUG_OUTPUT && rank == 0) {
+      std::cout << "Starting " << (inverse ? "inverse " : "")
+                << "FFT computation" << std::endl;
     }
+    debugCorner("Initial values");
 
     // 1. Row-wise FFT
+    TraceScope row_fft("row fft");
     for (int i = 0; i < local_rows; i++) {
-      std::vector<Complex> row(cols);
+      std::vector<Complex<T>> row(cols);
       for (int j = 0; j < cols; j++) {
         row[j] = local_data[i * cols + j];
       }
-      row = fft1D(row);
+      row = fft1D<T, TW>(row, inverse);
       for (int j = 0; j < cols; j++) {
         local_data[i * cols + j] = row[j];
       }
     }
 
-    // Debug: Print after row FFT
-    if (rank == 0) {
-      std::cout << "\nAfter row FFT (first 5x5):" << std::endl;
-      for (int i = 0; i < std::min(5, local_rows); i++) {
-        for (int j = 0; j < std::min(5, cols); j++) {
-          std::cout << std::abs(local_data[i * cols + j]) << " ";
-        }
-        std::cout << std::endl;
-      }
-    }
+    row_fft.end();
+    debugCorner("\nAfter row FFT");
 
     // 2. Transpose
     int old_rows = local_rows;
     int old_cols = cols;
     transposeGlobal();
 
-    // Debug: Print after transpose
-    if (rank == 0) {
-      std::cout << "\nAfter transpose (first 5x5):" << std::endl;
-      for (int i = 0; i < std::min(5, local_rows); i++) {
-        for (int j = 0; j < std::min(5, cols); j++) {
-          std::cout << std::abs(local_data[i * cols + j]) << " ";
-        }
-        std::cout << std::endl;
-      }
+    debugCorner("\nAfter transpose");
+    if (PENCIL_FFT_DEBUG_OUTPUT && rank == 0) {
       std::cout << "New dimensions: " << local_rows << "x" << cols << " (was "
                 << old_rows << "x" << old_cols << ")" << std::endl;
     }
 
     // 3. Column-wise FFT (now row-wise after transpose)
+    TraceScope column_fft("column fft");
     for (int i = 0; i < local_rows; i++) {
-      std::vector<Complex> row(cols);
+      std::vector<Complex<T>> row(cols);
       for (int j = 0; j < cols; j++) {
         row[j] = local_data[i * cols + j];
       }
-      row = fft1D(row);
+      row = fft1D<T, TW>(row, inverse);
       for (int j = 0; j < cols; j++) {
         local_data[i * cols + j] = row[j];
       }
     }
 
-    // Debug: Print after column FFT
-    if (rank == 0) {
-      std::cout << "\nAfter column FFT (first 5x5):" << std::endl;
-      for (int i = 0; i < std::min(5, local_rows); i++) {
-        for (int j = 0; j < std::min(5, cols); j++) {
-          std::cout << std::abs(local_data[i * cols + j]) << " ";
-        }
-        std::cout << std::endl;
-      }
-    }
+    column_fft.end();
+    debugCorner("\nAfter column FFT");
 
     // 4. Transpose back
     transposeGlobal();
 
-    // Debug: Print final result
-    if (rank == 0) {
-      std::cout << "\nFinal result (first 5x5):" << std::endl;
-      for (int i = 0; i < std::min(5, local_rows); i++) {
-        for (int j = 0; j < std::min(5, cols); j++) {
-          std::cout << std::abs(local_data[i * cols + j]) << " ";
-        }
-        std::cout << std::endl;
-      }
-    }
+    debugCorner("\nFinal result");
   }
 
   void transposeGlobal() {
-    if (rank == 0) {
+    if (PENCIL_FFT_DEBUG_OUTPUT && rank == 0) {
       std::cout << "Starting sequential transpose..." << std::endl;
     }
 
     double trans_start = MPI_Wtime();
 
     // Find the maximum data size across all processes
+    TraceScope exchange("allgather", "comm");
     int my_data_size = local_rows * cols;
     int max_data_size;
     MPI_Allreduce(&my_data_size, &max_data_size, 1, MPI_INT, MPI_MAX, comm);
 
     // Pad local data to max size
-    std::vector<Complex> padded_local = local_data;
-    padded_local.resize(max_data_size, Complex(0, 0));
+    PooledVector<Complex<T>> padded_local = local_data;
+    padded_local.resize(max_data_size, Complex<T>(0, 0));
 
     // Gather all data using Allgather
-    std::vector<Complex> global_data(max_data_size * size);
-    MPI_Allgather(padded_local.data(), max_data_size, MPI_DOUBLE_COMPLEX,
-                  global_data.data(), max_data_size, MPI_DOUBLE_COMPLEX, comm);
+    PooledVector<Complex<T>> global_data(max_data_size * size);
+    MPI_Allgather(padded_local.data(), max_data_size, complex_type,
+                  global_data.data(), max_data_size, complex_type, comm);
+    exchange.end();
 
-    // Each process performs transpose on its portion
+    // Each process gathers its block of columns, which become its rows
+    TraceScope reorder("transpose");
+    int old_cols = cols;
     int new_rows = cols / size;
     if (rank == size - 1) {
       new_rows = cols - (size - 1) * (cols / size);
@@ -247,13 +279,14 @@ public:
 
     // Resize local_data for the new dimensions
     local_data.resize(new_rows * new_cols);
-    std::fill(local_data.begin(), local_data.end(), Complex(0, 0));
+    std::fill(local_data.begin(), local_data.end(), Complex<T>(0, 0));
 
     // Calculate my portion of the transpose
     int start_col = rank * (cols / size);
     int end_col = (rank == size - 1) ? cols : (rank + 1) * (cols / size);
 
     for (int p = 0; p < size; p++) {
+      int p_start_row = p * (rows / size);
       int p_rows = rows / size;
       if (p == size - 1) {
         p_rows = rows - (size - 1) * (rows / size);
@@ -263,33 +296,39 @@ public:
         for (int j = start_col; j < end_col; j++) {
           int src_idx = p * max_data_size + i * cols + j;
           int local_j = j - start_col;
-          if (src_idx < global_data.size()) {
-            local_data[local_j * new_rows + i] = global_data[src_idx];
-          }
+          local_data[local_j * new_cols + p_start_row + i] =
+              global_data[src_idx];
         }
       }
     }
 
-    // Update dimensions
+    // Update dimensions, the global matrix is now cols x rows
     local_rows = new_rows;
     cols = new_cols;
+    rows = old_cols;
+    reorder.end();
 
-    MPI_Barrier(comm);
-    double trans_end = MPI_Wtime();
-    if (rank == 0) {
-      std::cout << "Sequential transpose time: " << trans_end - trans_start
-                << " seconds" << std::endl;
+    // The allgather already synchronized the data, this barrier only times
+    // the slowest rank's transpose
+    if constexpr (PENCIL_FFT_DEBUG_OUTPUT) {
+      MPI_Barrier(comm);
+      double trans_end = MPI_Wtime();
+      if (rank == 0) {
+        std::cout << "Sequential transpose time: " << trans_end - trans_start
+                  << " seconds" << std::endl;
+      }
     }
   }
 
   void collectResult(cv::Mat &magnitude_spectrum) {
+    TraceScope scope("collect", "comm");
     if (rank == 0) {
-      magnitude_spectrum = cv::Mat(rows, cols, CV_64F);
+      magnitude_spectrum = cv::Mat(rows, cols, cv::DataType<T>::type);
 
       // Copy own portion
       for (int i = 0; i < local_rows; i++) {
         for (int j = 0; j < cols; j++) {
-          magnitude_spectrum.at<double>(i, j) =
+          magnitude_spectrum.at<T>(i, j) =
               20 * log(1 + std::abs(local_data[i * cols + j]));
         }
       }
@@ -298,22 +337,22 @@ public:
       int base_rows = rows / size;
       for (int p = 1; p < size; p++) {
         int p_rows = (p == size - 1) ? rows - p * base_rows : base_rows;
-        std::vector<Complex> temp_buffer(p_rows * cols);
+        PooledVector<Complex<T>> temp_buffer(p_rows * cols);
 
         MPI_Status status;
-        MPI_Recv(temp_buffer.data(), p_rows * cols, MPI_DOUBLE_COMPLEX, p, 0,
+        MPI_Recv(temp_buffer.data(), p_rows * cols, complex_type, p, 0,
                  comm, &status);
 
         for (int i = 0; i < p_rows; i++) {
           for (int j = 0; j < cols; j++) {
-            magnitude_spectrum.at<double>(p * base_rows + i, j) =
+            magnitude_spectrum.at<T>(p * base_rows + i, j) =
                 20 * log(1 + std::abs(temp_buffer[i * cols + j]));
           }
         }
       }
     } else {
       // Send data to root
-      MPI_Send(local_data.data(), local_rows * cols, MPI_DOUBLE_COMPLEX, 0, 0,
+      MPI_Send(local_data.data(), local_rows * cols, complex_type, 0, 0,
                comm);
     }
 
@@ -324,8 +363,207 @@ public:
       magnitude_spectrum.convertTo(magnitude_spectrum, CV_8U);
     }
   }
+
+  // Multiply the local rows of the (unshifted) spectrum by the filter
+  // response. Must be called between computeFFT() and computeFFT(true).
+  void applyFilter(const FrequencyFilter &filter) {
+    TraceScope scope("filter");
+    int start_row = rank * (rows / size);
+    for (int i = 0; i < local_rows; i++) {
+      for (int j = 0; j < cols; j++) {
+        local_data[i * cols + j] *= (T)filter.response(start_row + i, j);
+      }
+    }
+  }
+
+  // Gather the inverse transform on root, scale it back to pixel values and
+  // crop the margin added by padChannel
+  void collectImage(cv::Mat &image, const FilterSpec &spec, int image_rows,
+                    int image_cols) {
+    TraceScope scope("collect", "comm");
+    if (rank != 0) {
+      MPI_Send(local_data.data(), local_rows * cols, complex_type, 0, 0,
+               comm);
+      return;
+    }
+
+    PooledVector<Complex<T>> full_data(rows * cols);
+    std::copy(local_data.begin(), local_data.end(), full_data.begin());
+    int base_rows = rows / size;
+    for (int p = 1; p < size; p++) {
+      int p_rows = (p == size - 1) ? rows - p * base_rows : base_rows;
+      MPI_Status status;
+      MPI_Recv(&full_data[p * base_rows * cols], p_rows * cols, complex_type,
+               p, 0, comm, &status);
+    }
+
+    int margin = filterMargin(spec);
+    T scale = T(1) / ((T)rows * cols);
+    T offset = (T)filterOffset(spec);
+    image = cv::Mat(image_rows, image_cols, CV_8U);
+    for (int i = 0; i < image_rows; i++) {
+      uchar *out_row = image.ptr(i);
+      const Complex<T> *in_row = &full_data[(i + margin) * cols + margin];
+      for (int j = 0; j < image_cols; j++) {
+        T value = in_row[j].real() * scale + offset;
+        out_row[j] = (uchar)std::min(std::max(value + T(0.5), T(0)), T(255));
+      }
+    }
+  }
 };
 
+// Run the pencil FFT on every channel at precision T. Only rank 0 holds the
+// channels and receives the magnitude spectrums.
+template <typename T, typename TW = T>
+std::vector<cv::Mat>
+computeMagnitudeSpectrums(const std::vector<cv::Mat> &channels, int rows,
+                          int cols, const std::string &precision_name) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  double start = MPI_Wtime();
+  std::vector<cv::Mat> magnitude_spectrums;
+
+  // Process each channel
+  for (int c = 0; c < 3; c++) {
+    if (rank == 0) {
+      std::cout << "\nProcessing channel " << c << std::endl;
+    }
+
+    PencilFFT<T, TW> fft(rows, cols);
+    fft.distributeData(rank == 0 ? channels[c] : cv::Mat());
+    fft.computeFFT();
+
+    cv::Mat magnitude_spectrum;
+    fft.collectResult(magnitude_spectrum);
+
+    if (rank == 0) {
+      magnitude_spectrums.push_back(magnitude_spectrum);
+    }
+  }
+
+  double end = MPI_Wtime();
+
+  // Bandwidth ceiling of every rank streaming at the same time
+  double stream_gbps = 0;
+  if (rooflineProbeEnabled()) {
+    double rank_gbps = streamTriadBandwidth();
+    MPI_Reduce(&rank_gbps, &stream_gbps, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+  }
+
+  if (rank == 0) {
+    std::cout << "\nFFT time: " << end - start << " seconds ("
+              << precision_name << " precision)" << std::endl;
+    printRoofline(fftOperationCost(FilterSpec(), rows, cols, 3,
+                                   sizeof(Complex<T>)),
+                  end - start, stream_gbps);
+  }
+  return magnitude_spectrums;
+}
+
+// Filter every channel in the frequency domain at precision T. Rank 0 pads
+// each channel, the pencil decomposition does forward FFT, pointwise
+// multiply and inverse FFT.
+template <typename T, typename TW = T>
+std::vector<cv::Mat> filterChannels(const std::vector<cv::Mat> &channels,
+                                    int rows, int cols, const FilterSpec &spec,
+                                    const std::string &precision_name) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  double start = MPI_Wtime();
+  std::vector<cv::Mat> filtered_channels;
+
+  for (int c = 0; c < 3; c++) {
+    cv::Mat padded;
+    int padded_dims[2] = {0, 0};
+    if (rank == 0) {
+      padded = padChannel(channels[c], filterMargin(spec));
+      padded_dims[0] = padded.rows;
+      padded_dims[1] = padded.cols;
+    }
+    MPI_Bcast(padded_dims, 2, MPI_INT, 0, MPI_COMM_WORLD);
+
+    PencilFFT<T, TW> fft(padded_dims[0], padded_dims[1]);
+    fft.distributeData(padded);
+    fft.computeFFT();
+    fft.applyFilter(FrequencyFilter(spec, padded_dims[0], padded_dims[1]));
+    fft.computeFFT(true);
+
+    cv::Mat filtered;
+    fft.collectImage(filtered, spec, rows, cols);
+    if (rank == 0) {
+      filtered_channels.push_back(filtered);
+    }
+  }
+
+  double end = MPI_Wtime();
+
+  // Bandwidth ceiling of every rank streaming at the same time
+  double stream_gbps = 0;
+  if (rooflineProbeEnabled()) {
+    double rank_gbps = streamTriadBandwidth();
+    MPI_Reduce(&rank_gbps, &stream_gbps, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+  }
+
+  if (rank == 0) {
+    std::cout << "\nFFT time: " << end - start << " seconds ("
+              << precision_name << " precision)" << std::endl;
+    printRoofline(fftOperationCost(spec, rows, cols, 3,
+                                   sizeof(Complex<T>)),
+                  end - start, stream_gbps);
+  }
+  return filtered_channels;
+}
+
+// Run the requested operation on every channel at precision T
+template <typename T, typename TW = T>
+std::vector<cv::Mat> runOperation(const std::vector<cv::Mat> &channels,
+                                  int rows, int cols, const FilterSpec &spec,
+                                  const std::string &precision_name) {
+  if (spec.operation == SPECTRUM) {
+    return computeMagnitudeSpectrums<T, TW>(channels, rows, cols,
+                                            precision_name);
+  }
+  return filterChannels<T, TW>(channels, rows, cols, spec, precision_name);
+}
+
+// Compare a reduced precision 8-bit magnitude image against the double
+// precision reference
+void reportPrecisionError(const std::string &precision_name,
+                          const cv::Mat &image, const cv::Mat &reference) {
+  int values_per_row = reference.cols * reference.channels();
+  size_t total = (size_t)reference.rows * values_per_row;
+  int max_error = 0;
+  size_t mismatched = 0;
+  double sum_error = 0, sum_squared_error = 0;
+
+  for (int r = 0; r < reference.rows; r++) {
+    const uchar *image_row = image.ptr(r);
+    const uchar *reference_row = reference.ptr(r);
+    for (int i = 0; i < values_per_row; i++) {
+      int error = std::abs((int)image_row[i] - (int)reference_row[i]);
+      max_error = std::max(max_error, error);
+      mismatched += error != 0;
+      sum_error += error;
+      sum_squared_error += (double)error * error;
+    }
+  }
+
+  double mse = sum_squared_error / total;
+  std::cout << precision_name << " vs double: max abs error " << max_error
+            << ", mean abs error " << sum_error / total << ", mismatched "
+            << 100.0 * mismatched / total << "%, PSNR ";
+  if (mse == 0) {
+    std::cout << "inf";
+  } else {
+    std::cout << 10 * log10(255.0 * 255.0 / mse);
+  }
+  std::cout << " dB" << std::endl;
+}
+
 int main(int argc, char **argv) {
   MPI_Init(&argc, &argv);
 
@@ -335,19 +573,62 @@ int main(int argc, char **argv) {
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-  if (argc != 2) {
+  if (argc < 2) {
+    if (rank == 0) {
+      std::cerr << "Usage: " << argv[0]
+                << " <image_path> [precision] [operation params...]"
+                << std::endl;
+      std::cerr << "precision: 'double' (default), 'float', 'mixed' or "
+                   "'compare'"
+                << std::endl;
+      printFilterUsage(std::cerr);
+    }
+    MPI_Abort(MPI_COMM_WORLD, 1);
+    return -1;
+  }
+
+  Precision precision = DOUBLE;
+  FilterSpec spec;
+  try {
+    if (argc >= 3) {
+      precision = parsePrecision(argv[2]);
+    }
+    spec = parseFilterSpec(argc, argv, 3);
+  } catch (const std::exception &e) {
     if (rank == 0) {
-      std::cerr << "Usage: " << argv[0] << " <image_path>" << std::endl;
+      std::cerr << "Error: " << e.what() << std::endl;
     }
     MPI_Abort(MPI_COMM_WORLD, 1);
     return -1;
   }
 
-  cv::Mat image, combined_magnitude;
-  std::vector<cv::Mat> channels, magnitude_spectrums;
+  // The result of an earlier run on the same image with the same operation,
+  // except for comparisons, which are run for their error report
+  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+  std::string output_stem = std::string(output_dir) + "/parallel_" +
+                            operationName(spec) + "_result";
+  ResultCache cache(argv[1], "fft_parallel " + std::to_string(precision) +
+                                 " " + filterKey(spec));
+  std::string restored;
+  if (precision != COMPARE &&
+      lookupResult(cache, MPI_COMM_WORLD, [&] {
+        restored = cache.restore(output_stem);
+        return !restored.empty();
+      })) {
+    if (rank == 0) {
+      std::cout << "Saving output to " << restored << std::endl;
+      cache.report();
+    }
+    MPI_Finalize();
+    return 0;
+  }
+
+  cv::Mat image, combined_result;
+  std::vector<cv::Mat> channels, results;
   int rows = 0, cols = 0;
 
   if (rank == 0) {
+    TraceScope decode("decode", "io");
     image = cv::imread(argv[1], cv::IMREAD_COLOR);
     if (image.empty()) {
       std::cerr << "Error: Could not read the image." << std::endl;
@@ -363,33 +644,40 @@ int main(int argc, char **argv) {
   MPI_Bcast(&rows, 1, MPI_INT, 0, MPI_COMM_WORLD);
   MPI_Bcast(&cols, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-  // Process each channel
-  for (int c = 0; c < 3; c++) {
-    if (rank == 0) {
-      std::cout << "\nProcessing channel " << c << std::endl;
-    }
-
-    PencilFFT fft(rows, cols);
-    fft.distributeData(channels[c]);
-    fft.computeFFT();
-
-    cv::Mat magnitude_spectrum;
-    fft.collectResult(magnitude_spectrum);
+  if (precision == SINGLE) {
+    results = runOperation<float>(channels, rows, cols, spec, "float");
+  } else if (precision == MIXED) {
+    results = runOperation<float, double>(channels, rows, cols, spec, "mixed");
+  } else {
+    results = runOperation<double>(channels, rows, cols, spec, "double");
+  }
 
+  if (precision == COMPARE) {
+    std::vector<cv::Mat> float_results =
+        runOperation<float>(channels, rows, cols, spec, "float");
+    std::vector<cv::Mat> mixed_results =
+        runOperation<float, double>(channels, rows, cols, spec, "mixed");
     if (rank == 0) {
-      magnitude_spectrums.push_back(magnitude_spectrum);
+      cv::Mat reference, float_result, mixed_result;
+      cv::merge(results, reference);
+      cv::merge(float_results, float_result);
+      cv::merge(mixed_results, mixed_result);
+      reportPrecisionError("float", float_result, reference);
+      reportPrecisionError("mixed", mixed_result, reference);
     }
   }
 
   if (rank == 0) {
-    cv::merge(magnitude_spectrums, combined_magnitude);
-    const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
-    std::string output_path =
-        std::string(output_dir) + "/parallel_fft_result.jpg";
+    cv::merge(results, combined_result);
+    std::string output_path = output_stem + ".jpg";
     std::cout << "Saving output to " << output_path << std::endl;
-    bool success = cv::imwrite(output_path, combined_magnitude);
+    TraceScope encode("encode", "io");
+    bool success = cv::imwrite(output_path, combined_result);
+    encode.end();
     if (!success) {
       std::cout << "Failed to save output image" << std::endl;
+    } else {
+      cache.store(output_path);
     }
   }
 
@@ -397,8 +685,11 @@ int main(int argc, char **argv) {
   if (rank == 0) {
     std::cout << "\nTotal execution time: " << total_end - total_start
               << " seconds" << std::endl;
+    cache.report();
   }
 
+  reportBufferPoolStats(MPI_COMM_WORLD);
+  writeTraceMPI(MPI_COMM_WORLD);
   MPI_Finalize();
   return 0;
 }
@@ -1,13 +1,37 @@
 #include <cmath>
 #include <complex>
+#include <limits>
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <omp.h>
 
+#include "complex_matrix.hpp"
+#include "fft_cost.hpp"
+#include "frequency_filter.hpp"
+#include "../common/result_cache.hpp"
+#include "../common/trace.hpp"
+
 const double PI = 3.14159265358979323846;
 
 using namespace std;
-using Complex = complex<double>;
+template <typename T> using Complex = complex<T>;
+
+enum Precision { DOUBLE = 0, SINGLE = 1, MIXED = 2, COMPARE = 3 };
+
+Precision parsePrecision(const string &type) {
+  if (type == "d" || type == "double") {
+    return DOUBLE;
+  } else if (type == "f" || type == "float") {
+    return SINGLE;
+  } else if (type == "m" || type == "mixed") {
+    return MIXED;
+  } else if (type == "c" || type == "compare") {
+    return COMPARE;
+  } else {
+    throw invalid_argument("Invalid precision. Use 'double', 'float', "
+                           "'mixed' or 'compare'");
+  }
+}
 
 bool isPowerOf2(int n) { return n && !(n & (n - 1)); }
 
@@ -29,152 +53,422 @@ int bitReverse(int n, int bits) {
   return reversed;
 }
 
-// Forward-only FFT implementation
-vector<Complex> fft(vector<Complex> &x) {
-  int n = x.size();
+// In-place radix-2 FFT on n contiguous samples. The inverse transform is
+// left unscaled, the caller divides by the number of samples.
+// T is the storage/arithmetic precision, TW the precision the twiddle factor
+// recurrence is carried in (fft<float, double> is the mixed mode)
+template <typename T, typename TW = T>
+void fft(Complex<T> *x, int n, bool inverse = false) {
   if (!isPowerOf2(n)) {
     throw runtime_error("Size must be a power of 2");
   }
 
   int bits = log2(n);
-  vector<Complex> result(n);
 
-  // Bit reversal
+  // Bit reversal permutation, each pair is swapped once
   for (int i = 0; i < n; i++) {
-    result[bitReverse(i, bits)] = x[i];
+    int j = bitReverse(i, bits);
+    if (i < j) {
+      swap(x[i], x[j]);
+    }
   }
 
-  // Butterfly operations
+  // Butterfly operations. A single row is one task, parallelism comes from
+  // running many rows at once.
   for (int stage = 1; stage <= bits; stage++) {
     int m = 1 << stage;
     int half_m = m / 2;
-    Complex wm = polar(1.0, -2 * PI / m);
+    Complex<TW> wm = polar(TW(1), TW((inverse ? 2 : -2) * PI / m));
 
-    #pragma omp parallel for schedule(static)
     for (int k = 0; k < n; k += m) {
-      Complex w = 1;
+      Complex<TW> w = 1;
       for (int j = 0; j < half_m; j++) {
-        Complex t = w * result[k + j + half_m];
-        Complex u = result[k + j];
-        result[k + j] = u + t;
-        result[k + j + half_m] = u - t;
+        Complex<T> t = Complex<T>(w) * x[k + j + half_m];
+        Complex<T> u = x[k + j];
+        x[k + j] = u + t;
+        x[k + j + half_m] = u - t;
         w *= wm;
       }
     }
   }
+}
 
-  return result;
+// Run body(c, i) for every channel c < num_channels and item
+// i < items_per_channel as one flat pool of OpenMP tasks, so the 3 channels
+// do not cap the parallelism and idle threads pick up the remaining items.
+// Each task is recorded as a span called name when tracing.
+// Must be called by a single thread inside a parallel region; returns once
+// every task has completed.
+template <typename Body>
+void channelTaskloop(const char *name, int num_channels,
+                     int items_per_channel, Body body) {
+  int total = num_channels * items_per_channel;
+  int grain = max(1, total / (omp_get_num_threads() * 8));
+  int num_chunks = (total + grain - 1) / grain;
+
+  #pragma omp taskloop grainsize(1)
+  for (int chunk = 0; chunk < num_chunks; chunk++) {
+    TraceScope scope(name);
+    int end = min(total, (chunk + 1) * grain);
+    for (int idx = chunk * grain; idx < end; idx++) {
+      body(idx / items_per_channel, idx % items_per_channel);
+    }
+  }
+}
+
+// FFT every row of every matrix in place
+template <typename T, typename TW = T>
+void fftRows(vector<ComplexMatrix<T>> &complex_images, bool inverse = false) {
+  int cols = complex_images[0].numCols();
+  channelTaskloop(inverse ? "inverse row fft" : "row fft",
+                  complex_images.size(), complex_images[0].numRows(),
+                  [&](int c, int i) {
+                    fft<T, TW>(complex_images[c].row(i), cols, inverse);
+                  });
 }
 
-// Forward-only 2D FFT implementation
-vector<vector<Complex>> fft2D(const cv::Mat &channel) {
-  int rows = channel.rows;
-  int cols = channel.cols;
+// Transpose every matrix, one task per tile row
+template <typename T>
+void transposeAll(vector<ComplexMatrix<T>> &complex_images) {
+  for (auto &complex_image : complex_images) {
+    complex_image.beginTranspose();
+  }
+  channelTaskloop(
+      "transpose", complex_images.size(), complex_images[0].numTileRows(),
+      [&](int c, int t) { complex_images[c].transposeTileRow(t); });
+  for (auto &complex_image : complex_images) {
+    complex_image.finishTranspose();
+  }
+}
 
+// Convert every channel to complex numbers, zero padded to power of 2
+// dimensions. Each row is first touched by the task that loads it.
+template <typename T>
+vector<ComplexMatrix<T>> loadChannels(const vector<cv::Mat> &channels) {
+  int rows = channels[0].rows;
+  int cols = channels[0].cols;
   int padded_rows = nextPowerOf2(rows);
   int padded_cols = nextPowerOf2(cols);
 
-  vector<vector<Complex>> complex_image(padded_rows,
-                                      vector<Complex>(padded_cols));
+  vector<ComplexMatrix<T>> complex_images;
+  for (size_t c = 0; c < channels.size(); c++) {
+    complex_images.emplace_back(padded_rows, padded_cols);
+  }
 
-  // Convert channel to complex numbers and pad
-  #pragma omp parallel for collapse(2)
-  for (int i = 0; i < rows; i++) {
-    for (int j = 0; j < cols; j++) {
-      complex_image[i][j] = Complex(channel.at<uchar>(i, j), 0);
+  channelTaskloop("load", channels.size(), padded_rows, [&](int c, int i) {
+    Complex<T> *out_row = complex_images[c].row(i);
+    int j = 0;
+    if (i < rows) {
+      const uchar *in_row = channels[c].ptr(i);
+      for (; j < cols; j++) {
+        out_row[j] = Complex<T>(in_row[j], 0);
+      }
     }
-  }
+    fill(out_row + j, out_row + padded_cols, Complex<T>(0, 0));
+  });
+  return complex_images;
+}
+
+// Forward 2D FFT of every channel. Columns are transformed as rows of the
+// transposed matrices, then transposed back. Must be called by a single
+// thread inside a parallel region.
+template <typename T, typename TW = T>
+vector<ComplexMatrix<T>> fft2D(const vector<cv::Mat> &channels) {
+  vector<ComplexMatrix<T>> complex_images = loadChannels<T>(channels);
 
   // Apply FFT to rows
-  #pragma omp parallel for schedule(dynamic)
-  for (int i = 0; i < padded_rows; i++) {
-    vector<Complex> row = complex_image[i];
-    row = fft(row);
-    complex_image[i] = row;
-  }
+  fftRows<T, TW>(complex_images);
 
   // Apply FFT to columns
-  #pragma omp parallel for schedule(dynamic)
-  for (int j = 0; j < padded_cols; j++) {
-    vector<Complex> col(padded_rows);
-    for (int i = 0; i < padded_rows; i++) {
-      col[i] = complex_image[i][j];
+  transposeAll(complex_images);
+  fftRows<T, TW>(complex_images);
+  transposeAll(complex_images);
+
+  return complex_images;
+}
+
+// Multiply the (unshifted) spectrum of every channel by the filter
+// response. A transposed spectrum holds frequency (i, j) at row j, column i.
+template <typename T>
+void applyFilter(vector<ComplexMatrix<T>> &complex_images,
+                 const FilterSpec &spec, bool transposed) {
+  int rows = complex_images[0].numRows();
+  int cols = complex_images[0].numCols();
+  FrequencyFilter filter(spec, transposed ? cols : rows,
+                         transposed ? rows : cols);
+
+  channelTaskloop("filter", complex_images.size(), rows, [&](int c, int i) {
+    Complex<T> *row = complex_images[c].row(i);
+    for (int j = 0; j < cols; j++) {
+      row[j] *= (T)(transposed ? filter.response(j, i) : filter.response(i, j));
     }
-    col = fft(col);
-    for (int i = 0; i < padded_rows; i++) {
-      complex_image[i][j] = col[i];
+  });
+}
+
+// Scale the inverse transforms back to pixel values and crop the margin
+template <typename T>
+vector<cv::Mat> getFilteredImages(const vector<ComplexMatrix<T>> &complex_images,
+                                  const FilterSpec &spec, int rows, int cols) {
+  int margin = filterMargin(spec);
+  T scale =
+      T(1) / ((T)complex_images[0].numRows() * complex_images[0].numCols());
+  T offset = (T)filterOffset(spec);
+
+  vector<cv::Mat> filtered(complex_images.size());
+  for (auto &channel : filtered) {
+    channel.create(rows, cols, CV_8U);
+  }
+
+  channelTaskloop("store", complex_images.size(), rows, [&](int c, int i) {
+    uchar *out_row = filtered[c].ptr(i);
+    const Complex<T> *in_row = complex_images[c].row(i + margin) + margin;
+    for (int j = 0; j < cols; j++) {
+      T value = in_row[j].real() * scale + offset;
+      out_row[j] = (uchar)min(max(value + T(0.5), T(0)), T(255));
     }
+  });
+  return filtered;
+}
+
+// Turn every spectrum into an 8-bit log-magnitude image with the zero
+// frequency shifted to the center, in two passes over the data:
+//   1. log(1 + |X|) written back into the real part, with a per-row min/max
+//   2. min/max normalization to 0-255, rounding, and the quadrant shift,
+//      writing each row straight to its shifted position in the output
+// The consumed spectrums are overwritten. Must be called by a single thread
+// inside a parallel region.
+template <typename T>
+vector<cv::Mat> getMagnitudeImages(vector<ComplexMatrix<T>> &complex_images) {
+  int num_channels = complex_images.size();
+  int rows = complex_images[0].numRows();
+  int cols = complex_images[0].numCols();
+
+  // Pass 1: log magnitude, the min/max reduction is done per row so the
+  // tasks never synchronize
+  vector<T> row_min(num_channels * rows), row_max(num_channels * rows);
+  channelTaskloop("log magnitude", num_channels, rows, [&](int c, int i) {
+    Complex<T> *row = complex_images[c].row(i);
+    T lo = numeric_limits<T>::max();
+    T hi = numeric_limits<T>::lowest();
+    #pragma omp simd reduction(min : lo) reduction(max : hi)
+    for (int j = 0; j < cols; j++) {
+      T re = row[j].real(), im = row[j].imag();
+      T value = log(1 + sqrt(re * re + im * im));
+      row[j] = Complex<T>(value, 0);
+      lo = min(lo, value);
+      hi = max(hi, value);
+    }
+    row_min[c * rows + i] = lo;
+    row_max[c * rows + i] = hi;
+  });
+
+  // Same scale/shift as cv::normalize(NORM_MINMAX) to 0-255
+  vector<double> scale(num_channels), shift(num_channels);
+  for (int c = 0; c < num_channels; c++) {
+    T lo = *min_element(row_min.begin() + c * rows,
+                        row_min.begin() + (c + 1) * rows);
+    T hi = *max_element(row_max.begin() + c * rows,
+                        row_max.begin() + (c + 1) * rows);
+    scale[c] = hi > lo ? 255.0 / ((double)hi - lo) : 0;
+    shift[c] = -lo * scale[c];
+  }
+
+  vector<cv::Mat> magnitude_spectrums(num_channels);
+  for (auto &magnitude : magnitude_spectrums) {
+    magnitude.create(rows, cols, CV_8U);
   }
 
-  return complex_image;
+  // Pass 2: quantize into the shifted quadrant position. Row i lands on row
+  // (i + rows / 2) % rows, its two column halves swap sides.
+  int cy = rows / 2;
+  int cx = cols / 2;
+  channelTaskloop("normalize shift", num_channels, rows, [&](int c, int i) {
+    const Complex<T> *in_row = complex_images[c].row(i);
+    uchar *out_row = magnitude_spectrums[c].ptr((i + cy) % rows);
+    double channel_scale = scale[c], channel_shift = shift[c];
+
+    #pragma omp simd
+    for (int j = 0; j < cols - cx; j++) {
+      double value = in_row[j].real() * channel_scale + channel_shift;
+      out_row[j + cx] = (uchar)min(max(nearbyint(value), 0.0), 255.0);
+    }
+    #pragma omp simd
+    for (int j = cols - cx; j < cols; j++) {
+      double value = in_row[j].real() * channel_scale + channel_shift;
+      out_row[j - (cols - cx)] = (uchar)min(max(nearbyint(value), 0.0), 255.0);
+    }
+  });
+
+  return magnitude_spectrums;
 }
 
-cv::Mat getMagnitudeImage(const vector<vector<Complex>> &complex_image) {
-  int rows = complex_image.size();
-  int cols = complex_image[0].size();
-  cv::Mat magnitude(rows, cols, CV_64F);
+// Run the forward FFT on every channel at precision T and return the
+// centred magnitude spectrum of each channel
+template <typename T, typename TW = T>
+vector<cv::Mat> computeMagnitudeSpectrums(const vector<cv::Mat> &channels,
+                                          const string &precision_name) {
+  double start = omp_get_wtime();
 
-  double max_magnitude = 0;
-  
-  // Calculate magnitude and find maximum
+  // Perform forward FFT of all channels and get the centred magnitude
+  // spectrums as one pool of tasks
+  vector<cv::Mat> magnitude_spectrums;
   #pragma omp parallel
+  #pragma omp single
   {
-    double local_max = 0;
-    #pragma omp for collapse(2)
-    for (int i = 0; i < rows; i++) {
-      for (int j = 0; j < cols; j++) {
-        magnitude.at<double>(i, j) = abs(complex_image[i][j]);
-        local_max = max(local_max, magnitude.at<double>(i, j));
-      }
-    }
-    #pragma omp critical
-    {
-      max_magnitude = max(max_magnitude, local_max);
-    }
+    vector<ComplexMatrix<T>> complex_images = fft2D<T, TW>(channels);
+    magnitude_spectrums = getMagnitudeImages(complex_images);
   }
 
-  // Normalize and convert to logarithmic scale
-  #pragma omp parallel for collapse(2)
-  for (int i = 0; i < rows; i++) {
-    for (int j = 0; j < cols; j++) {
-      magnitude.at<double>(i, j) = log(1 + magnitude.at<double>(i, j));
-    }
+  double stop = omp_get_wtime();
+  cout << "Parallel time with " << omp_get_max_threads() << " threads: "
+       << (stop - start) * 1000 << " milliseconds"
+       << " (" << precision_name << " precision)" << endl;
+  printRoofline(fftOperationCost(FilterSpec(), channels[0].rows,
+                                 channels[0].cols, channels.size(),
+                                 sizeof(Complex<T>)),
+                stop - start,
+                rooflineProbeEnabled() ? streamTriadBandwidth() : 0);
+
+  return magnitude_spectrums;
+}
+
+// Filter every channel in the frequency domain at precision T: forward FFT,
+// pointwise multiply with the filter response, inverse FFT
+template <typename T, typename TW = T>
+vector<cv::Mat> filterChannels(const vector<cv::Mat> &channels,
+                               const FilterSpec &spec,
+                               const string &precision_name) {
+  double start = omp_get_wtime();
+
+  vector<cv::Mat> padded(channels.size());
+  for (size_t i = 0; i < channels.size(); i++) {
+    padded[i] = padChannel(channels[i], filterMargin(spec));
   }
 
-  // Normalize to 0-255 range
-  cv::normalize(magnitude, magnitude, 0, 255, cv::NORM_MINMAX);
+  vector<cv::Mat> filtered_channels;
+  #pragma omp parallel
+  #pragma omp single
+  {
+    // The filter is applied to the transposed spectrum, so the forward
+    // transform skips its final transpose and the inverse its first one
+    vector<ComplexMatrix<T>> complex_images = loadChannels<T>(padded);
+    fftRows<T, TW>(complex_images);
+    transposeAll(complex_images);
+    fftRows<T, TW>(complex_images);
+    applyFilter(complex_images, spec, true);
+    fftRows<T, TW>(complex_images, true);
+    transposeAll(complex_images);
+    fftRows<T, TW>(complex_images, true);
+
+    filtered_channels = getFilteredImages(complex_images, spec,
+                                          channels[0].rows, channels[0].cols);
+  }
 
-  // Convert to 8-bit image
-  cv::Mat magnitude_8u;
-  magnitude.convertTo(magnitude_8u, CV_8U);
+  double stop = omp_get_wtime();
+  cout << "Parallel time with " << omp_get_max_threads() << " threads: "
+       << (stop - start) * 1000 << " milliseconds"
+       << " (" << precision_name << " precision)" << endl;
+  printRoofline(fftOperationCost(spec, channels[0].rows, channels[0].cols,
+                                 channels.size(), sizeof(Complex<T>)),
+                stop - start,
+                rooflineProbeEnabled() ? streamTriadBandwidth() : 0);
 
-  return magnitude_8u;
+  return filtered_channels;
 }
 
-void shiftQuadrants(cv::Mat &magnitude_spectrum) {
-  int cx = magnitude_spectrum.cols / 2;
-  int cy = magnitude_spectrum.rows / 2;
-
-  cv::Mat q0(magnitude_spectrum, cv::Rect(0, 0, cx, cy));
-  cv::Mat q1(magnitude_spectrum, cv::Rect(cx, 0, cx, cy));
-  cv::Mat q2(magnitude_spectrum, cv::Rect(0, cy, cx, cy));
-  cv::Mat q3(magnitude_spectrum, cv::Rect(cx, cy, cx, cy));
+// Compare a reduced precision 8-bit magnitude image against the double
+// precision reference
+void reportPrecisionError(const string &precision_name, const cv::Mat &image,
+                          const cv::Mat &reference) {
+  int values_per_row = reference.cols * reference.channels();
+  size_t total = (size_t)reference.rows * values_per_row;
+  int max_error = 0;
+  size_t mismatched = 0;
+  double sum_error = 0, sum_squared_error = 0;
+
+  #pragma omp parallel for reduction(max : max_error) \
+      reduction(+ : mismatched, sum_error, sum_squared_error)
+  for (int r = 0; r < reference.rows; r++) {
+    const uchar *image_row = image.ptr(r);
+    const uchar *reference_row = reference.ptr(r);
+    for (int i = 0; i < values_per_row; i++) {
+      int error = abs((int)image_row[i] - (int)reference_row[i]);
+      max_error = max(max_error, error);
+      mismatched += error != 0;
+      sum_error += error;
+      sum_squared_error += (double)error * error;
+    }
+  }
 
-  cv::Mat tmp;
-  q0.copyTo(tmp);
-  q3.copyTo(q0);
-  tmp.copyTo(q3);
+  double mse = sum_squared_error / total;
+  cout << precision_name << " vs double: max abs error " << max_error
+       << ", mean abs error " << sum_error / total << ", mismatched "
+       << 100.0 * mismatched / total << "%, PSNR ";
+  if (mse == 0) {
+    cout << "inf";
+  } else {
+    cout << 10 * log10(255.0 * 255.0 / mse);
+  }
+  cout << " dB" << endl;
+}
 
-  q1.copyTo(tmp);
-  q2.copyTo(q1);
-  tmp.copyTo(q2);
+// Run the requested operation on every channel at precision T
+template <typename T, typename TW = T>
+vector<cv::Mat> runOperation(const vector<cv::Mat> &channels,
+                             const FilterSpec &spec,
+                             const string &precision_name) {
+  if (spec.operation == SPECTRUM) {
+    return computeMagnitudeSpectrums<T, TW>(channels, precision_name);
+  }
+  return filterChannels<T, TW>(channels, spec, precision_name);
 }
 
 int main(int argc, char **argv) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0]
+         << " <image_path> [precision] [operation params...]" << endl;
+    cerr << "precision: 'double' (default), 'float', 'mixed' (float data, "
+            "double twiddles)"
+         << endl;
+    cerr << "           'compare' runs all three and reports the error "
+            "against double"
+         << endl;
+    printFilterUsage(cerr);
+    return -1;
+  }
+
+  Precision precision = DOUBLE;
+  FilterSpec spec;
+  try {
+    if (argc >= 3) {
+      precision = parsePrecision(argv[2]);
+    }
+    spec = parseFilterSpec(argc, argv, 3);
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return -1;
+  }
+
+  // The result of an earlier run on the same image with the same operation,
+  // except for comparisons, which are run for their error report
+  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+  string output_stem =
+      string(output_dir) + "/parallel_" + operationName(spec) + "_result";
+  ResultCache cache(argv[1], "fft_parallel_openmp " + to_string(precision) +
+                                 " " + filterKey(spec));
+  string restored;
+  if (precision != COMPARE && cache.lookup() &&
+      !(restored = cache.restore(output_stem)).empty()) {
+    cout << "Saving output to " << restored << endl;
+    cache.report();
+    return 0;
+  }
+
   // Set number of OpenMP threads
   omp_set_num_threads(omp_get_max_threads());
   
   // Read RGB image
+  TraceScope decode("decode", "io");
   cv::Mat image = cv::imread(argv[1], cv::IMREAD_COLOR);
   if (image.empty()) {
     cerr << "Error: Could not read the image." << endl;
@@ -184,42 +478,44 @@ int main(int argc, char **argv) {
   // Split the image into channels
   vector<cv::Mat> channels;
   cv::split(image, channels);
-
-  double start = omp_get_wtime();
-
-  // Process each channel
-  vector<cv::Mat> magnitude_spectrums(channels.size());
-  #pragma omp parallel for schedule(dynamic)
-  for (size_t i = 0; i < channels.size(); i++) {
-    // Perform forward FFT
-    auto complex_image = fft2D(channels[i]);
-
-    // Get magnitude spectrum
-    cv::Mat magnitude_spectrum = getMagnitudeImage(complex_image);
-
-    // Shift zero frequency to center
-    shiftQuadrants(magnitude_spectrum);
-
-    magnitude_spectrums[i] = magnitude_spectrum;
+  decode.end();
+
+  vector<cv::Mat> results;
+  if (precision == SINGLE) {
+    results = runOperation<float>(channels, spec, "float");
+  } else if (precision == MIXED) {
+    results = runOperation<float, double>(channels, spec, "mixed");
+  } else {
+    results = runOperation<double>(channels, spec, "double");
   }
 
-  double stop = omp_get_wtime();
-  cout << "Parallel time with " << omp_get_max_threads() << " threads: "
-       << (stop - start) * 1000 << " milliseconds"
-       << endl;
-
-  // Create combined RGB magnitude spectrum
-  cv::Mat combined_magnitude;
-  cv::merge(magnitude_spectrums, combined_magnitude);
+  // Create combined RGB result
+  cv::Mat combined_result;
+  cv::merge(results, combined_result);
+
+  if (precision == COMPARE) {
+    cv::Mat float_result, mixed_result;
+    cv::merge(runOperation<float>(channels, spec, "float"), float_result);
+    cv::merge(runOperation<float, double>(channels, spec, "mixed"),
+              mixed_result);
+    reportPrecisionError("float", float_result, combined_result);
+    reportPrecisionError("mixed", mixed_result, combined_result);
+  }
 
-  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
   // Save results
-  string output_path = string(output_dir) + "/parallel_fft_result.jpg";
+  string output_path = output_stem + ".jpg";
   cout << "Saving output to " << output_path << endl;
-  bool success = cv::imwrite(output_path, combined_magnitude);
+  TraceScope encode("encode", "io");
+  bool success = cv::imwrite(output_path, combined_result);
+  encode.end();
   if (!success) {
     std::cout << "Failed to save output image" << std::endl;
+  } else {
+    cache.store(output_path);
   }
+  cache.report();
+  reportBufferPoolStats();
+  writeTrace("parallel_openmp fft");
 
   return 0;
 }
@@ -4,11 +4,32 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "complex_matrix.hpp"
+#include "fft_cost.hpp"
+#include "../common/result_cache.hpp"
+
 const double PI = 3.14159265358979323846;
 
-// Complex number type definition
+// Complex number type definition, templated on the FFT precision
 using namespace std;
-using Complex = complex<double>;
+template <typename T> using Complex = complex<T>;
+
+enum Precision { DOUBLE = 0, SINGLE = 1, MIXED = 2, COMPARE = 3 };
+
+Precision parsePrecision(const string &type) {
+  if (type == "d" || type == "double") {
+    return DOUBLE;
+  } else if (type == "f" || type == "float") {
+    return SINGLE;
+  } else if (type == "m" || type == "mixed") {
+    return MIXED;
+  } else if (type == "c" || type == "compare") {
+    return COMPARE;
+  } else {
+    throw invalid_argument("Invalid precision. Use 'double', 'float', "
+                           "'mixed' or 'compare'");
+  }
+}
 
 // Function to check if number is power of 2
 bool isPowerOf2(int n) { return n && !(n & (n - 1)); }
@@ -33,45 +54,50 @@ int bitReverse(int n, int bits) {
   return reversed;
 }
 
-// 1D FFT implementation
-vector<Complex> fft(vector<Complex> &x) {
-  int n = x.size();
+// In-place radix-2 FFT on n contiguous samples
+// T is the storage/arithmetic precision, TW the precision the twiddle factor
+// recurrence is carried in. fft<float, double> is the mixed precision mode:
+// float data with twiddles that do not drift over long stages.
+template <typename T, typename TW = T> void fft(Complex<T> *x, int n) {
   if (!isPowerOf2(n)) {
     throw runtime_error("Size must be a power of 2");
   }
 
   int bits = log2(n);
-  vector<Complex> result(n);
 
-  // Bit reversal
+  // Bit reversal permutation, each pair is swapped once
   for (int i = 0; i < n; i++) {
-    result[bitReverse(i, bits)] = x[i];
+    int j = bitReverse(i, bits);
+    if (i < j) {
+      swap(x[i], x[j]);
+    }
   }
 
   // Butterfly operations
   for (int stage = 1; stage <= bits; stage++) {
     int m = 1 << stage;
     int half_m = m / 2;
-    Complex wm = polar(1.0,  -2 * PI / m);
+    Complex<TW> wm = polar(TW(1), TW(-2 * PI / m));
 
     for (int k = 0; k < n; k += m) {
-      Complex w = 1;
+      Complex<TW> w = 1;
       for (int j = 0; j < half_m; j++) {
-        Complex t = w * result[k + j + half_m];
-        Complex u = result[k + j];
-        result[k + j] = u + t;
-        result[k + j + half_m] = u - t;
+        Complex<T> t = Complex<T>(w) * x[k + j + half_m];
+        Complex<T> u = x[k + j];
+        x[k + j] = u + t;
+        x[k + j + half_m] = u - t;
         w *= wm;
       }
     }
   }
-
-
-  return result;
 }
 
-// 2D FFT implementation for a single channel
-vector<vector<Complex>> fft2D(const cv::Mat &channel) {
+// 2D FFT implementation for a single channel. The matrix is one pooled
+// allocation, reused by the next channel of the same size. Rows are
+// transformed in place, and the columns as rows of the transposed matrix,
+// which is then transposed back.
+template <typename T, typename TW = T>
+ComplexMatrix<T> fft2D(const cv::Mat &channel) {
   int rows = channel.rows;
   int cols = channel.cols;
 
@@ -80,58 +106,48 @@ vector<vector<Complex>> fft2D(const cv::Mat &channel) {
   int padded_cols = nextPowerOf2(cols);
 
   // Initialize 2D complex matrix
-  vector<vector<Complex>> complex_image(padded_rows,
-                                        vector<Complex>(padded_cols));
+  ComplexMatrix<T> complex_image(padded_rows, padded_cols);
 
   // Convert channel to complex numbers and pad
-  for (int i = 0; i < rows; i++) {
-    for (int j = 0; j < cols; j++) {
-      complex_image[i][j] = Complex(channel.at<uchar>(i, j), 0);
+  for (int i = 0; i < padded_rows; i++) {
+    Complex<T> *row = complex_image.row(i);
+    fill(row, row + padded_cols, Complex<T>(0, 0));
+    if (i < rows) {
+      const uchar *pixels = channel.ptr(i);
+      for (int j = 0; j < cols; j++) {
+        row[j] = Complex<T>(pixels[j], 0);
+      }
     }
   }
 
   // Apply FFT to rows
   for (int i = 0; i < padded_rows; i++) {
-    vector<Complex> row = complex_image[i];
-    row = fft(row);
-    complex_image[i] = row;
+    fft<T, TW>(complex_image.row(i), padded_cols);
   }
 
-  // Apply FFT to columns
+  // Apply FFT to columns, the rows of the transposed matrix
+  complex_image.transpose();
   for (int j = 0; j < padded_cols; j++) {
-    vector<Complex> col(padded_rows);
-    for (int i = 0; i < padded_rows; i++) {
-      col[i] = complex_image[i][j];
-    }
-    col = fft(col);
-    for (int i = 0; i < padded_rows; i++) {
-      complex_image[i][j] = col[i];
-    }
+    fft<T, TW>(complex_image.row(j), padded_rows);
   }
+  complex_image.transpose();
 
   return complex_image;
 }
 
 // Convert complex matrix to magnitude image for a single channel
-cv::Mat getMagnitudeImage(const vector<vector<Complex>> &complex_image) {
-  int rows = complex_image.size();
-  int cols = complex_image[0].size();
-  cv::Mat magnitude(rows, cols, CV_64F);
-
-  double max_magnitude = 0;
+template <typename T>
+cv::Mat getMagnitudeImage(const ComplexMatrix<T> &complex_image) {
+  int rows = complex_image.numRows();
+  int cols = complex_image.numCols();
+  cv::Mat magnitude(rows, cols, cv::DataType<T>::type);
 
-  // Calculate magnitude and find maximum
+  // Calculate the magnitude and convert to logarithmic scale
   for (int i = 0; i < rows; i++) {
+    const Complex<T> *row = complex_image.row(i);
+    T *out = magnitude.ptr<T>(i);
     for (int j = 0; j < cols; j++) {
-      magnitude.at<double>(i, j) = abs(complex_image[i][j]);
-      max_magnitude = max(max_magnitude, magnitude.at<double>(i, j));
-    }
-  }
-
-  // Normalize and convert to logarithmic scale
-  for (int i = 0; i < rows; i++) {
-    for (int j = 0; j < cols; j++) {
-      magnitude.at<double>(i, j) = log(1 + magnitude.at<double>(i, j));
+      out[j] = log(1 + abs(row[j]));
     }
   }
 
@@ -165,25 +181,18 @@ void shiftQuadrants(cv::Mat &magnitude_spectrum) {
   tmp.copyTo(q2);
 }
 
-int main(int argc, char **argv) {
-  // Read RGB image
-  cv::Mat image = cv::imread(argv[1], cv::IMREAD_COLOR);
-  if (image.empty()) {
-    cerr << "Error: Could not read the image." << endl;
-    return -1;
-  }
-
-  // Split the image into channels
-  vector<cv::Mat> channels;
-  cv::split(image, channels);
-
+// Run the forward FFT on every channel at precision T and return the
+// centred magnitude spectrum of each channel
+template <typename T, typename TW = T>
+vector<cv::Mat> computeMagnitudeSpectrums(const vector<cv::Mat> &channels,
+                                          const string &precision_name) {
   auto start = std::chrono::high_resolution_clock::now();
 
   // Process each channel
   vector<cv::Mat> magnitude_spectrums;
   for (const auto &channel : channels) {
     // Perform forward FFT
-    auto complex_image = fft2D(channel);
+    auto complex_image = fft2D<T, TW>(channel);
 
     // Get magnitude spectrum
     cv::Mat magnitude_spectrum = getMagnitudeImage(complex_image);
@@ -196,20 +205,132 @@ int main(int argc, char **argv) {
   auto stop = std::chrono::high_resolution_clock::now();
   cout << "Sequential time: "
        << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() << " microseconds"
-       << endl;
+       << " (" << precision_name << " precision)" << endl;
+  printRoofline(fftOperationCost(FilterSpec(), channels[0].rows,
+                                 channels[0].cols, channels.size(),
+                                 sizeof(Complex<T>)),
+                std::chrono::duration<double>(stop - start).count(),
+                rooflineProbeEnabled() ? streamTriadBandwidth(false) : 0);
+
+  return magnitude_spectrums;
+}
+
+// Compare a reduced precision 8-bit magnitude image against the double
+// precision reference
+void reportPrecisionError(const string &precision_name, const cv::Mat &image,
+                          const cv::Mat &reference) {
+  int values_per_row = reference.cols * reference.channels();
+  size_t total = (size_t)reference.rows * values_per_row;
+  int max_error = 0;
+  size_t mismatched = 0;
+  double sum_error = 0, sum_squared_error = 0;
+
+  for (int r = 0; r < reference.rows; r++) {
+    const uchar *image_row = image.ptr(r);
+    const uchar *reference_row = reference.ptr(r);
+    for (int i = 0; i < values_per_row; i++) {
+      int error = abs((int)image_row[i] - (int)reference_row[i]);
+      max_error = max(max_error, error);
+      mismatched += error != 0;
+      sum_error += error;
+      sum_squared_error += (double)error * error;
+    }
+  }
+
+  double mse = sum_squared_error / total;
+  cout << precision_name << " vs double: max abs error " << max_error
+       << ", mean abs error " << sum_error / total << ", mismatched "
+       << 100.0 * mismatched / total << "%, PSNR ";
+  if (mse == 0) {
+    cout << "inf";
+  } else {
+    cout << 10 * log10(255.0 * 255.0 / mse);
+  }
+  cout << " dB" << endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 3) {
+    cerr << "Usage: " << argv[0] << " <image_path> [precision]" << endl;
+    cerr << "precision: 'double' (default), 'float', 'mixed' (float data, "
+            "double twiddles)"
+         << endl;
+    cerr << "           'compare' runs all three and reports the error "
+            "against double"
+         << endl;
+    return -1;
+  }
+
+  Precision precision = DOUBLE;
+  if (argc == 3) {
+    try {
+      precision = parsePrecision(argv[2]);
+    } catch (const invalid_argument &e) {
+      cerr << "Error: " << e.what() << endl;
+      return -1;
+    }
+  }
+
+  // The result of an earlier run on the same image, except for comparisons,
+  // which are run for their error report
+  const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
+  string output_stem = string(output_dir) + "/sequential_fft_result";
+  ResultCache cache(argv[1], "fft_sequential " + to_string(precision));
+  string restored;
+  if (precision != COMPARE && cache.lookup() &&
+      !(restored = cache.restore(output_stem)).empty()) {
+    cout << "Saving output to " << restored << endl;
+    cache.report();
+    return 0;
+  }
+
+  // Read RGB image
+  cv::Mat image = cv::imread(argv[1], cv::IMREAD_COLOR);
+  if (image.empty()) {
+    cerr << "Error: Could not read the image." << endl;
+    return -1;
+  }
+
+  // Split the image into channels
+  vector<cv::Mat> channels;
+  cv::split(image, channels);
+
+  vector<cv::Mat> magnitude_spectrums;
+  if (precision == SINGLE) {
+    magnitude_spectrums = computeMagnitudeSpectrums<float>(channels, "float");
+  } else if (precision == MIXED) {
+    magnitude_spectrums =
+        computeMagnitudeSpectrums<float, double>(channels, "mixed");
+  } else {
+    magnitude_spectrums = computeMagnitudeSpectrums<double>(channels, "double");
+  }
 
   // Create combined RGB magnitude spectrum
   cv::Mat combined_magnitude;
   cv::merge(magnitude_spectrums, combined_magnitude);
 
-  const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
+  if (precision == COMPARE) {
+    cv::Mat float_magnitude, mixed_magnitude;
+    cv::merge(computeMagnitudeSpectrums<float>(channels, "float"),
+              float_magnitude);
+    cv::merge(computeMagnitudeSpectrums<float, double>(channels, "mixed"),
+              mixed_magnitude);
+    reportPrecisionError("float", float_magnitude, combined_magnitude);
+    reportPrecisionError("mixed", mixed_magnitude, combined_magnitude);
+  }
+
   // Save results
-  string output_path = string(output_dir) + "/sequential_fft_result.jpg";
+  string output_path = output_stem + ".jpg";
   cout << "Saving output to" << output_path << endl;
   bool success = cv::imwrite(output_path, combined_magnitude);
   if (!success) {
     std::cout << "Failed to save output image"<< std::endl;
+  } else {
+    cache.store(output_path);
   }
+  cache.report();
+
+  reportBufferPoolStats();
 
   // Display results
   return 0;
@@ -1,58 +1,9 @@
 #!/bin/bash
-export PROJECT_ROOT="/Users/joseph280996/Code/School/PHPC/Project"
-export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/strong"
+# Strong scalability test on data/input.jpg. Timings (median/p95 over repeated
+# runs) are merged into output/benchmark/results.csv, extra flags such as
+# --repetitions are passed through to benchmark.py
+cd "$(dirname "$0")"
 
-echo "Start fft transform"
-export OMP_NUM_THREADS=1
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=2
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=3
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=4
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=5
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=6
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=7
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=8
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=9
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=10
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=11
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=12
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=13
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=14
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=15
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=16
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=17
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=18
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=19
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=20
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=25
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=30
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=35
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=40
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=50
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-export OMP_NUM_THREADS=60
-./parallel_openmp /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg
-echo "Finished fft transform"
+echo "Start strong scalability test on fft transform"
+python3 ../benchmark.py strong --kernels fft_openmp --workers 1-20,25,30,35,40,50,60 "$@"
+echo "Finished strong scalability test on fft transform"
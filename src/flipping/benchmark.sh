@@ -1,11 +1,12 @@
 #!/bin/bash
-export PROJECT_ROOT="/Users/joseph280996/Code/School/PHPC/Project"
+export PROJECT_ROOT="$(cd "$(dirname "$0")/../.." && pwd)"
 export SEQ_OUTPUT_DIR="$PROJECT_ROOT/output/sequential"
 export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/parallel"
+mkdir -p "$SEQ_OUTPUT_DIR" "$PAR_OUTPUT_DIR"
 
 echo "Start flipping image horizontally"
-mpirun -np 10 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h true
+mpirun --bind-to core --map-by numa -np 10 ./parallel_flip "$PROJECT_ROOT/data/input.jpg" h true
 echo "Finished flipping image horizontally"
 echo "Start flipping image verticall"
-mpirun -np 10 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v true
+mpirun --bind-to core --map-by numa -np 10 ./parallel_flip "$PROJECT_ROOT/data/input.jpg" v true
 echo "Finished flipping image vertically"
@@ -1,87 +1,101 @@
+#include <algorithm>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <mpi.h>
 #include <opencv2/opencv.hpp>
 #include <string>
 
+#include "../common/batch_mpi.hpp"
+#include "../common/buffer_pool_mpi.hpp"
+#include "../common/node_comm.hpp"
+#include "../common/perf_counters_mpi.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/result_cache_mpi.hpp"
+#include "../common/roi.hpp"
+#include "../common/roofline.hpp"
+#include "../common/shared_window.hpp"
+#include "../common/stream_mpi.hpp"
+#include "../common/trace_mpi.hpp"
+
 using namespace cv;
 using namespace std;
 using namespace std::chrono;
 
 enum FlipType { HORIZONTAL = 0, VERTICAL = 1 };
 
+// Whole rows are swapped in place, so the horizontal flip works on the bytes
+// of any pixel type and needs no scratch row
 void flip_horizontal_sequential(Mat &image) {
   int rows = image.rows;
-  int cols = image.cols;
-  int channels = image.channels();
+  size_t row_bytes = image.cols * image.elemSize();
 
   // Swap rows from top and bottom
   for (int i = 0; i < rows / 2; i++) {
     uchar *top_row = image.ptr(i);
     uchar *bottom_row = image.ptr(rows - 1 - i);
-
-    vector<uchar> temp(cols * channels);
-    memcpy(temp.data(), top_row, cols * channels);
-    memcpy(top_row, bottom_row, cols * channels);
-    memcpy(bottom_row, temp.data(), cols * channels);
+    swap_ranges(top_row, top_row + row_bytes, bottom_row);
   }
 }
 
-void flip_vertical_sequential(Mat &image) {
+template <typename T, int CN> void flip_vertical_sequential(Mat &image) {
   int rows = image.rows;
   int cols = image.cols;
-  int channels = image.channels();
+  const int cn = channelCount<CN>(image.channels());
 
   for (int i = 0; i < rows; i++) {
-    uchar *row = image.ptr(i);
+    T *row = image.ptr<T>(i);
     for (int j = 0; j < cols / 2; j++) {
-      for (int c = 0; c < channels; c++) {
-        swap(row[j * channels + c], row[(cols - 1 - j) * channels + c]);
-      }
+      swapPixels<T, CN>(row + j * cn, row + (cols - 1 - j) * cn, cn);
     }
   }
 }
 
-void flip_vertical_parallel(uchar *shared_data, int rows, int cols,
-                            int channels, int rank, int num_processes) {
-  int block_size = rows / num_processes;
-  int start_row = rank * block_size;
-  int end_row = (rank == num_processes - 1) ? rows : (rank + 1) * block_size;
+void flip_vertical_sequential(Mat &image) {
+  dispatchPixelType(image.type(), [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    flip_vertical_sequential<T, decltype(pixel)::channels>(image);
+  });
+}
 
-  for (int i = start_row; i < end_row; i++) {
+// Mirror rows [start_row, end_row) in place, swapping whole pixels
+template <typename T, int CN>
+void flip_vertical_parallel(uchar *shared_data, int cols, int channels,
+                            long start_row, long end_row) {
+  T *values = reinterpret_cast<T *>(shared_data);
+  const int cn = channelCount<CN>(channels);
+  for (long i = start_row; i < end_row; i++) {
+    T *row = values + i * cols * cn;
     for (int j = 0; j < cols / 2; j++) {
-      for (int c = 0; c < channels; c++) {
-        int left_idx = (i * cols + j) * channels + c;
-        int right_idx = (i * cols + (cols - 1 - j)) * channels + c;
-        swap(shared_data[left_idx], shared_data[right_idx]);
-      }
+      swapPixels<T, CN>(row + j * cn, row + (cols - 1 - j) * cn, cn);
     }
   }
 }
 
-void flip_horizontal_parallel(uchar *shared_data, int rows, int cols,
-                              int channels, int rank, int num_processes) {
-  // Calculate work on half the rows since we only need to process half
-  int half_rows = rows / 2;
-  int block_size = half_rows / num_processes;
-  int start_row = rank * block_size;
-  int end_row =
-      (rank == num_processes - 1) ? half_rows : (rank + 1) * block_size;
-
-  // Now only process rows in the top half
-  for (int i = start_row; i < end_row; i++) {
-    int corresponding_row = rows - 1 - i;
-    size_t current_row_offset = i * cols * channels;
-    size_t opposite_row_offset = corresponding_row * cols * channels;
-
-    vector<uchar> temp(cols * channels);
-    memcpy(temp.data(), &shared_data[current_row_offset], cols * channels);
-    memcpy(&shared_data[current_row_offset], &shared_data[opposite_row_offset],
-           cols * channels);
-    memcpy(&shared_data[opposite_row_offset], temp.data(), cols * channels);
+// Swap the rows [start_row, end_row) of the top half with their mirrored rows
+// in the bottom half
+void flip_horizontal_parallel(uchar *shared_data, int rows, long row_bytes,
+                              long start_row, long end_row) {
+  for (long i = start_row; i < end_row; i++) {
+    long corresponding_row = rows - 1 - i;
+    size_t current_row_offset = i * row_bytes;
+    size_t opposite_row_offset = corresponding_row * row_bytes;
+    swap_ranges(&shared_data[current_row_offset],
+                &shared_data[current_row_offset] + row_bytes,
+                &shared_data[opposite_row_offset]);
   }
 }
 
+// A flip only permutes values: each swapped value is read and written once
+// and there is no arithmetic. The middle row (horizontal) or column
+// (vertical) of an odd sized image stays in place.
+KernelCost flip_cost(FlipType flip_type, int rows, int cols,
+                     size_t pixel_bytes) {
+  double swapped = flip_type == HORIZONTAL ? (double)(rows / 2 * 2) * cols
+                                           : (double)rows * (cols / 2 * 2);
+  return {2 * swapped * pixel_bytes, 0, false};
+}
+
 FlipType parseFlipType(const string &type) {
   if (type == "h" || type == "horizontal") {
     return HORIZONTAL;
@@ -93,12 +107,199 @@ FlipType parseFlipType(const string &type) {
   }
 }
 
+// Flip rank 0's image in the node-shared window of workspace and hand the
+// result to save on rank 0. Returns the kernel time. Collective over
+// MPI_COMM_WORLD.
+duration<double> flip_shared(const NodeComms &nodes, PhaseCounters &counters,
+                             SharedWorkspace &workspace, Mat &image,
+                             FlipType flip_type,
+                             const function<void(const Mat &)> &save) {
+  int rank, num_processes;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+
+  int dims[3] = {image.rows, image.cols, image.type()};
+
+  // Broadcast dimensions and pixel type to all processes
+  MPI_Bcast(dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
+
+  // The output rows are split into one balanced, page aligned part per rank
+  // and each node holds the slab of its ranks' parts. A vertical flip mirrors
+  // the slab's rows in place. A horizontal flip receives the mirrored input
+  // rows of its slab and reverses their order, split into the row pairs it
+  // swaps. The rows each rank writes are placed on its own NUMA node.
+  long row_bytes = (long)dims[1] * CV_ELEM_SIZE(dims[2]);
+  Partition partition(dims[0], row_bytes, num_processes);
+  WorkRange slab = nodes.slab(partition);
+  long slab_rows = slab.end - slab.begin;
+  long slab_bytes = slab_rows * row_bytes;
+  Partition node_partition(flip_type == HORIZONTAL ? slab_rows / 2 : slab_rows,
+                           row_bytes, nodes.node_size);
+  WorkRange part = node_partition.part(nodes.node_rank);
+  vector<WorkRange> written = {{part.begin * row_bytes, part.end * row_bytes}};
+  if (flip_type == HORIZONTAL) {
+    written.push_back({(slab_rows - part.end) * row_bytes,
+                       (slab_rows - part.begin) * row_bytes});
+  }
+  SharedImageWindow &window = workspace.window(0, slab_bytes, written);
+  uchar *sharedData = window.data();
+  SharedChunkCounter &next_chunk = workspace.chunkCounter();
+  NodeBarrier &node_barrier = workspace.barrier();
+
+  // Bytes of the input and the output image on every node, known to the
+  // leaders
+  vector<WorkRange> node_input_bytes, node_output_bytes;
+  if (nodes.isLeader()) {
+    for (const WorkRange &node_slab : nodes.nodeSlabs(partition)) {
+      node_output_bytes.push_back(
+          {node_slab.begin * row_bytes, node_slab.end * row_bytes});
+      node_input_bytes.push_back(
+          flip_type == HORIZONTAL
+              ? WorkRange{(dims[0] - node_slab.end) * row_bytes,
+                          (dims[0] - node_slab.begin) * row_bytes}
+              : node_output_bytes.back());
+    }
+  }
+
+  // Root scatters the slabs to the node leaders' shared memory
+  if (nodes.isLeader()) {
+    counters.begin("copy");
+    scatterSlabs(nodes, image.data, node_input_bytes, sharedData, slab_bytes);
+    counters.end();
+  }
+
+  // Ensure all processes see the initial data
+  node_barrier.wait({&window});
+
+  // Start parallel timing
+  auto start = high_resolution_clock::now();
+
+  // Each process flips its portion
+  counters.begin("kernel");
+  if (flip_type == HORIZONTAL) {
+    runPartition(node_partition, nodes.node_rank, next_chunk.get(),
+                 [&](long begin, long end) {
+                   flip_horizontal_parallel(sharedData, slab_rows, row_bytes,
+                                            begin, end);
+                 });
+  } else { // VERTICAL
+    dispatchPixelType(dims[2], [&](auto pixel) {
+      using T = typename decltype(pixel)::Channel;
+      constexpr int CN = decltype(pixel)::channels;
+      runPartition(node_partition, nodes.node_rank, next_chunk.get(),
+                   [&](long begin, long end) {
+                     flip_vertical_parallel<T, CN>(sharedData, dims[1],
+                                                   CV_MAT_CN(dims[2]), begin,
+                                                   end);
+                   });
+    });
+  }
+  counters.end();
+
+  // Wait for all processes to complete
+  counters.begin("barrier");
+  node_barrier.wait({&window});
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    MPI_Barrier(nodes.leaders);
+  }
+  counters.end();
+  auto stop = high_resolution_clock::now();
+
+  // Root gathers the slabs of the other nodes, on a single node the shared
+  // slab is the whole image
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    counters.begin("gather");
+    gatherSlabs(nodes, sharedData, slab_bytes, node_output_bytes, image.data);
+    counters.end();
+  }
+
+  if (rank == 0) {
+    save(nodes.num_nodes > 1
+             ? image
+             : Mat(dims[0], dims[1], dims[2], sharedData));
+  }
+
+  return stop - start;
+}
+
+// The batch mode of batch_mpi.hpp, results are written as
+// <name>_<horizontal|vertical>.jpg, or with the extension resultExtension
+// picks for other pixel types
+int flip_batch(const NodeComms &nodes, PhaseCounters &counters,
+               const string &input, FlipType flip_type) {
+  string flip_str = (flip_type == HORIZONTAL) ? "horizontal" : "vertical";
+  // Windows of the split images, allocated again only for a larger one
+  SharedWorkspace workspace(nodes.node);
+  auto decode = [](const string &path) { return readPixels(path); };
+  auto split = [&](Mat &image, ImagePool<Mat> &pool) {
+    // Copied out of the window, the encode overlaps the next image
+    Mat result;
+    flip_shared(nodes, counters, workspace, image, flip_type,
+                [&](const Mat &shared_result) {
+                  result = pool.acquire();
+                  shared_result.copyTo(result);
+                });
+    return result;
+  };
+  auto whole = [&](Mat &image, ImagePool<Mat> &) {
+    TraceScope scope("kernel");
+    if (flip_type == HORIZONTAL) {
+      flip_horizontal_sequential(image);
+    } else { // VERTICAL
+      flip_vertical_sequential(image);
+    }
+    return image;
+  };
+  auto encode = [&](const Mat &result, const string &path) {
+    return imwrite(
+        batchOutputPath(path, flip_str, resultExtension(result.type())),
+        result);
+  };
+  int status = runBatchMPI<Mat>(input, decode, split, whole, encode);
+  workspace.free();
+  return status;
+}
+
+// The streaming mode of stream_mpi.hpp. Each band is flipped on its own and
+// written to parallel_<horizontal|vertical>_result.ppm, a horizontally
+// flipped band to the mirrored rows.
+int flip_stream(const NodeComms &nodes, PhaseCounters &counters,
+                const string &input, FlipType flip_type) {
+  string flip_str = (flip_type == HORIZONTAL) ? "horizontal" : "vertical";
+  // Windows of the first, largest band, reused by the others
+  SharedWorkspace workspace(nodes.node);
+  auto process = [&](StreamBand &band) {
+    Mat image;
+    if (band.data != nullptr) {
+      image = Mat(band.count, band.cols, CV_8UC(band.channels), band.data);
+    }
+    int out_first = flip_type == HORIZONTAL
+                        ? band.rows - band.first - band.count
+                        : band.first;
+    return flip_shared(nodes, counters, workspace, image, flip_type,
+                       [&](const Mat &result) {
+                         counters.begin("encode");
+                         band.writer.writeRows(out_first, band.count,
+                                               result.data);
+                         counters.end();
+                       })
+        .count();
+  };
+  int status = runStreamMPI(counters, input, flip_str, false, 0, process);
+  workspace.free();
+  return status;
+}
+
 int main(int argc, char **argv) {
   if (argc != 4) {
     cout << "Usage: " << argv[0]
          << " <image_path> <flip_type> <with_sequential>" << endl;
     cout << "flip_type: 'h' or 'horizontal' for horizontal flip" << endl;
     cout << "          'v' or 'vertical' for vertical flip" << endl;
+    cout << "image_path may also be a directory or a .txt manifest of images"
+         << endl
+         << "With STREAM_BAND_BYTES set, a .ppm image is streamed in bands"
+         << endl;
     return -1;
   }
 
@@ -111,25 +312,104 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  MPI_Init(&argc, &argv);
+  // Batch mode decodes and encodes on helper threads
+  initMPIThreads(&argc, &argv);
 
-  int rank, num_processes;
+  int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
 
-  // Create shared communicator
-  MPI_Comm nodeComm;
-  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
-                      &nodeComm);
+  // Create node and node leader communicators
+  NodeComms nodes(MPI_COMM_WORLD);
+
+  // Optional hardware counters of each phase, PERF_COUNTERS=1
+  PhaseCounters counters(
+      perfCountersEnabled(MPI_COMM_WORLD),
+      {"decode", "copy", "kernel", "barrier", "gather", "encode"});
+
+  if (isBatchInput(argv[1]) || isStreamInput(argv[1])) {
+    int status = isBatchInput(argv[1])
+                     ? flip_batch(nodes, counters, argv[1], flip_type)
+                     : flip_stream(nodes, counters, argv[1], flip_type);
+    reportPhaseCounters(counters, MPI_COMM_WORLD);
+    reportBufferPoolStats(MPI_COMM_WORLD);
+    writeTraceMPI(MPI_COMM_WORLD);
+    nodes.free();
+    MPI_Finalize();
+    return status;
+  }
 
-  // Variables for shared memory
-  MPI_Win win;
-  uchar *sharedData;
-  int dims[3] = {0, 0, 0}; // rows, cols, channels
+  // The result of an earlier run on the same image and flip
+  string flip_str = (flip_type == HORIZONTAL) ? "horizontal" : "vertical";
+  const string with_sequential_flag = argv[3];
+  ResultCache cache(argv[1], "flip " + flip_str);
+  auto restore = [&] {
+    return !cache.restore(string(std::getenv("PAR_OUTPUT_DIR")) +
+                          "/parallel_" + flip_str + "_result")
+                .empty() &&
+           (with_sequential_flag != "true" ||
+            !cache.restore(string(std::getenv("SEQ_OUTPUT_DIR")) +
+                           "/sequential_" + flip_str + "_result")
+                 .empty());
+  };
+  if (lookupResult(cache, MPI_COMM_WORLD, restore)) {
+    if (rank == 0) {
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
+
+  // Only the mirror image of the edited rectangle on top of the previous
+  // result, see roi.hpp
+  int dirty_done = 0;
+  if (rank == 0) {
+    DirtyRegion dirty = dirtyRegion();
+    if (!dirty.previous_path.empty()) {
+      string output_path = updateDirtyRegion(
+          argv[1], dirty, false,
+          string(std::getenv("PAR_OUTPUT_DIR")) + "/parallel_" + flip_str +
+              "_result",
+          [&](const Mat &input, Mat &result) {
+            Rect rect = dirty.rect & Rect(0, 0, input.cols, input.rows);
+            if (rect.empty()) {
+              return rect;
+            }
+            Mat region = input(rect).clone();
+            Rect mirrored = rect;
+            if (flip_type == HORIZONTAL) {
+              flip_horizontal_sequential(region);
+              mirrored.y = input.rows - rect.y - rect.height;
+            } else { // VERTICAL
+              flip_vertical_sequential(region);
+              mirrored.x = input.cols - rect.x - rect.width;
+            }
+            Mat target = result(mirrored);
+            region.copyTo(target);
+            return mirrored;
+          });
+      if (!output_path.empty()) {
+        dirty_done = 1;
+      }
+    }
+  }
+  MPI_Bcast(&dirty_done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (dirty_done) {
+    if (rank == 0) {
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
+
+  Mat image;
 
   if (rank == 0) {
     // Read image and do sequential version
-    Mat image = imread(argv[1]);
+    counters.begin("decode");
+    image = readPixels(argv[1]);
+    counters.end();
     if (image.empty()) {
       cout << "Error: Could not read the image." << endl;
       MPI_Abort(MPI_COMM_WORLD, 1);
@@ -137,9 +417,11 @@ int main(int argc, char **argv) {
     }
 
     // Do sequential version
-    const string with_sequential_flag = argv[3];
     if (with_sequential_flag == "true") {
-      Mat seqImage = image.clone();
+      // Copy into a pooled buffer rather than clone() a fresh allocation
+      PooledBuffer seqBuffer(image.total() * image.elemSize());
+      Mat seqImage(image.rows, image.cols, image.type(), seqBuffer.data());
+      image.copyTo(seqImage);
       auto start = high_resolution_clock::now();
       if (flip_type == HORIZONTAL) {
         flip_horizontal_sequential(seqImage);
@@ -150,78 +432,61 @@ int main(int argc, char **argv) {
       cout << "Sequential time: "
            << duration_cast<microseconds>(stop - start).count()
            << " microseconds" << endl;
-      string flip_str = (flip_type == HORIZONTAL) ? "horizontal" : "vertical";
+      printRoofline(
+          flip_cost(flip_type, image.rows, image.cols, image.elemSize()),
+          duration<double>(stop - start).count());
       const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
-      string sequential_output =
-          string(output_dir) + "/sequential_" + flip_str + "_result.jpg";
+      string sequential_output = string(output_dir) + "/sequential_" +
+                                 flip_str + "_result" +
+                                 resultExtension(image.type());
       imwrite(sequential_output, seqImage);
     }
 
-    // Share dimensions
-    dims[0] = image.rows;
-    dims[1] = image.cols;
-    dims[2] = image.channels();
-  }
-
-  // Broadcast dimensions to all processes
-  MPI_Bcast(dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
-
-  // Allocate shared memory - only root allocates real size
-  size_t total_image_size = (rank == 0) ? dims[0] * dims[1] * dims[2] : 0;
-  MPI_Win_allocate_shared(total_image_size, 1, MPI_INFO_NULL, nodeComm,
-                          &sharedData, &win);
-
-  // Non-root processes get pointer to root's memory
-  if (rank != 0) {
-    MPI_Aint shared_memory_size;
-    int disp_unit;
-    MPI_Win_shared_query(win, 0, &shared_memory_size, &disp_unit, &sharedData);
   }
 
-  // Root copies image data to shared memory
-  if (rank == 0) {
-    Mat image = imread(argv[1]);
-    memcpy(sharedData, image.data, total_image_size);
+  // The windows of the one image, released before MPI_Finalize
+  SharedWorkspace workspace(nodes.node);
+  duration<double> elapsed = flip_shared(
+      nodes, counters, workspace, image, flip_type, [&](const Mat &result) {
+        // Save result
+        const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+        string parallel_output = string(output_dir) + "/parallel_" +
+                                 flip_str + "_result" +
+                                 updatableResultExtension(result.type());
+        counters.begin("encode");
+        bool success =
+            imwrite(parallel_output, result); // Changed seqImage to result
+        counters.end();
+        if (success) {
+          cache.store(parallel_output);
+        }
+      });
+
+  // Bandwidth ceiling of every rank streaming at the same time
+  double stream_gbps = 0;
+  if (rooflineProbeEnabled()) {
+    double rank_gbps = streamTriadBandwidth();
+    MPI_Reduce(&rank_gbps, &stream_gbps, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
   }
 
-  // Ensure all processes see the initial data
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  // Start parallel timing
-  auto start = high_resolution_clock::now();
-
-  // Each process flips its portion
-  if (flip_type == HORIZONTAL) {
-    // Process assigned rows if they need flipping
-    flip_horizontal_parallel(sharedData, dims[0], dims[1], dims[2], rank,
-                             num_processes);
-  } else { // VERTICAL
-    flip_vertical_parallel(sharedData, dims[0], dims[1], dims[2], rank,
-                           num_processes);
-  }
-
-  // Wait for all processes to complete
-  MPI_Barrier(MPI_COMM_WORLD);
-
   if (rank == 0) {
-    auto stop = high_resolution_clock::now();
     cout << "Parallel time: "
-         << duration_cast<microseconds>(stop - start).count() << " microseconds"
+         << duration_cast<microseconds>(elapsed).count() << " microseconds"
          << endl;
-
-    // Save result
-    Mat result(dims[0], dims[1], CV_8UC(dims[2]), sharedData);
-    string flip_str = (flip_type == HORIZONTAL) ? "horizontal" : "vertical";
-
-    const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
-    string parallel_output =
-        string(output_dir) + "/parallel_" + flip_str +
-        "_result.jpg"; // Also fixed "sequential" to "parallel" in the filename
-    imwrite(parallel_output, result); // Changed seqImage to result
+    printRoofline(flip_cost(flip_type, image.rows, image.cols,
+                            image.elemSize()),
+                  elapsed.count(), stream_gbps);
+  }
+  if (rank == 0) {
+    cache.report();
   }
+  reportPhaseCounters(counters, MPI_COMM_WORLD);
+  reportBufferPoolStats(MPI_COMM_WORLD);
+  writeTraceMPI(MPI_COMM_WORLD);
 
-  MPI_Win_free(&win);
-  MPI_Comm_free(&nodeComm);
+  workspace.free();
+  nodes.free();
   MPI_Finalize();
   return 0;
 }
@@ -1,29 +1,12 @@
 #!/bin/bash
+# Strong scalability test on data/input.jpg. Timings (median/p95 over repeated
+# runs) are merged into output/benchmark/results.csv, extra flags such as
+# --repetitions are passed through to benchmark.py
+cd "$(dirname "$0")"
 
-export PROJECT_ROOT="/Users/joseph280996/Code/School/PHPC/Project"
-export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/strong"
-
-echo "Start Strong Scalability Test Image Vertical Flipping"
-mpirun -np 1 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 2 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 3 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 4 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 5 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 6 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 7 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 8 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 9 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-mpirun -np 10 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg v false
-echo "Finished Strong Scalability Test Image Vertical Flipping"
-echo "Start Strong Scalability Test Image Horizontal Flipping"
-mpirun -np 1 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 2 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 3 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 4 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 5 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 6 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 7 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 8 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 9 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-mpirun -np 10 ./parallel_flip /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg h false
-echo "Finished Strong Scalability Test Image Horizontal Flipping"
+echo "Start strong scalability test on vertical flipping"
+python3 ../benchmark.py strong --kernels flip_vertical --workers 1-10 "$@"
+echo "Finished strong scalability test on vertical flipping"
+echo "Start strong scalability test on horizontal flipping"
+python3 ../benchmark.py strong --kernels flip_horizontal --workers 1-10 "$@"
+echo "Finished strong scalability test on horizontal flipping"
@@ -4,98 +4,471 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "../common/band_stream.hpp"
+#include "../common/batch.hpp"
+#include "../common/buffer_pool.hpp"
+#include "../common/gaussian_kernel.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/planar.hpp"
+#include "../common/result_cache.hpp"
+#include "../common/roi.hpp"
+#include "../common/roofline.hpp"
+#include "../common/trace.hpp"
+
 class GaussianBlur {
 private:
-  std::vector<float> createGaussianKernel(int radius, float sigma) {
-    int size = 2 * radius + 1;
-    std::vector<float> kernel(size);
-    float sum = 0.0f;
-
-    for (int x = -radius; x <= radius; x++) {
-      float exponent = -(x * x) / (2.0f * sigma * sigma);
-      kernel[x + radius] =
-          std::exp(exponent) / (std::sqrt(2.0f * M_PI) * sigma);
-      sum += kernel[x + radius];
-    }
+  // Both passes over width x height pixels with channels values of type T.
+  // Each output pixel is summed whole, a tap at a time, so with CN known its
+  // channel sums stay in registers and every tap loads one whole pixel.
+  template <typename T, int CN>
+  void blurPasses(T *image, T *temp, int width, int height, int channels,
+                  const std::vector<float> &kernel, int radius) {
+    const int cn = channelCount<CN>(channels);
+    // Supported images have at most 4 channels
+    constexpr int maxChannels = CN != ANY_CHANNELS ? CN : 4;
 
-    for (int i = 0; i < size; i++) {
-      kernel[i] /= sum;
-    }
+    // One parallel region for both passes, so each thread's share of either
+    // pass and its wait at the barrier between them show up in a trace
+#pragma omp parallel
+    {
+      {
+        TraceScope scope("horizontal pass");
+#pragma omp for collapse(2) nowait
+        for (int y = 0; y < height; y++) {
+          for (int x = 0; x < width; x++) {
+            float sum[maxChannels] = {};
 
-    return kernel;
-  }
+            for (int i = -radius; i <= radius; i++) {
+              int srcX = std::min(std::max(x + i, 0), width - 1);
+              const T *pixel = image + (y * width + srcX) * cn;
+              for (int c = 0; c < cn; c++) {
+                sum[c] += pixel[c] * kernel[i + radius];
+              }
+            }
 
-public:
-  void applyBlur(std::vector<unsigned char> &image, int width, int height,
-                 int channels, int radius, float sigma) {
-    std::vector<unsigned char> temp(image.size());
-    std::vector<float> kernel = createGaussianKernel(radius, sigma);
+            T *out = temp + (y * width + x) * cn;
+            for (int c = 0; c < cn; c++) {
+              out[c] = clampChannel<T>(sum[c]);
+            }
+          }
+        }
+      }
+      {
+        TraceScope scope("barrier", "sync");
+#pragma omp barrier
+      }
+      {
+        TraceScope scope("vertical pass");
+#pragma omp for collapse(2) nowait
+        for (int y = 0; y < height; y++) {
+          for (int x = 0; x < width; x++) {
+            float sum[maxChannels] = {};
 
-#pragma omp parallel for collapse(2)
-    for (int y = 0; y < height; y++) {
-      for (int x = 0; x < width; x++) {
-        for (int c = 0; c < channels; c++) {
-          float sum = 0.0f;
+            for (int i = -radius; i <= radius; i++) {
+              int srcY = std::min(std::max(y + i, 0), height - 1);
+              const T *pixel = temp + (srcY * width + x) * cn;
+              for (int c = 0; c < cn; c++) {
+                sum[c] += pixel[c] * kernel[i + radius];
+              }
+            }
 
-          for (int i = -radius; i <= radius; i++) {
-            int srcX = std::min(std::max(x + i, 0), width - 1);
-            sum +=
-                image[(y * width + srcX) * channels + c] * kernel[i + radius];
+            T *out = image + (y * width + x) * cn;
+            for (int c = 0; c < cn; c++) {
+              out[c] = clampChannel<T>(sum[c]);
+            }
           }
-
-          temp[(y * width + x) * channels + c] =
-              static_cast<unsigned char>(std::min(std::max(sum, 0.0f), 255.0f));
         }
       }
     }
+  }
 
-#pragma omp parallel for collapse(2)
-    for (int y = 0; y < height; y++) {
-      for (int x = 0; x < width; x++) {
-        for (int c = 0; c < channels; c++) {
-          float sum = 0.0f;
-
+  // Both passes over one plane of width x height values. Each row is summed
+  // a tap at a time into a row of sums, so the loops run along contiguous
+  // values and vectorize across pixels. The horizontal pass pads its row
+  // with copies of the edge values instead of clamping every index.
+  template <typename T>
+  void blurPlane(T *plane, T *temp, int width, int height,
+                 const std::vector<float> &kernel, int radius) {
+#pragma omp parallel
+    {
+      std::vector<float> padded(width + 2 * radius), sums(width);
+      {
+        TraceScope scope("horizontal pass");
+#pragma omp for nowait
+        for (int y = 0; y < height; y++) {
+          const T *row = plane + (long)y * width;
+          for (int x = 0; x < width + 2 * radius; x++) {
+            padded[x] = row[std::min(std::max(x - radius, 0), width - 1)];
+          }
+          std::fill(sums.begin(), sums.end(), 0.0f);
+          for (int i = 0; i <= 2 * radius; i++) {
+            const float *shifted = padded.data() + i;
+            float weight = kernel[i];
+#pragma omp simd
+            for (int x = 0; x < width; x++) {
+              sums[x] += shifted[x] * weight;
+            }
+          }
+          T *out = temp + (long)y * width;
+          for (int x = 0; x < width; x++) {
+            out[x] = clampChannel<T>(sums[x]);
+          }
+        }
+      }
+      {
+        TraceScope scope("barrier", "sync");
+#pragma omp barrier
+      }
+      {
+        TraceScope scope("vertical pass");
+#pragma omp for nowait
+        for (int y = 0; y < height; y++) {
+          std::fill(sums.begin(), sums.end(), 0.0f);
           for (int i = -radius; i <= radius; i++) {
             int srcY = std::min(std::max(y + i, 0), height - 1);
-            sum += temp[(srcY * width + x) * channels + c] * kernel[i + radius];
+            const T *row = temp + (long)srcY * width;
+            float weight = kernel[i + radius];
+#pragma omp simd
+            for (int x = 0; x < width; x++) {
+              sums[x] += row[x] * weight;
+            }
           }
+          T *out = plane + (long)y * width;
+          for (int x = 0; x < width; x++) {
+            out[x] = clampChannel<T>(sums[x]);
+          }
+        }
+      }
+    }
+  }
 
-          image[(y * width + x) * channels + c] =
-              static_cast<unsigned char>(std::min(std::max(sum, 0.0f), 255.0f));
+  // The planar layout of planar.hpp: the image is deinterleaved into planes,
+  // each plane blurred as a single channel image and the planes interleaved
+  // back. A single channel image is its own plane.
+  template <typename T, int CN>
+  void blurPlanar(T *image, int width, int height, int channels,
+                  const std::vector<float> &kernel, int radius) {
+    long planeSize = (long)width * height;
+    PooledVector<unsigned char> planeData(
+        channels > 1 ? planeSize * channels * sizeof(T) : 0);
+    PooledVector<unsigned char> temp(planeSize * sizeof(T));
+    T *planes =
+        channels > 1 ? reinterpret_cast<T *>(planeData.data()) : image;
+
+    double start = omp_get_wtime();
+    if (channels > 1) {
+#pragma omp parallel
+      {
+        TraceScope scope("deinterleave");
+#pragma omp for
+        for (int y = 0; y < height; y++) {
+          deinterleave<T, CN>(image, planes, channels, planeSize,
+                              (long)y * width, (long)(y + 1) * width);
         }
       }
     }
+    conversionSeconds += omp_get_wtime() - start;
+
+    for (int c = 0; c < channels; c++) {
+      blurPlane<T>(planes + c * planeSize, reinterpret_cast<T *>(temp.data()),
+                   width, height, kernel, radius);
+    }
+
+    start = omp_get_wtime();
+    if (channels > 1) {
+#pragma omp parallel
+      {
+        TraceScope scope("interleave");
+#pragma omp for
+        for (int y = 0; y < height; y++) {
+          interleave<T, CN>(planes, image, channels, planeSize,
+                            (long)y * width, (long)(y + 1) * width);
+        }
+      }
+    }
+    conversionSeconds += omp_get_wtime() - start;
+  }
+
+public:
+  // Seconds spent converting to and from the planar layout
+  double conversionSeconds = 0;
+
+  // image holds the pixels of a Mat of the given type, blurred in the
+  // layout pixelLayout() selects
+  void applyBlur(PooledVector<unsigned char> &image, int width, int height,
+                 int type, int radius, float sigma) {
+    std::vector<float> kernel = createGaussianKernel(radius, sigma);
+    if (pixelLayout() == PLANAR) {
+      dispatchPixelType(type, [&](auto pixel) {
+        using T = typename decltype(pixel)::Channel;
+        blurPlanar<T, decltype(pixel)::channels>(
+            reinterpret_cast<T *>(image.data()), width, height,
+            CV_MAT_CN(type), kernel, radius);
+      });
+      return;
+    }
+    PooledVector<unsigned char> temp(image.size());
+    dispatchPixelType(type, [&](auto pixel) {
+      using T = typename decltype(pixel)::Channel;
+      blurPasses<T, decltype(pixel)::channels>(
+          reinterpret_cast<T *>(image.data()),
+          reinterpret_cast<T *>(temp.data()), width, height, CV_MAT_CN(type),
+          kernel, radius);
+    });
   }
 };
 
+// Each of the two passes reads and writes every channel value once and does
+// a multiply-add per kernel tap
+KernelCost blurCost(int width, int height, int channels, size_t channelBytes,
+                    int radius) {
+  double values = (double)width * height * channels;
+  return {4 * values * channelBytes, 4 * (2 * radius + 1) * values, true};
+}
+
+// Blur one image of a batch in place. imageData is the worker's buffer,
+// reused from image to image. Inside an OpenMP worker thread of blurBatch the
+// passes run on that thread alone.
+void blurBatchImage(cv::Mat &image, PooledVector<unsigned char> &imageData,
+                    int radius, float sigma) {
+  imageData.assign(image.data, image.data + image.total() * image.elemSize());
+  GaussianBlur gaussianBlur;
+  gaussianBlur.applyBlur(imageData, image.cols, image.rows, image.type(),
+                         radius, sigma);
+  std::memcpy(image.data, imageData.data(), imageData.size());
+}
+
+// The batch mode of batch.hpp with OpenMP threads as the workers: large
+// images are blurred by every thread one after another, then each thread
+// blurs its share of the small images on its own. Every worker has its own
+// decoder and encoder thread, results are written as <name>_blurred.jpg, or
+// with the extension resultExtension picks for other pixel types.
+int blurBatch(const std::string &input, int radius, float sigma) {
+  std::vector<BatchItem> items = batchItems(input);
+  if (items.empty()) {
+    std::cerr << "Error: No images in " << input << std::endl;
+    return -1;
+  }
+  auto [split_items, whole_items] = splitBatch(items, batchSplitBytes());
+  auto decode = [](const std::string &path) { return readPixels(path); };
+  auto encode = [](const cv::Mat &result, const std::string &path) {
+    return cv::imwrite(
+        batchOutputPath(path, "blurred", resultExtension(result.type())),
+        result);
+  };
+
+  double start = omp_get_wtime();
+  long split_failed = 0;
+
+  std::vector<std::string> split_paths;
+  for (const BatchItem &item : split_items) {
+    split_paths.push_back(item.path);
+  }
+  ImagePool<cv::Mat> split_pool;
+  Encoder<cv::Mat> split_encoder(encode, split_pool);
+  Prefetcher<cv::Mat> split_prefetch(split_paths, decode);
+  PooledVector<unsigned char> imageData;
+  cv::Mat image;
+  std::string path;
+  while (split_prefetch.next(image, path)) {
+    if (image.empty()) {
+      std::cerr << "Error: Could not read image " << path << std::endl;
+      split_failed++;
+      continue;
+    }
+    blurBatchImage(image, imageData, radius, sigma);
+    split_encoder.submit(std::move(image), path);
+  }
+  split_failed += split_encoder.finish();
+
+  // A thread takes over the share of any worker the runtime did not start
+  int num_workers = omp_get_max_threads();
+  long whole_failed = 0;
+  std::vector<std::vector<std::string>> assignment =
+      assignWhole(whole_items, num_workers);
+#pragma omp parallel reduction(+ : whole_failed)
+  for (int worker = omp_get_thread_num(); worker < num_workers;
+       worker += omp_get_num_threads()) {
+    ImagePool<cv::Mat> pool;
+    Encoder<cv::Mat> encoder(encode, pool);
+    Prefetcher<cv::Mat> whole_prefetch(assignment[worker], decode);
+    PooledVector<unsigned char> imageData;
+    cv::Mat image;
+    std::string path;
+    while (whole_prefetch.next(image, path)) {
+      if (image.empty()) {
+        std::cerr << "Error: Could not read image " << path << std::endl;
+        whole_failed++;
+        continue;
+      }
+      blurBatchImage(image, imageData, radius, sigma);
+      encoder.submit(std::move(image), path);
+    }
+    whole_failed += encoder.finish();
+  }
+
+  double end = omp_get_wtime();
+  long failed = split_failed + whole_failed;
+  printBatchReport((long)items.size() - failed,
+                   (long)split_items.size() - split_failed, failed,
+                   end - start);
+  return failed == 0 ? 0 : -1;
+}
+
+// The streaming mode of band_stream.hpp. Each band is read with radius halo
+// rows above and below it, so the vertical pass sees the same neighbours as
+// on the whole image, blurred by every thread and written without the halo
+// to parallel_blurred_result.ppm.
+int blurStream(const std::string &input, int radius, float sigma) {
+  PnmBandReader reader;
+  PnmBandWriter writer;
+  if (!reader.open(input) ||
+      !writer.open(streamOutputPath("blurred", reader.channels), reader.rows,
+                   reader.cols, reader.channels)) {
+    return -1;
+  }
+  long rowBytes = reader.rowBytes();
+  int bandRows = std::min(streamBandRows(rowBytes, radius), reader.rows);
+
+  GaussianBlur gaussianBlur;
+  PooledVector<unsigned char> imageData;
+  double start = omp_get_wtime();
+  double blurSeconds = 0;
+  int bands = 0;
+  for (int first = 0; first < reader.rows; first += bandRows) {
+    int count = std::min(bandRows, reader.rows - first);
+    int top = std::max(0, first - radius);
+    int bottom = std::min(reader.rows, first + count + radius);
+    imageData.resize((bottom - top) * rowBytes);
+
+    TraceScope decode("decode", "io");
+    if (!reader.read(top, bottom - top, imageData.data())) {
+      return -1;
+    }
+    decode.end();
+
+    double blurStart = omp_get_wtime();
+    gaussianBlur.applyBlur(imageData, reader.cols, bottom - top,
+                           CV_8UC(reader.channels), radius, sigma);
+    blurSeconds += omp_get_wtime() - blurStart;
+
+    TraceScope encode("encode", "io");
+    if (!writer.writeRows(first, count,
+                          imageData.data() + (first - top) * rowBytes)) {
+      std::cerr << "Error: Could not write the streamed result" << std::endl;
+      return -1;
+    }
+    encode.end();
+    bands++;
+  }
+
+  std::cout << "Parallel time with " << omp_get_max_threads()
+            << " threads: " << blurSeconds * 1000 << " milliseconds"
+            << std::endl;
+  printStreamReport(bands, bandRows, omp_get_wtime() - start);
+  return 0;
+}
+
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " <image_path>" << std::endl;
+  if (argc != 2 && argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <image_path> [radius sigma]"
+              << std::endl;
+    std::cerr << "image_path may also be a directory or a .txt manifest of "
+                 "images"
+              << std::endl
+              << "With STREAM_BAND_BYTES set, a .ppm image is streamed in "
+                 "bands"
+              << std::endl;
     return -1;
   }
 
-  cv::Mat image = cv::imread(argv[1]);
+  // Default kernel used by the scalability tests
+  int radius = 5;
+  float sigma = 2.0f;
+  if (argc == 4) {
+    radius = std::stoi(argv[2]);
+    sigma = std::stof(argv[3]);
+  }
+
+  if (isBatchInput(argv[1]) || isStreamInput(argv[1])) {
+    int status = isBatchInput(argv[1]) ? blurBatch(argv[1], radius, sigma)
+                                       : blurStream(argv[1], radius, sigma);
+    reportBufferPoolStats();
+    writeTrace("parallel_omp blur");
+    return status;
+  }
+
+  // The result of an earlier run on the same image with the same kernel
+  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+  ResultCache cache(argv[1], "gaussian_blur_openmp " + std::to_string(radius) +
+                                 " " + std::to_string(sigma));
+  if (cache.lookup() &&
+      !cache.restore(std::string(output_dir) + "/parallel_blurred_result")
+           .empty()) {
+    cache.report();
+    return 0;
+  }
+
+  // Only the pixels the edited rectangle reaches on top of the previous
+  // result
+  DirtyRegion dirty = dirtyRegion();
+  if (!dirty.previous_path.empty()) {
+    GaussianBlur gaussianBlur;
+    std::string outputPath = updateDirtyRegion(
+        argv[1], dirty, false,
+        std::string(output_dir) + "/parallel_blurred_result",
+        [&](const cv::Mat &input, cv::Mat &result) {
+          return blurDirtyRegion(gaussianBlur, input, result, dirty.rect,
+                                 radius, sigma);
+        });
+    if (!outputPath.empty()) {
+      cache.report();
+      writeTrace("parallel_omp blur");
+      return 0;
+    }
+  }
+
+  TraceScope decode("decode", "io");
+  cv::Mat image = readPixels(argv[1]);
   if (image.empty()) {
     std::cerr << "Error: Could not read image " << argv[1] << std::endl;
     return -1;
   }
 
-  std::vector<unsigned char> imageData(
-      image.data, image.data + image.total() * image.channels());
+  PooledVector<unsigned char> imageData(
+      image.data, image.data + image.total() * image.elemSize());
+  decode.end();
 
   GaussianBlur gaussianBlur;
   double start = omp_get_wtime();
-  gaussianBlur.applyBlur(imageData, image.cols, image.rows, image.channels(), 5,
-                         2.0f);
+  gaussianBlur.applyBlur(imageData, image.cols, image.rows, image.type(),
+                         radius, sigma);
   double end = omp_get_wtime();
 
+  TraceScope encode("encode", "io");
   std::memcpy(image.data, imageData.data(), imageData.size());
-  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
-  std::string outputPath =
-      std::string(output_dir) + "/parallel_blurred_result.jpg";
-  cv::imwrite(outputPath, image);
+  std::string outputPath = std::string(output_dir) +
+                           "/parallel_blurred_result" +
+                           updatableResultExtension(image.type());
+  if (cv::imwrite(outputPath, image)) {
+    cache.store(outputPath);
+  }
+  encode.end();
 
-  std::cout << end - start << std::endl;
+  std::cout << "Parallel time with " << omp_get_max_threads()
+            << " threads: " << (end - start) * 1000 << " milliseconds"
+            << std::endl;
+  if (pixelLayout() == PLANAR) {
+    std::cout << "Planar conversion: " << gaussianBlur.conversionSeconds * 1000
+              << " milliseconds" << std::endl;
+  }
+  printRoofline(blurCost(image.cols, image.rows, image.channels(),
+                         image.elemSize1(), radius),
+                end - start,
+                rooflineProbeEnabled() ? streamTriadBandwidth() : 0);
+  cache.report();
+  reportBufferPoolStats();
+  writeTrace("parallel_omp blur");
 
   return 0;
 }
@@ -4,57 +4,42 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "../common/buffer_pool.hpp"
+#include "../common/gaussian_kernel.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/planar.hpp"
+#include "../common/result_cache.hpp"
+#include "../common/roi.hpp"
+#include "../common/roofline.hpp"
+
 class GaussianBlur {
 private:
-  // Generate 1D Gaussian kernel
-  std::vector<float> createGaussianKernel(int radius, float sigma) {
-    int size = 2 * radius + 1;
-    std::vector<float> kernel(size);
-    float sum = 0.0f;
-
-    for (int x = -radius; x <= radius; x++) {
-      float exponent = -(x * x) / (2.0f * sigma * sigma);
-      kernel[x + radius] =
-          std::exp(exponent) / (std::sqrt(2.0f * M_PI) * sigma);
-      sum += kernel[x + radius];
-    }
-
-    // Normalize kernel
-    for (int i = 0; i < size; i++) {
-      kernel[i] /= sum;
-    }
-
-    return kernel;
-  }
-
-public:
-  // Apply Gaussian blur to image data
-  double applyBlur(std::vector<unsigned char> &image, int width, int height,
-                   int channels, int radius, float sigma) {
-    if (image.empty() || width <= 0 || height <= 0 || channels <= 0) {
-      std::cerr << "Invalid image parameters" << std::endl;
-      return 0.0;
-    }
-
-    auto start = std::chrono::high_resolution_clock::now();
-
-    std::vector<unsigned char> temp(image.size());
-    std::vector<float> kernel = createGaussianKernel(radius, sigma);
+  // Both passes over width x height pixels with channels values of type T.
+  // Each output pixel is summed whole, a tap at a time, so with CN known its
+  // channel sums stay in registers and every tap loads one whole pixel.
+  template <typename T, int CN>
+  void blurPasses(T *image, T *temp, int width, int height, int channels,
+                  const std::vector<float> &kernel, int radius) {
+    const int cn = channelCount<CN>(channels);
+    // Supported images have at most 4 channels
+    constexpr int maxChannels = CN != ANY_CHANNELS ? CN : 4;
 
     // Horizontal pass
     for (int y = 0; y < height; y++) {
       for (int x = 0; x < width; x++) {
-        for (int c = 0; c < channels; c++) {
-          float sum = 0.0f;
+        float sum[maxChannels] = {};
 
-          for (int i = -radius; i <= radius; i++) {
-            int srcX = std::min(std::max(x + i, 0), width - 1);
-            sum +=
-                image[(y * width + srcX) * channels + c] * kernel[i + radius];
+        for (int i = -radius; i <= radius; i++) {
+          int srcX = std::min(std::max(x + i, 0), width - 1);
+          const T *pixel = image + (y * width + srcX) * cn;
+          for (int c = 0; c < cn; c++) {
+            sum[c] += pixel[c] * kernel[i + radius];
           }
+        }
 
-          temp[(y * width + x) * channels + c] =
-              static_cast<unsigned char>(std::min(std::max(sum, 0.0f), 255.0f));
+        T *out = temp + (y * width + x) * cn;
+        for (int c = 0; c < cn; c++) {
+          out[c] = clampChannel<T>(sum[c]);
         }
       }
     }
@@ -62,19 +47,143 @@ public:
     // Vertical pass
     for (int y = 0; y < height; y++) {
       for (int x = 0; x < width; x++) {
-        for (int c = 0; c < channels; c++) {
-          float sum = 0.0f;
+        float sum[maxChannels] = {};
 
-          for (int i = -radius; i <= radius; i++) {
-            int srcY = std::min(std::max(y + i, 0), height - 1);
-            sum += temp[(srcY * width + x) * channels + c] * kernel[i + radius];
+        for (int i = -radius; i <= radius; i++) {
+          int srcY = std::min(std::max(y + i, 0), height - 1);
+          const T *pixel = temp + (srcY * width + x) * cn;
+          for (int c = 0; c < cn; c++) {
+            sum[c] += pixel[c] * kernel[i + radius];
           }
+        }
 
-          image[(y * width + x) * channels + c] =
-              static_cast<unsigned char>(std::min(std::max(sum, 0.0f), 255.0f));
+        T *out = image + (y * width + x) * cn;
+        for (int c = 0; c < cn; c++) {
+          out[c] = clampChannel<T>(sum[c]);
         }
       }
     }
+  }
+
+  // Both passes over one plane of width x height values. Each row is summed
+  // a tap at a time into a row of sums, so the loops run along contiguous
+  // values and vectorize across pixels. The horizontal pass pads its row
+  // with copies of the edge values instead of clamping every index.
+  template <typename T>
+  void blurPlane(T *plane, T *temp, int width, int height,
+                 const std::vector<float> &kernel, int radius) {
+    std::vector<float> padded(width + 2 * radius), sums(width);
+
+    // Horizontal pass
+    for (int y = 0; y < height; y++) {
+      const T *row = plane + (long)y * width;
+      for (int x = 0; x < width + 2 * radius; x++) {
+        padded[x] = row[std::min(std::max(x - radius, 0), width - 1)];
+      }
+      std::fill(sums.begin(), sums.end(), 0.0f);
+      for (int i = 0; i <= 2 * radius; i++) {
+        const float *shifted = padded.data() + i;
+        float weight = kernel[i];
+#pragma omp simd
+        for (int x = 0; x < width; x++) {
+          sums[x] += shifted[x] * weight;
+        }
+      }
+      T *out = temp + (long)y * width;
+      for (int x = 0; x < width; x++) {
+        out[x] = clampChannel<T>(sums[x]);
+      }
+    }
+
+    // Vertical pass
+    for (int y = 0; y < height; y++) {
+      std::fill(sums.begin(), sums.end(), 0.0f);
+      for (int i = -radius; i <= radius; i++) {
+        int srcY = std::min(std::max(y + i, 0), height - 1);
+        const T *row = temp + (long)srcY * width;
+        float weight = kernel[i + radius];
+#pragma omp simd
+        for (int x = 0; x < width; x++) {
+          sums[x] += row[x] * weight;
+        }
+      }
+      T *out = plane + (long)y * width;
+      for (int x = 0; x < width; x++) {
+        out[x] = clampChannel<T>(sums[x]);
+      }
+    }
+  }
+
+  // The planar layout of planar.hpp: the image is deinterleaved into planes,
+  // each plane blurred as a single channel image and the planes interleaved
+  // back. A single channel image is its own plane.
+  template <typename T, int CN>
+  void blurPlanar(T *image, int width, int height, int channels,
+                  const std::vector<float> &kernel, int radius) {
+    long planeSize = (long)width * height;
+    PooledVector<unsigned char> planeData(
+        channels > 1 ? planeSize * channels * sizeof(T) : 0);
+    PooledVector<unsigned char> temp(planeSize * sizeof(T));
+    T *planes =
+        channels > 1 ? reinterpret_cast<T *>(planeData.data()) : image;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    if (channels > 1) {
+      deinterleave<T, CN>(image, planes, channels, planeSize, 0, planeSize);
+    }
+    std::chrono::duration<double> duration =
+        std::chrono::high_resolution_clock::now() - start;
+
+    for (int c = 0; c < channels; c++) {
+      blurPlane<T>(planes + c * planeSize, reinterpret_cast<T *>(temp.data()),
+                   width, height, kernel, radius);
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    if (channels > 1) {
+      interleave<T, CN>(planes, image, channels, planeSize, 0, planeSize);
+    }
+    duration += std::chrono::high_resolution_clock::now() - start;
+    conversionSeconds += duration.count();
+  }
+
+public:
+  // Seconds spent converting to and from the planar layout
+  double conversionSeconds = 0;
+
+  // Apply Gaussian blur to image data, the pixels of a Mat of the given type,
+  // in the layout pixelLayout() selects
+  double applyBlur(PooledVector<unsigned char> &image, int width, int height,
+                   int type, int radius, float sigma) {
+    if (image.empty() || width <= 0 || height <= 0 ||
+        !isSupportedPixelType(type)) {
+      std::cerr << "Invalid image parameters" << std::endl;
+      return 0.0;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<float> kernel = createGaussianKernel(radius, sigma);
+    if (pixelLayout() == PLANAR) {
+      dispatchPixelType(type, [&](auto pixel) {
+        using T = typename decltype(pixel)::Channel;
+        blurPlanar<T, decltype(pixel)::channels>(
+            reinterpret_cast<T *>(image.data()), width, height,
+            CV_MAT_CN(type), kernel, radius);
+      });
+      std::chrono::duration<double> duration =
+          std::chrono::high_resolution_clock::now() - start;
+      return duration.count();
+    }
+
+    PooledVector<unsigned char> temp(image.size());
+    dispatchPixelType(type, [&](auto pixel) {
+      using T = typename decltype(pixel)::Channel;
+      blurPasses<T, decltype(pixel)::channels>(
+          reinterpret_cast<T *>(image.data()),
+          reinterpret_cast<T *>(temp.data()), width, height, CV_MAT_CN(type),
+          kernel, radius);
+    });
 
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> duration = end - start;
@@ -82,6 +191,14 @@ public:
   }
 };
 
+// Each of the two passes reads and writes every channel value once and does
+// a multiply-add per kernel tap
+KernelCost blurCost(int width, int height, int channels, size_t channelBytes,
+                    int radius) {
+  double values = (double)width * height * channels;
+  return {4 * values * channelBytes, 4 * (2 * radius + 1) * values, true};
+}
+
 int main(int argc, char **argv) {
   if (argc != 2) {
     std::cerr << "Usage: " << argv[0] << " <image_path>" << std::endl;
@@ -91,9 +208,37 @@ int main(int argc, char **argv) {
   // Record total execution time
   auto total_start = std::chrono::high_resolution_clock::now();
 
+  // The result of an earlier run on the same image
+  const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
+  ResultCache cache(argv[1], "gaussian_blur_sequential 5 2");
+  if (cache.lookup() &&
+      !cache.restore(std::string(output_dir) + "/sequential_blurred_result")
+           .empty()) {
+    cache.report();
+    return 0;
+  }
+
+  // Only the pixels the edited rectangle reaches on top of the previous
+  // result
+  DirtyRegion dirty = dirtyRegion();
+  if (!dirty.previous_path.empty()) {
+    GaussianBlur gaussianBlur;
+    std::string outputPath = updateDirtyRegion(
+        argv[1], dirty, false,
+        std::string(output_dir) + "/sequential_blurred_result",
+        [&](const cv::Mat &input, cv::Mat &result) {
+          return blurDirtyRegion(gaussianBlur, input, result, dirty.rect, 5,
+                                 2.0f);
+        });
+    if (!outputPath.empty()) {
+      cache.report();
+      return 0;
+    }
+  }
+
   // Read image using OpenCV
   auto read_start = std::chrono::high_resolution_clock::now();
-  cv::Mat image = cv::imread(argv[1]);
+  cv::Mat image = readPixels(argv[1]);
   if (image.empty()) {
     std::cerr << "Error: Could not read image " << argv[1] << std::endl;
     return -1;
@@ -102,23 +247,25 @@ int main(int argc, char **argv) {
   std::chrono::duration<double> read_duration = read_end - read_start;
 
   // Convert OpenCV Mat to vector for our implementation
-  std::vector<unsigned char> imageData(
-      image.data, image.data + image.total() * image.channels());
+  PooledVector<unsigned char> imageData(
+      image.data, image.data + image.total() * image.elemSize());
 
   // Apply Gaussian blur and get processing time
   GaussianBlur gaussianBlur;
   double blur_time = gaussianBlur.applyBlur(imageData, image.cols, image.rows,
-                                            image.channels(), 5, 2.0f);
+                                            image.type(), 5, 2.0f);
 
   // Copy processed data back to Mat
   std::memcpy(image.data, imageData.data(), imageData.size());
 
   // Save the result using OpenCV
   auto write_start = std::chrono::high_resolution_clock::now();
-  const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
-  std::string outputPath =
-      std::string(output_dir) + "/sequential_blurred_result.jpg";
-  cv::imwrite(outputPath, image);
+  std::string outputPath = std::string(output_dir) +
+                           "/sequential_blurred_result" +
+                           updatableResultExtension(image.type());
+  if (cv::imwrite(outputPath, image)) {
+    cache.store(outputPath);
+  }
   auto write_end = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double> write_duration = write_end - write_start;
 
@@ -128,8 +275,18 @@ int main(int argc, char **argv) {
   // Print timing information
   std::cout << "\nTiming Information:" << std::endl;
   std::cout << "Blur Processing Time: " << blur_time << " seconds" << std::endl;
+  if (pixelLayout() == PLANAR) {
+    std::cout << "Planar conversion: " << gaussianBlur.conversionSeconds
+              << " seconds" << std::endl;
+  }
+  printRoofline(blurCost(image.cols, image.rows, image.channels(),
+                         image.elemSize1(), 5),
+                blur_time,
+                rooflineProbeEnabled() ? streamTriadBandwidth(false) : 0);
   std::cout << "Total Execution Time: " << total_duration.count() << " seconds"
             << std::endl;
+  cache.report();
+  reportBufferPoolStats();
 
   return 0;
 }
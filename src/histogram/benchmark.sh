@@ -0,0 +1,16 @@
+#!/bin/bash
+
+export PROJECT_ROOT="$(cd "$(dirname "$0")/../.." && pwd)"
+export SEQ_OUTPUT_DIR="$PROJECT_ROOT/output/sequential"
+export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/parallel"
+mkdir -p "$SEQ_OUTPUT_DIR" "$PAR_OUTPUT_DIR"
+
+echo "Start histogram and statistics"
+mpirun --bind-to core --map-by numa -np 8 ./parallel_histogram "$PROJECT_ROOT/data/input.jpg" stats true
+echo "Finished histogram and statistics"
+echo "Start histogram equalization"
+mpirun --bind-to core --map-by numa -np 8 ./parallel_histogram "$PROJECT_ROOT/data/input.jpg" equalize true
+echo "Finished histogram equalization"
+echo "Start CLAHE"
+mpirun --bind-to core --map-by numa -np 8 ./parallel_histogram "$PROJECT_ROOT/data/input.jpg" clahe true
+echo "Finished CLAHE"
@@ -0,0 +1,6 @@
+#!/bin/bash
+rm -rf build
+mkdir build && cd build
+cmake ..
+make
+mv parallel_histogram ..
@@ -0,0 +1,841 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mpi.h>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "../common/buffer_pool_mpi.hpp"
+#include "../common/node_comm.hpp"
+#include "../common/perf_counters_mpi.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/result_cache_mpi.hpp"
+#include "../common/roofline.hpp"
+#include "../common/shared_window.hpp"
+#include "../common/trace_mpi.hpp"
+
+using namespace cv;
+using namespace std;
+using namespace std::chrono;
+
+enum HISTOGRAMOP { STATS = 0, EQUALIZE = 1, CLAHE = 2 };
+
+// The operation, with per_channel set by the _channels variants, which
+// equalize every color channel on its own rather than the luma
+HISTOGRAMOP parseHistogramOp(const string &op, bool &per_channel) {
+  per_channel = false;
+  if (op == "stats") {
+    return STATS;
+  } else if (op == "equalize") {
+    return EQUALIZE;
+  } else if (op == "clahe") {
+    return CLAHE;
+  } else if (op == "equalize_channels") {
+    per_channel = true;
+    return EQUALIZE;
+  } else if (op == "clahe_channels") {
+    per_channel = true;
+    return CLAHE;
+  } else {
+    throw invalid_argument("Invalid operation. Use 'stats', 'equalize', "
+                           "'clahe', 'equalize_channels' or 'clahe_channels'");
+  }
+}
+
+// Defaults of cv::createCLAHE
+constexpr double CLAHE_CLIP_LIMIT = 2.0;
+constexpr int CLAHE_TILES = 8;
+
+// Float channels are binned over [0, 1]
+constexpr int FLOAT_HISTOGRAM_BINS = 256;
+
+// Histogram bins of a channel type: one per value for 8-bit and 16-bit
+// channels. CLAHE keeps a histogram per tile, and bins 16-bit channels by
+// their top 12 bits.
+template <typename T> int histogram_bins(HISTOGRAMOP op) {
+  if constexpr (is_floating_point<T>::value) {
+    return FLOAT_HISTOGRAM_BINS;
+  } else if constexpr (sizeof(T) == 1) {
+    return 256;
+  } else {
+    return op == CLAHE ? 4096 : 65536;
+  }
+}
+
+// Bin of a channel value among bins spanning the range of T
+template <typename T> struct Binner {
+  int bins;
+  int shift = 0; // of integer values
+
+  explicit Binner(int bins) : bins(bins) {
+    if constexpr (!is_floating_point<T>::value) {
+      while (((long)numeric_limits<T>::max() + 1) >> shift > bins) {
+        shift++;
+      }
+    }
+  }
+
+  int operator()(T value) const {
+    if constexpr (is_floating_point<T>::value) {
+      return (int)min(max(value * bins, 0.0f), bins - 1.0f);
+    } else {
+      return value >> shift;
+    }
+  }
+};
+
+// Largest channel value, the top of the equalized range
+template <typename T> double channel_max() {
+  if constexpr (is_floating_point<T>::value) {
+    return 1.0;
+  } else {
+    return numeric_limits<T>::max();
+  }
+}
+
+// Luma of a BGR pixel, the Y of cv::COLOR_BGR2YCrCb, on the scale of T
+template <typename T> T pixel_luma(const T *pixel) {
+  return roundChannel<T>(0.114f * pixel[0] + 0.587f * pixel[1] +
+                         0.299f * pixel[2]);
+}
+
+// The color channels of a BGR pixel moved by the change of its luma. The
+// luma weights sum to 1, so Y moves by change while R - Y and B - Y, and so
+// Cr and Cb, stay as they are, unless a channel is clamped to the range.
+template <typename T> void shift_luma(T *pixel, float change) {
+  const float top = (float)channel_max<T>();
+  for (int k = 0; k < 3; k++) {
+    pixel[k] = roundChannel<T>(min(max(pixel[k] + change, 0.0f), top));
+  }
+}
+
+// Whether the LUTs map the luma of color pixels rather than each channel:
+// for EQUALIZE and CLAHE of color images unless per_channel is set, since
+// equalizing B, G and R apart shifts the hues
+bool equalizes_luma(HISTOGRAMOP op, bool per_channel, int channels) {
+  return op != STATS && !per_channel && channels >= 3;
+}
+
+// Tiles of CLAHE, of tile_w x tile_h pixels but for the last row and column.
+// Tiles that would lie wholly outside a small image are dropped. A grid of
+// one tile is the whole image, for the global histogram.
+struct TileGrid {
+  int tile_w, tile_h;
+  int tiles_x, tiles_y;
+
+  TileGrid(int rows, int cols, int tiles)
+      : tile_w((cols + tiles - 1) / tiles), tile_h((rows + tiles - 1) / tiles),
+        tiles_x((cols + tile_w - 1) / tile_w),
+        tiles_y((rows + tile_h - 1) / tile_h) {}
+
+  int count() const { return tiles_x * tiles_y; }
+};
+
+// Per channel statistics of a set of pixels
+struct ImageStats {
+  array<double, 4> min, max, sum{}, sum_squares{};
+
+  ImageStats() {
+    min.fill(numeric_limits<double>::max());
+    max.fill(numeric_limits<double>::lowest());
+  }
+};
+
+// Histograms and statistics of the whole image on rank 0, the histograms of
+// every tile with counts[(tile * channels + c) * bins + bin]
+struct HistogramResult {
+  int bins = 0;
+  vector<long> counts;
+  ImageStats stats;
+};
+
+// Pixels [start_pixel, end_pixel) of an image cols pixels wide, in row-major
+// order, into the rank's private histograms and statistics. pixels holds the
+// image from pixel first_pixel on. col_offsets is the offset of the histograms
+// of each column's tile in counts. With luma set each tile has one histogram,
+// of the luma of its pixels, while the statistics are still of every channel.
+template <typename T, int CN>
+void histogram_parallel(const uchar *shared_data, long first_pixel,
+                        long start_pixel, long end_pixel, int cols,
+                        int channels, bool luma, const Binner<T> &binner,
+                        const TileGrid &grid, const vector<long> &col_offsets,
+                        long *counts, ImageStats &stats) {
+  const T *pixels = reinterpret_cast<const T *>(shared_data);
+  const int cn = channelCount<CN>(channels);
+  const int histograms = luma ? 1 : cn;
+  const long bins = binner.bins;
+  // Supported images have at most 4 channels
+  constexpr int maxChannels = CN != ANY_CHANNELS ? CN : 4;
+  T lo[maxChannels], hi[maxChannels];
+  double sum[maxChannels] = {}, squares[maxChannels] = {};
+  if (start_pixel < end_pixel) {
+    copyPixel<T, CN>(lo, pixels + start_pixel * cn, cn);
+    copyPixel<T, CN>(hi, pixels + start_pixel * cn, cn);
+  }
+
+  // A row of the image at a time, all in one row of tiles
+  for (long p = start_pixel; p < end_pixel;) {
+    long y = (first_pixel + p) / cols;
+    long x = (first_pixel + p) % cols;
+    long run = min(end_pixel - p, cols - x);
+    long *row_counts =
+        counts + (y / grid.tile_h) * grid.tiles_x * histograms * bins;
+    for (long i = 0; i < run; i++) {
+      const T *pixel = pixels + (p + i) * cn;
+      long *tile_counts = row_counts + col_offsets[x + i];
+      if (luma) {
+        tile_counts[binner(pixel_luma(pixel))]++;
+      }
+      for (int k = 0; k < cn; k++) {
+        T value = pixel[k];
+        if (!luma) {
+          tile_counts[k * bins + binner(value)]++;
+        }
+        lo[k] = min(lo[k], value);
+        hi[k] = max(hi[k], value);
+        sum[k] += value;
+        squares[k] += (double)value * value;
+      }
+    }
+    p += run;
+  }
+
+  if (start_pixel < end_pixel) {
+    for (int k = 0; k < cn; k++) {
+      stats.min[k] = min(stats.min[k], (double)lo[k]);
+      stats.max[k] = max(stats.max[k], (double)hi[k]);
+      stats.sum[k] += sum[k];
+      stats.sum_squares[k] += squares[k];
+    }
+  }
+}
+
+// Offset of the histograms of each column's tile in the counts of its row of
+// tiles
+vector<long> column_offsets(int cols, const TileGrid &grid, int channels,
+                            int bins) {
+  vector<long> offsets(cols);
+  for (int x = 0; x < cols; x++) {
+    offsets[x] = (long)(x / grid.tile_w) * channels * bins;
+  }
+  return offsets;
+}
+
+// The equalizing map of every tile's histogram of the first lut_channels
+// channels, luts[(tile * channels + c) * bins + bin] on the scale of the
+// channel. The global histogram is equalized like cv::equalizeHist, its lowest
+// value mapped to 0. With adaptive set each tile first has its bins clipped at
+// clip_limit times the average bin and the excess spread over all bins, like
+// cv::createCLAHE, which limits how much contrast a flat tile gains.
+vector<float> equalizing_luts(const vector<long> &counts, int tiles,
+                              int channels, int lut_channels, int bins,
+                              bool adaptive, double clip_limit,
+                              double max_value) {
+  vector<float> luts(counts.size());
+  vector<long> histogram(bins);
+  for (int t = 0; t < tiles; t++) {
+    for (int c = 0; c < lut_channels; c++) {
+      long offset = ((long)t * channels + c) * bins;
+      copy(counts.begin() + offset, counts.begin() + offset + bins,
+           histogram.begin());
+      long total = 0;
+      for (long count : histogram) {
+        total += count;
+      }
+      float *lut = luts.data() + offset;
+
+      if (!adaptive) {
+        int first = 0;
+        while (first < bins - 1 && histogram[first] == 0) {
+          first++;
+        }
+        long base = histogram[first];
+        if (total == base) {
+          // A single value keeps its bin's
+          for (int b = 0; b < bins; b++) {
+            lut[b] = (float)(b * max_value / (bins - 1));
+          }
+          continue;
+        }
+        double scale = max_value / (total - base);
+        long cdf = 0;
+        for (int b = 0; b < bins; b++) {
+          cdf += histogram[b];
+          lut[b] = b < first ? 0.0f : (float)((cdf - base) * scale);
+        }
+        continue;
+      }
+
+      if (clip_limit > 0) {
+        long limit = max(1L, (long)(clip_limit * total / bins));
+        long excess = 0;
+        for (long &count : histogram) {
+          if (count > limit) {
+            excess += count - limit;
+            count = limit;
+          }
+        }
+        long batch = excess / bins;
+        long residual = excess - batch * bins;
+        for (long &count : histogram) {
+          count += batch;
+        }
+        long step = max(bins / max(residual, 1L), 1L);
+        for (long b = 0; b < bins && residual > 0; b += step, residual--) {
+          histogram[b]++;
+        }
+      }
+      double scale = total > 0 ? max_value / total : 0;
+      long cdf = 0;
+      for (int b = 0; b < bins; b++) {
+        cdf += histogram[b];
+        lut[b] = (float)(cdf * scale);
+      }
+    }
+  }
+  return luts;
+}
+
+// Pixels [start_pixel, end_pixel) mapped in place through the equalizing
+// LUTs, the first lut_channels channels, an alpha channel is left as it is.
+// With luma set the single LUT of each tile maps the luma and the color
+// channels are shifted by its change. With a single tile each value is looked
+// up. With CLAHE's grid each pixel blends the maps of the four tiles around
+// it by its distance to their centers, so the tile edges do not show.
+template <typename T, int CN>
+void apply_luts_parallel(uchar *shared_data, long first_pixel,
+                         long start_pixel, long end_pixel, int cols,
+                         int channels, int lut_channels, bool luma,
+                         const Binner<T> &binner, const TileGrid &grid,
+                         const vector<float> &luts) {
+  T *pixels = reinterpret_cast<T *>(shared_data);
+  const int cn = channelCount<CN>(channels);
+  const int histograms = luma ? 1 : cn;
+  const long bins = binner.bins;
+
+  if (grid.count() == 1) {
+    for (long p = start_pixel; p < end_pixel; p++) {
+      T *pixel = pixels + p * cn;
+      if (luma) {
+        T y = pixel_luma(pixel);
+        shift_luma(pixel, luts[binner(y)] - y);
+        continue;
+      }
+      for (int k = 0; k < lut_channels; k++) {
+        pixel[k] = roundChannel<T>(luts[k * bins + binner(pixel[k])]);
+      }
+    }
+    return;
+  }
+
+  // The two tiles either side of each column and the weight of the second,
+  // as in cv::createCLAHE
+  vector<long> left(cols), right(cols);
+  vector<float> right_weight(cols);
+  for (int x = 0; x < cols; x++) {
+    float tx = (float)x / grid.tile_w - 0.5f;
+    int tx1 = (int)floor(tx);
+    right_weight[x] = tx - tx1;
+    left[x] = (long)max(tx1, 0) * histograms * bins;
+    right[x] = (long)min(tx1 + 1, grid.tiles_x - 1) * histograms * bins;
+  }
+
+  for (long p = start_pixel; p < end_pixel;) {
+    long y = (first_pixel + p) / cols;
+    long x = (first_pixel + p) % cols;
+    long run = min(end_pixel - p, cols - x);
+    float ty = (float)y / grid.tile_h - 0.5f;
+    int ty1 = (int)floor(ty);
+    float bottom_weight = ty - ty1;
+    const float *top_luts =
+        luts.data() + (long)max(ty1, 0) * grid.tiles_x * histograms * bins;
+    const float *bottom_luts =
+        luts.data() + (long)min(ty1 + 1, grid.tiles_y - 1) * grid.tiles_x *
+                          histograms * bins;
+    for (long i = 0; i < run; i++, x++) {
+      T *pixel = pixels + (p + i) * cn;
+      float wx = right_weight[x];
+      auto blend = [&](long bin) {
+        float top = (1 - wx) * top_luts[left[x] + bin] +
+                    wx * top_luts[right[x] + bin];
+        float bottom = (1 - wx) * bottom_luts[left[x] + bin] +
+                       wx * bottom_luts[right[x] + bin];
+        return (1 - bottom_weight) * top + bottom_weight * bottom;
+      };
+      if (luma) {
+        T y = pixel_luma(pixel);
+        shift_luma(pixel, blend(binner(y)) - y);
+        continue;
+      }
+      for (int k = 0; k < lut_channels; k++) {
+        pixel[k] = roundChannel<T>(blend(k * bins + binner(pixel[k])));
+      }
+    }
+    p += run;
+  }
+}
+
+// Channels the LUTs map: all but an alpha channel
+int lut_channel_count(int channels) { return channels == 4 ? 3 : channels; }
+
+// Sum of every rank's counts, on rank 0 or with all on every rank. Summed
+// within each node first and then across the node leaders, so one set of
+// histograms per node crosses the network. Collective over MPI_COMM_WORLD.
+void reduce_counts(const NodeComms &nodes, vector<long> &counts, bool all) {
+  vector<long> node_counts(counts.size());
+  MPI_Reduce(counts.data(), node_counts.data(), (int)counts.size(), MPI_LONG,
+             MPI_SUM, 0, nodes.node);
+  if (nodes.isLeader() && nodes.num_nodes > 1) {
+    if (all) {
+      MPI_Allreduce(MPI_IN_PLACE, node_counts.data(), (int)counts.size(),
+                    MPI_LONG, MPI_SUM, nodes.leaders);
+    } else {
+      int leader_rank;
+      MPI_Comm_rank(nodes.leaders, &leader_rank);
+      MPI_Reduce(leader_rank == 0 ? MPI_IN_PLACE : node_counts.data(),
+                 node_counts.data(), (int)counts.size(), MPI_LONG, MPI_SUM, 0,
+                 nodes.leaders);
+    }
+  }
+  if (all) {
+    MPI_Bcast(node_counts.data(), (int)counts.size(), MPI_LONG, 0, nodes.node);
+  }
+  counts.swap(node_counts);
+}
+
+// Every rank's statistics combined on rank 0
+void reduce_stats(ImageStats &stats) {
+  ImageStats total;
+  MPI_Reduce(stats.min.data(), total.min.data(), 4, MPI_DOUBLE, MPI_MIN, 0,
+             MPI_COMM_WORLD);
+  MPI_Reduce(stats.max.data(), total.max.data(), 4, MPI_DOUBLE, MPI_MAX, 0,
+             MPI_COMM_WORLD);
+  MPI_Reduce(stats.sum.data(), total.sum.data(), 4, MPI_DOUBLE, MPI_SUM, 0,
+             MPI_COMM_WORLD);
+  MPI_Reduce(stats.sum_squares.data(), total.sum_squares.data(), 4,
+             MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  stats = total;
+}
+
+// Every channel value is read once, binned and counted, and added to the
+// statistics. Equalization reads and writes each value again through a LUT,
+// and CLAHE blends four of them.
+KernelCost histogram_cost(HISTOGRAMOP op, int rows, int cols, int channels,
+                          size_t channel_bytes) {
+  double values = (double)rows * cols * channels;
+  double ops[] = {6, 8, 16};
+  double passes[] = {1, 3, 3};
+  return {passes[op] * values * channel_bytes, ops[op] * values, false};
+}
+
+// The histograms and statistics of image, and for EQUALIZE and CLAHE image
+// equalized in place, in one sequential pass each
+void histogram_sequential(HISTOGRAMOP op, bool per_channel, Mat &image,
+                          double clip_limit, int tiles,
+                          HistogramResult &result) {
+  dispatchPixelType(image.type(), [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    int channels = image.channels();
+    bool luma = equalizes_luma(op, per_channel, channels);
+    int histograms = luma ? 1 : channels;
+    long total = (long)image.rows * image.cols;
+    Binner<T> binner(histogram_bins<T>(op));
+    TileGrid grid(image.rows, image.cols, op == CLAHE ? tiles : 1);
+    result.bins = binner.bins;
+    result.counts.assign((long)grid.count() * histograms * binner.bins, 0);
+    result.stats = ImageStats();
+    histogram_parallel<T, CN>(
+        image.data, 0, 0, total, image.cols, channels, luma, binner, grid,
+        column_offsets(image.cols, grid, histograms, binner.bins),
+        result.counts.data(), result.stats);
+    if (op != STATS) {
+      int lut_channels = luma ? 1 : lut_channel_count(channels);
+      vector<float> luts = equalizing_luts(
+          result.counts, grid.count(), histograms, lut_channels, binner.bins,
+          op == CLAHE, clip_limit, channel_max<T>());
+      apply_luts_parallel<T, CN>(image.data, 0, 0, total, image.cols,
+                                 channels, lut_channels, luma, binner, grid,
+                                 luts);
+    }
+  });
+}
+
+// Histograms and statistics of rank 0's image in the node-shared windows
+// into result on rank 0. For EQUALIZE and CLAHE the image is then equalized
+// in place and handed to save on rank 0 before the windows are released.
+// Returns the kernel time. Collective over MPI_COMM_WORLD.
+duration<double> histogram_shared(const NodeComms &nodes,
+                                  PhaseCounters &counters, Mat &image,
+                                  HISTOGRAMOP op, bool per_channel,
+                                  double clip_limit, int tiles,
+                                  HistogramResult &result,
+                                  const function<void(const Mat &)> &save) {
+  int rank, num_processes;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+
+  int dims[3] = {image.rows, image.cols, image.type()};
+
+  // Broadcast dimensions and pixel type to all processes
+  MPI_Bcast(dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  long pixel_bytes = CV_ELEM_SIZE(dims[2]);
+  int channels = CV_MAT_CN(dims[2]);
+  bool luma = equalizes_luma(op, per_channel, channels);
+  int histograms = luma ? 1 : channels;
+
+  // The pixels are split into one balanced, page aligned part per rank like
+  // the color transformation's. Each node holds the slab of its ranks'
+  // parts, which it splits again between them, and each rank's part of the
+  // shared slab is placed on its own NUMA node.
+  Partition partition((long)dims[0] * dims[1], pixel_bytes, num_processes);
+  WorkRange slab = nodes.slab(partition);
+  long slab_bytes = (slab.end - slab.begin) * pixel_bytes;
+  Partition node_partition(slab.end - slab.begin, pixel_bytes,
+                           nodes.node_size);
+  WorkRange part = node_partition.part(nodes.node_rank);
+  SharedImageWindow window(nodes.node, slab_bytes,
+                           {{part.begin * pixel_bytes, part.end * pixel_bytes}});
+  uchar *sharedData = window.data();
+  // One per pass, a counter is used up by the pass
+  SharedChunkCounter histogram_chunk(nodes.node);
+  SharedChunkCounter lut_chunk(nodes.node);
+  NodeBarrier node_barrier(nodes.node);
+
+  // Bytes of the image on every node, known to the leaders
+  vector<WorkRange> node_bytes;
+  if (nodes.isLeader()) {
+    for (const WorkRange &node_slab : nodes.nodeSlabs(partition)) {
+      node_bytes.push_back(
+          {node_slab.begin * pixel_bytes, node_slab.end * pixel_bytes});
+    }
+  }
+
+  // Root scatters the slabs to the node leaders' shared memory
+  if (nodes.isLeader()) {
+    counters.begin("copy");
+    scatterSlabs(nodes, image.data, node_bytes, sharedData, slab_bytes);
+    counters.end();
+  }
+
+  // Ensure all processes see the initial data
+  node_barrier.wait({&window});
+
+  // Start parallel timing
+  auto start = high_resolution_clock::now();
+
+  counters.begin("kernel");
+  dispatchPixelType(dims[2], [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    Binner<T> binner(histogram_bins<T>(op));
+    TileGrid grid(dims[0], dims[1], op == CLAHE ? tiles : 1);
+    vector<long> col_offsets =
+        column_offsets(dims[1], grid, histograms, binner.bins);
+
+    // Each rank counts the pixels it takes into histograms of its own, so no
+    // two ranks ever write the same bin
+    vector<long> counts((long)grid.count() * histograms * binner.bins, 0);
+    ImageStats stats;
+    runPartition(node_partition, nodes.node_rank, histogram_chunk.get(),
+                 [&](long begin, long end) {
+                   histogram_parallel<T, CN>(
+                       sharedData, slab.begin, begin, end, dims[1], channels,
+                       luma, binner, grid, col_offsets, counts.data(), stats);
+                 });
+    reduce_counts(nodes, counts, op != STATS);
+    reduce_stats(stats);
+    result.bins = binner.bins;
+    result.stats = stats;
+
+    if (op != STATS) {
+      // Every rank builds the same LUTs from the merged histograms
+      int lut_channels = luma ? 1 : lut_channel_count(channels);
+      vector<float> luts = equalizing_luts(
+          counts, grid.count(), histograms, lut_channels, binner.bins,
+          op == CLAHE, clip_limit, channel_max<T>());
+      runPartition(node_partition, nodes.node_rank, lut_chunk.get(),
+                   [&](long begin, long end) {
+                     apply_luts_parallel<T, CN>(sharedData, slab.begin, begin,
+                                                end, dims[1], channels,
+                                                lut_channels, luma, binner,
+                                                grid, luts);
+                   });
+    }
+    result.counts.swap(counts);
+  });
+  counters.end();
+
+  // Wait for all processes to complete
+  counters.begin("barrier");
+  node_barrier.wait({&window});
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    MPI_Barrier(nodes.leaders);
+  }
+  counters.end();
+  auto stop = high_resolution_clock::now();
+
+  if (op != STATS) {
+    // Root gathers the slabs of the other nodes, on a single node the shared
+    // slab is the whole image
+    if (nodes.num_nodes > 1 && nodes.isLeader()) {
+      counters.begin("gather");
+      gatherSlabs(nodes, sharedData, slab_bytes, node_bytes, image.data);
+      counters.end();
+    }
+
+    if (rank == 0) {
+      save(nodes.num_nodes > 1
+               ? image
+               : Mat(dims[0], dims[1], dims[2], sharedData));
+    }
+  }
+
+  node_barrier.free();
+  histogram_chunk.free();
+  lut_chunk.free();
+  window.free();
+  return stop - start;
+}
+
+// e.g. "blue" for channel 0 of a BGR image
+string channel_name(int channel, int channels) {
+  if (channels == 1) {
+    return "gray";
+  }
+  const char *names[] = {"blue", "green", "red", "alpha"};
+  return names[channel];
+}
+
+// The minimum, maximum, mean and standard deviation of every channel, on the
+// scale of its type
+void print_stats(const HistogramResult &result, long pixels, int channels) {
+  for (int c = 0; c < channels; c++) {
+    double mean = result.stats.sum[c] / pixels;
+    double variance =
+        max(0.0, result.stats.sum_squares[c] / pixels - mean * mean);
+    cout << "Channel " << channel_name(c, channels)
+         << ": min " << result.stats.min[c] << ", max " << result.stats.max[c]
+         << ", mean " << mean << ", stddev " << sqrt(variance) << endl;
+  }
+}
+
+// The histogram of every channel over the whole image as CSV, a row per bin
+bool write_histogram(const string &path, const HistogramResult &result,
+                     int channels) {
+  ofstream file(path);
+  file << "bin";
+  for (int c = 0; c < channels; c++) {
+    file << "," << channel_name(c, channels);
+  }
+  file << "\n";
+  long tiles = (long)result.counts.size() / channels / result.bins;
+  for (int b = 0; b < result.bins; b++) {
+    file << b;
+    for (int c = 0; c < channels; c++) {
+      long count = 0;
+      for (long t = 0; t < tiles; t++) {
+        count += result.counts[(t * channels + c) * result.bins + b];
+      }
+      file << "," << count;
+    }
+    file << "\n";
+  }
+  return (bool)file;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4 || argc > 6) {
+    cout << "Usage: " << argv[0]
+         << " <image_path> <stats|equalize|clahe> <with_sequential_flag> "
+            "[clip_limit] [tiles]"
+         << endl;
+    cout << "stats:    per channel histograms, min, max, mean and stddev"
+         << endl
+         << "equalize: histogram equalization of the luma, keeping the "
+            "chroma"
+         << endl
+         << "clahe:    contrast limited adaptive equalization of the luma on "
+            "a tiles x tiles grid, clip_limit "
+         << CLAHE_CLIP_LIMIT << " and " << CLAHE_TILES << " tiles by default"
+         << endl
+         << "equalize_channels, clahe_channels: equalize every color channel "
+            "on its own, which shifts the hues"
+         << endl;
+    return -1;
+  }
+
+  string image_path = argv[1];
+  HISTOGRAMOP op;
+  bool per_channel;
+  double clip_limit = CLAHE_CLIP_LIMIT;
+  int tiles = CLAHE_TILES;
+  try {
+    op = parseHistogramOp(argv[2], per_channel);
+    if (argc > 4) {
+      clip_limit = stod(argv[4]);
+    }
+    if (argc > 5) {
+      tiles = stoi(argv[5]);
+    }
+    if (tiles < 1) {
+      throw invalid_argument("Invalid tile count");
+    }
+  } catch (const invalid_argument &e) {
+    cout << "Error: " << e.what() << endl;
+    return -1;
+  }
+  const string with_sequential_flag = argv[3];
+  const string op_str = op == STATS       ? "stats"
+                        : op == EQUALIZE ? "equalized"
+                                         : "clahe";
+
+  MPI_Init(&argc, &argv);
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  NodeComms nodes(MPI_COMM_WORLD);
+
+  // Optional hardware counters of each phase, PERF_COUNTERS=1
+  PhaseCounters counters(
+      perfCountersEnabled(MPI_COMM_WORLD),
+      {"decode", "copy", "kernel", "barrier", "gather", "encode"});
+
+  // The result of an earlier equalization of the same image. A hit returns
+  // before the image is read, so its statistics are not printed. stats runs
+  // are never cached.
+  string operation =
+      "histogram " + op_str + (per_channel ? " channels" : " luma");
+  if (op == CLAHE) {
+    operation += " " + to_string(clip_limit) + " " + to_string(tiles);
+  }
+  ResultCache cache(image_path, operation);
+  auto restore = [&] {
+    return !cache.restore(string(std::getenv("PAR_OUTPUT_DIR")) +
+                          "/parallel_" + op_str + "_result")
+                .empty() &&
+           (with_sequential_flag != "true" ||
+            !cache.restore(string(std::getenv("SEQ_OUTPUT_DIR")) +
+                           "/sequential_" + op_str + "_result")
+                 .empty());
+  };
+  if (op != STATS && lookupResult(cache, MPI_COMM_WORLD, restore)) {
+    if (rank == 0) {
+      cout << "Statistics are not computed for a cached result, run stats "
+              "for them"
+           << endl;
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
+
+  Mat image;
+
+  if (rank == 0) {
+    counters.begin("decode");
+    image = readPixels(image_path);
+    counters.end();
+    if (image.empty()) {
+      cout << "Error: Could not read the image." << endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+      return -1;
+    }
+
+    // Do sequential version
+    if (with_sequential_flag == "true") {
+      // Copy into a pooled buffer rather than clone() a fresh allocation
+      PooledBuffer seqBuffer(image.total() * image.elemSize());
+      Mat seqImage(image.rows, image.cols, image.type(), seqBuffer.data());
+      image.copyTo(seqImage);
+      HistogramResult seqResult;
+      auto start = high_resolution_clock::now();
+      histogram_sequential(op, per_channel, seqImage, clip_limit, tiles,
+                           seqResult);
+      auto stop = high_resolution_clock::now();
+      cout << "Sequential time: "
+           << duration_cast<microseconds>(stop - start).count()
+           << " microseconds" << endl;
+      printRoofline(histogram_cost(op, image.rows, image.cols,
+                                   image.channels(), image.elemSize1()),
+                    duration<double>(stop - start).count());
+
+      const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
+      string seq_out_path =
+          op == STATS ? string(output_dir) + "/sequential_histogram.csv"
+                      : string(output_dir) + "/sequential_" + op_str +
+                            "_result" + resultExtension(image.type());
+      bool success = op == STATS
+                         ? write_histogram(seq_out_path, seqResult,
+                                           image.channels())
+                         : imwrite(seq_out_path, seqImage);
+      if (!success) {
+        cout << "Error: Could not write " << seq_out_path << endl;
+      }
+    }
+  }
+
+  HistogramResult result;
+  duration<double> elapsed = histogram_shared(
+      nodes, counters, image, op, per_channel, clip_limit, tiles, result,
+      [&](const Mat &equalized) {
+        const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+        string parallel_output = string(output_dir) + "/parallel_" + op_str +
+                                 "_result" +
+                                 resultExtension(equalized.type());
+        counters.begin("encode");
+        bool success = imwrite(parallel_output, equalized);
+        counters.end();
+        if (!success) {
+          cout << "Error: Could not write " << parallel_output << endl;
+        } else {
+          cache.store(parallel_output);
+        }
+      });
+
+  // Bandwidth ceiling of every rank streaming at the same time
+  double stream_gbps = 0;
+  if (rooflineProbeEnabled()) {
+    double rank_gbps = streamTriadBandwidth();
+    MPI_Reduce(&rank_gbps, &stream_gbps, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+  }
+
+  if (rank == 0) {
+    // The statistics are of the input, the histogram file of the input's
+    // bins over the whole image
+    print_stats(result, (long)image.rows * image.cols, image.channels());
+    if (op == STATS) {
+      string histogram_path =
+          string(std::getenv("PAR_OUTPUT_DIR")) + "/parallel_histogram.csv";
+      if (!write_histogram(histogram_path, result, image.channels())) {
+        cout << "Error: Could not write " << histogram_path << endl;
+      }
+    }
+    cout << "Parallel time: "
+         << duration_cast<microseconds>(elapsed).count() << " microseconds"
+         << endl;
+    printRoofline(histogram_cost(op, image.rows, image.cols, image.channels(),
+                                 image.elemSize1()),
+                  elapsed.count(), stream_gbps);
+    if (op != STATS) {
+      cache.report();
+    }
+  }
+  reportPhaseCounters(counters, MPI_COMM_WORLD);
+  reportBufferPoolStats(MPI_COMM_WORLD);
+  writeTraceMPI(MPI_COMM_WORLD);
+
+  nodes.free();
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,9 @@
+#!/bin/bash
+# Strong scalability test on data/input.jpg. Timings (median/p95 over repeated
+# runs) are merged into output/benchmark/results.csv, extra flags such as
+# --repetitions are passed through to benchmark.py
+cd "$(dirname "$0")"
+
+echo "Start strong scalability test on histogram"
+python3 ../benchmark.py strong --kernels histogram_stats histogram_equalize histogram_clahe --workers 1-10 "$@"
+echo "Finished strong scalability test on histogram"
@@ -0,0 +1,27 @@
+#!/bin/bash
+# Huge page sensitivity of the kernels that stride across large images. Every
+# kernel is run with HUGE_PAGES=0 (4 KB pages only) and HUGE_PAGES=1 (shared
+# windows and pooled buffers advised for 2 MB transparent huge pages), with
+# PERF_COUNTERS=1 so the MPI kernels also report the dTLB misses of their
+# kernel phase. Each setting is written to output/benchmark/hugepages/<off|on>,
+# extra flags such as --workers are passed through to benchmark.py.
+# The shared windows only get huge pages when
+# /sys/kernel/mm/transparent_hugepage/shmem_enabled is advise or always.
+cd "$(dirname "$0")"
+PROJECT_ROOT="$(cd .. && pwd)"
+OUTPUT_DIR="$PROJECT_ROOT/output/benchmark/hugepages"
+mkdir -p "$OUTPUT_DIR"
+
+KERNELS="color_transformation flip_horizontal flip_vertical rotation fft_openmp fft_mpi gaussian_blur_openmp"
+THP_DIR=/sys/kernel/mm/transparent_hugepage
+echo "THP enabled: $(cat $THP_DIR/enabled 2>/dev/null)"
+echo "THP shmem_enabled: $(cat $THP_DIR/shmem_enabled 2>/dev/null)"
+
+declare -A MODES=([off]=0 [on]=1)
+for mode in off on; do
+  echo "Start huge page benchmark: $mode"
+  HUGE_PAGES=${MODES[$mode]} PERF_COUNTERS=1 python3 benchmark.py strong \
+    --kernels $KERNELS --workers 1-10 \
+    --output "$OUTPUT_DIR/$mode" "$@"
+done
+echo "Finished huge page benchmark, results in $OUTPUT_DIR"
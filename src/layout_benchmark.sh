@@ -0,0 +1,21 @@
+#!/bin/bash
+# Gain of the planar pixel layout in the blur kernels. Both are run on the
+# scaled image set with PIXEL_LAYOUT=interleaved (filtering the pixels as
+# OpenCV stores them) and PIXEL_LAYOUT=planar (one plane per channel,
+# including the conversion to it and back). Each setting is written to
+# output/benchmark/layout/<interleaved|planar>, extra flags such as --workers
+# are passed through to benchmark.py.
+cd "$(dirname "$0")"
+PROJECT_ROOT="$(cd .. && pwd)"
+OUTPUT_DIR="$PROJECT_ROOT/output/benchmark/layout"
+mkdir -p "$OUTPUT_DIR"
+
+KERNELS="gaussian_blur_sequential gaussian_blur_openmp"
+
+for layout in interleaved planar; do
+  echo "Start layout benchmark: $layout"
+  PIXEL_LAYOUT=$layout python3 benchmark.py weak \
+    --kernels $KERNELS --workers 1-10 \
+    --output "$OUTPUT_DIR/$layout" "$@"
+done
+echo "Finished layout benchmark, results in $OUTPUT_DIR"
@@ -0,0 +1,32 @@
+#!/bin/bash
+# NUMA sensitivity of the shared-window MPI tools. Every kernel is run with
+# the image placed on rank 0's NUMA node (the old layout) and with each rank's
+# rows on its own node, under three rank bindings:
+#   none:   the OS may migrate ranks away from their pages
+#   packed: consecutive ranks fill one socket before the next
+#   spread: ranks alternate between NUMA nodes
+# Each combination is written to output/benchmark/numa/<placement>_<binding>,
+# extra flags such as --workers are passed through to benchmark.py.
+# The binding flags are Open MPI's.
+cd "$(dirname "$0")"
+PROJECT_ROOT="$(cd .. && pwd)"
+OUTPUT_DIR="$PROJECT_ROOT/output/benchmark/numa"
+mkdir -p "$OUTPUT_DIR"
+
+KERNELS="color_transformation flip_horizontal flip_vertical rotation"
+declare -A BINDINGS=(
+  [none]="--bind-to none"
+  [packed]="--map-by core --bind-to core"
+  [spread]="--map-by numa --bind-to core"
+)
+
+for placement in root local; do
+  for binding in none packed spread; do
+    echo "Start NUMA benchmark: placement=$placement binding=$binding"
+    SHARED_WINDOW_PLACEMENT=$placement python3 benchmark.py strong \
+      --kernels $KERNELS --workers 1-10 \
+      --mpirun-args "${BINDINGS[$binding]}" \
+      --output "$OUTPUT_DIR/${placement}_${binding}" "$@"
+  done
+done
+echo "Finished NUMA benchmark, results in $OUTPUT_DIR"
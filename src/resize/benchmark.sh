@@ -0,0 +1,20 @@
+#!/bin/bash
+
+export PROJECT_ROOT="$(cd "$(dirname "$0")/../.." && pwd)"
+export SEQ_OUTPUT_DIR="$PROJECT_ROOT/output/sequential"
+export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/parallel"
+mkdir -p "$SEQ_OUTPUT_DIR" "$PAR_OUTPUT_DIR"
+
+echo "Start resize to half size"
+export OMP_NUM_THREADS=10
+for mode in area bilinear lanczos; do
+  ./parallel_omp "$PROJECT_ROOT/data/input.jpg" resize 0.5 $mode
+  ./parallel_omp "$PROJECT_ROOT/data/input.jpg" resize 0.5 $mode opencv
+  mpirun --bind-to core --map-by numa -np 8 ./parallel_resize "$PROJECT_ROOT/data/input.jpg" resize 0.5 $mode
+done
+echo "Finished resize to half size"
+echo "Start image pyramids"
+./parallel_omp "$PROJECT_ROOT/data/input.jpg" pyramid 4 gaussian
+./parallel_omp "$PROJECT_ROOT/data/input.jpg" pyramid 4 gaussian opencv
+mpirun --bind-to core --map-by numa -np 8 ./parallel_resize "$PROJECT_ROOT/data/input.jpg" pyramid 4 laplacian
+echo "Finished image pyramids"
@@ -0,0 +1,7 @@
+#!/bin/bash
+rm -rf build
+mkdir build && cd build
+cmake ..
+make
+mv parallel_omp ..
+mv parallel_resize ..
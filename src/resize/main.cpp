@@ -0,0 +1,364 @@
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mpi.h>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "../common/buffer_pool_mpi.hpp"
+#include "../common/node_comm.hpp"
+#include "../common/perf_counters_mpi.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/result_cache_mpi.hpp"
+#include "../common/roofline.hpp"
+#include "../common/shared_window.hpp"
+#include "../common/trace_mpi.hpp"
+#include "resample.hpp"
+
+using namespace cv;
+using namespace std;
+using namespace std::chrono;
+
+// The root sends every node leader the bytes node_bands[n] of the input, the
+// band of input rows its block of output rows is resampled from. The bands
+// of neighbouring nodes overlap by the filter's support, which MPI_Scatterv
+// does not allow, so each is sent on its own. Collective over the leaders, a
+// no-op on the other ranks.
+void send_row_bands(const NodeComms &nodes, const uchar *input_data,
+                    const vector<WorkRange> &node_bands, uchar *band_data,
+                    long band_bytes) {
+  if (!nodes.isLeader()) {
+    return;
+  }
+  int leader_rank;
+  MPI_Comm_rank(nodes.leaders, &leader_rank);
+  if (leader_rank != 0) {
+    MPI_Recv(band_data, (int)band_bytes, MPI_BYTE, 0, 0, nodes.leaders,
+             MPI_STATUS_IGNORE);
+    return;
+  }
+  for (int n = 1; n < nodes.num_nodes; n++) {
+    MPI_Send(input_data + node_bands[n].begin,
+             (int)(node_bands[n].end - node_bands[n].begin), MPI_BYTE, n, 0,
+             nodes.leaders);
+  }
+  memcpy(band_data, input_data + node_bands[0].begin, band_bytes);
+}
+
+// Resample rank 0's input in the node-shared windows with the filters
+// filters_for returns for its size, and hand the result to save on rank 0
+// before the windows are released. Returns the kernel time. Collective over
+// MPI_COMM_WORLD.
+duration<double>
+resize_shared(const NodeComms &nodes, PhaseCounters &counters,
+              const Mat &input,
+              const function<ResampleFilters(Size)> &filters_for,
+              const function<void(const Mat &)> &save) {
+  int rank, num_processes;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+
+  int in_dims[3] = {input.rows, input.cols, input.type()};
+  // Make sure everyone has the dims and pixel type
+  MPI_Bcast(in_dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  int in_rows = in_dims[0];
+  int in_cols = in_dims[1];
+  int type = in_dims[2];
+  int pixel_bytes = CV_ELEM_SIZE(type);
+  ResampleFilters filters = filters_for(Size(in_cols, in_rows));
+  Size out_size = filters.outputSize();
+
+  // The output rows are split into one balanced, page aligned part per rank
+  // and each node holds the block of its ranks' parts, along with the band of
+  // input rows the block is resampled from. Each rank's part of either window
+  // is placed on its own NUMA node.
+  long in_row_bytes = (long)in_cols * pixel_bytes;
+  long out_row_bytes = (long)out_size.width * pixel_bytes;
+  Partition partition(out_size.height, out_row_bytes, num_processes);
+  WorkRange slab = nodes.slab(partition);
+  long slab_rows = slab.end - slab.begin;
+  long slab_bytes = slab_rows * out_row_bytes;
+  WorkRange band = filters.vertical.sources(slab.begin, slab.end);
+  long band_rows = band.end - band.begin;
+  long band_bytes = band_rows * in_row_bytes;
+  Partition node_partition(slab_rows, out_row_bytes, nodes.node_size);
+  WorkRange part = node_partition.part(nodes.node_rank);
+  WorkRange in_part =
+      Partition(band_rows, in_row_bytes, nodes.node_size).part(nodes.node_rank);
+  SharedImageWindow in_window(
+      nodes.node, band_bytes,
+      {{in_part.begin * in_row_bytes, in_part.end * in_row_bytes}});
+  SharedImageWindow out_window(
+      nodes.node, slab_bytes,
+      {{part.begin * out_row_bytes, part.end * out_row_bytes}});
+  uchar *sharedInData = in_window.data();
+  uchar *sharedOutData = out_window.data();
+  SharedChunkCounter next_chunk(nodes.node);
+  NodeBarrier node_barrier(nodes.node);
+
+  // Input bands and output bytes of every node, known to the leaders
+  vector<WorkRange> node_bands, node_output_bytes;
+  if (nodes.isLeader()) {
+    for (const WorkRange &node_slab : nodes.nodeSlabs(partition)) {
+      WorkRange node_band =
+          filters.vertical.sources(node_slab.begin, node_slab.end);
+      node_bands.push_back(
+          {node_band.begin * in_row_bytes, node_band.end * in_row_bytes});
+      node_output_bytes.push_back(
+          {node_slab.begin * out_row_bytes, node_slab.end * out_row_bytes});
+    }
+  }
+
+  // Root sends the row bands to the node leaders' shared memory, on a single
+  // node the band is the whole input, which is copied as one block
+  if (nodes.isLeader()) {
+    counters.begin("copy");
+    send_row_bands(nodes, input.data, node_bands, sharedInData, band_bytes);
+    counters.end();
+  }
+
+  // Ensure all processes see the initial data
+  node_barrier.wait({&in_window, &out_window});
+
+  // Start parallel timing
+  auto start_par = high_resolution_clock::now();
+
+  // Resample the node's block of output rows from its band
+  counters.begin("kernel");
+  dispatchPixelType(type, [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    runPartition(node_partition, nodes.node_rank, next_chunk.get(),
+                 [&](long begin, long end) {
+                   resampleRows<T, CN>(
+                       reinterpret_cast<const T *>(sharedInData), band.begin,
+                       in_cols, reinterpret_cast<T *>(sharedOutData),
+                       slab.begin, CV_MAT_CN(type), filters,
+                       slab.begin + begin, slab.begin + end);
+                 });
+  });
+  counters.end();
+
+  counters.begin("barrier");
+  node_barrier.wait({&in_window, &out_window});
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    MPI_Barrier(nodes.leaders);
+  }
+  counters.end();
+  auto stop_par = high_resolution_clock::now();
+
+  // Root gathers the output blocks of the other nodes, on a single node the
+  // shared block is the whole output
+  Mat output;
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    if (rank == 0) {
+      output.create(out_size, type);
+    }
+    counters.begin("gather");
+    gatherSlabs(nodes, sharedOutData, slab_bytes, node_output_bytes,
+                output.data);
+    counters.end();
+  }
+
+  if (rank == 0) {
+    save(nodes.num_nodes > 1 ? output
+                             : Mat(out_size.height, out_size.width, type,
+                                   sharedOutData));
+  }
+
+  node_barrier.free();
+  next_chunk.free();
+  in_window.free();
+  out_window.free();
+  return stop_par - start_par;
+}
+
+// Gaussian pyramid levels 0 to levels of rank 0's input into pyramid on rank
+// 0, each level resampled in the shared windows from the one before and
+// copied out. A Laplacian pyramid then upsamples every level but the first
+// the same way, in float, and replaces the levels but the last by their
+// difference to it. Returns the kernel time. Collective over MPI_COMM_WORLD.
+duration<double> pyramid_shared(const NodeComms &nodes,
+                                PhaseCounters &counters, const Mat &input,
+                                int levels, bool laplacian,
+                                vector<Mat> &pyramid) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  // Every rank follows the level sizes, the targets of the upsampling
+  int in_size[2] = {input.cols, input.rows};
+  MPI_Bcast(in_size, 2, MPI_INT, 0, MPI_COMM_WORLD);
+  vector<Size> sizes = pyramidSizes(Size(in_size[0], in_size[1]), levels);
+
+  duration<double> elapsed(0);
+  pyramid.assign(1, input);
+  for (int k = 0; k < levels; k++) {
+    elapsed += resize_shared(
+        nodes, counters, rank == 0 ? pyramid.back() : Mat(), pyramidFilters,
+        [&](const Mat &level) { pyramid.push_back(level.clone()); });
+  }
+  if (!laplacian) {
+    return elapsed;
+  }
+
+  for (int k = 0; k < levels; k++) {
+    Mat next;
+    if (rank == 0) {
+      pyramid[k + 1].convertTo(next, CV_32F);
+    }
+    elapsed += resize_shared(
+        nodes, counters, next,
+        [&](Size size) { return resizeFilters(BILINEAR, size, sizes[k]); },
+        [&](const Mat &upsampled) {
+          auto start = high_resolution_clock::now();
+          pyramid[k] = laplacianLevel(pyramid[k], upsampled);
+          elapsed += high_resolution_clock::now() - start;
+        });
+  }
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 5) {
+    cout << "Usage: " << argv[0]
+         << " <image_path> resize <scale|WxH> <area|bilinear|lanczos>" << endl;
+    cout << "       " << argv[0]
+         << " <image_path> pyramid <levels> <gaussian|laplacian>" << endl;
+    return -1;
+  }
+
+  const string operation = argv[2];
+  ResizeMode mode = AREA;
+  int levels = 0;
+  bool laplacian = false;
+  try {
+    if (operation == "resize") {
+      parseOutputSize(argv[3], Size(1, 1));
+      mode = parseResizeMode(argv[4]);
+    } else if (operation == "pyramid") {
+      levels = stoi(argv[3]);
+      laplacian = string(argv[4]) == "laplacian";
+      if (levels < 1 || (!laplacian && string(argv[4]) != "gaussian")) {
+        throw invalid_argument("Invalid pyramid. Use a level count of at "
+                               "least 1 and 'gaussian' or 'laplacian'");
+      }
+    } else {
+      throw invalid_argument("Invalid operation. Use 'resize' or 'pyramid'");
+    }
+  } catch (const invalid_argument &e) {
+    cout << "Error: " << e.what() << endl;
+    return -1;
+  }
+
+  MPI_Init(&argc, &argv);
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // Create node and node leader communicators
+  NodeComms nodes(MPI_COMM_WORLD);
+
+  // Optional hardware counters of each phase, PERF_COUNTERS=1
+  PhaseCounters counters(
+      perfCountersEnabled(MPI_COMM_WORLD),
+      {"decode", "copy", "kernel", "barrier", "gather", "encode"});
+
+  // The result of an earlier run of the same resize on the same image
+  const string output_dir = std::getenv("PAR_OUTPUT_DIR");
+  const string resize_stem = output_dir + "/parallel_resize_" +
+                             resizeModeName(mode) + "_result";
+  ResultCache cache(argv[1], string("resize_mpi ") + argv[3] + " " +
+                                 resizeModeName(mode));
+  if (operation == "resize" &&
+      lookupResult(cache, MPI_COMM_WORLD,
+                   [&] { return !cache.restore(resize_stem).empty(); })) {
+    if (rank == 0) {
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
+
+  Mat input;
+  if (rank == 0) {
+    // Read image
+    counters.begin("decode");
+    input = readPixels(argv[1]);
+    counters.end();
+    if (input.empty()) {
+      cout << "Error: Could not read the image." << endl;
+      MPI_Abort(MPI_COMM_WORLD, 1);
+      return -1;
+    }
+  }
+
+  duration<double> elapsed;
+  if (operation == "resize") {
+    // The output size of a scale factor depends on the input size, which
+    // every rank learns in resize_shared
+    elapsed = resize_shared(
+        nodes, counters, input,
+        [&](Size size) {
+          return resizeFilters(mode, size, parseOutputSize(argv[3], size));
+        },
+        [&](const Mat &result) {
+          string outputPath = resize_stem + resultExtension(result.type());
+          counters.begin("encode");
+          bool success = cv::imwrite(outputPath, result);
+          counters.end();
+          if (success) {
+            cache.store(outputPath);
+          }
+        });
+  } else {
+    vector<Mat> pyramid;
+    elapsed = pyramid_shared(nodes, counters, input, levels, laplacian,
+                             pyramid);
+    if (rank == 0) {
+      // Level 0 of a Gaussian pyramid is the image itself
+      counters.begin("encode");
+      string stem = output_dir + "/parallel_pyramid_" + argv[4] + "_";
+      for (int k = laplacian ? 0 : 1; k <= levels; k++) {
+        cv::imwrite(stem + to_string(k) + resultExtension(pyramid[k].type()),
+                    pyramid[k]);
+      }
+      counters.end();
+    }
+  }
+
+  // Bandwidth ceiling of every rank streaming at the same time
+  double stream_gbps = 0;
+  if (rooflineProbeEnabled()) {
+    double rank_gbps = streamTriadBandwidth();
+    MPI_Reduce(&rank_gbps, &stream_gbps, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+  }
+
+  if (rank == 0) {
+    cout << "Parallel time: "
+         << duration_cast<microseconds>(elapsed).count() << " microseconds"
+         << endl;
+    KernelCost cost;
+    if (operation == "resize") {
+      Size size = parseOutputSize(argv[3], input.size());
+      cost = resampleCost(input.size(), resizeFilters(mode, input.size(), size),
+                          input.channels(), input.elemSize1());
+    } else {
+      cost = pyramidCost(input.size(), levels, laplacian, input.channels(),
+                         input.elemSize1());
+    }
+    printRoofline(cost, elapsed.count(), stream_gbps);
+    if (operation == "resize") {
+      cache.report();
+    }
+  }
+  reportPhaseCounters(counters, MPI_COMM_WORLD);
+  reportBufferPoolStats(MPI_COMM_WORLD);
+  writeTraceMPI(MPI_COMM_WORLD);
+
+  nodes.free();
+  MPI_Finalize();
+  return 0;
+}
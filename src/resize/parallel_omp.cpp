@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <omp.h>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "../common/pixel_types.hpp"
+#include "../common/result_cache.hpp"
+#include "../common/roofline.hpp"
+#include "../common/trace.hpp"
+#include "resample.hpp"
+
+// The image resampled by filters, blocks of output rows shared out over the
+// threads
+cv::Mat resampleImage(const cv::Mat &image, const ResampleFilters &filters) {
+  cv::Mat output(filters.outputSize(), image.type());
+  dispatchPixelType(image.type(), [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    const long rows = output.rows;
+#pragma omp parallel
+    {
+      TraceScope scope("resample");
+#pragma omp for schedule(dynamic)
+      for (long block = 0; block < rows; block += RESAMPLE_BLOCK_ROWS) {
+        resampleRows<T, CN>(image.ptr<T>(), 0, image.cols, output.ptr<T>(), 0,
+                            image.channels(), filters, block,
+                            std::min(rows, block + RESAMPLE_BLOCK_ROWS));
+      }
+    }
+  });
+  return output;
+}
+
+// Gaussian levels 0 to levels, level 0 being the image. Each level is
+// blurred and decimated from the one before in a single pass.
+std::vector<cv::Mat> gaussianPyramid(const cv::Mat &image, int levels) {
+  std::vector<cv::Mat> pyramid{image};
+  for (int k = 0; k < levels; k++) {
+    pyramid.push_back(
+        resampleImage(pyramid.back(), pyramidFilters(pyramid.back().size())));
+  }
+  return pyramid;
+}
+
+// Laplacian levels of a Gaussian pyramid, then its coarsest level
+std::vector<cv::Mat> laplacianPyramid(const std::vector<cv::Mat> &gaussian) {
+  std::vector<cv::Mat> pyramid;
+  for (size_t k = 0; k + 1 < gaussian.size(); k++) {
+    cv::Mat next;
+    gaussian[k + 1].convertTo(next, CV_32F);
+    cv::Mat upsampled = resampleImage(
+        next, resizeFilters(BILINEAR, next.size(), gaussian[k].size()));
+    pyramid.push_back(laplacianLevel(gaussian[k], upsampled));
+  }
+  pyramid.push_back(gaussian.back());
+  return pyramid;
+}
+
+// The same pyramids from cv::pyrDown and cv::pyrUp
+std::vector<cv::Mat> openCVPyramid(const cv::Mat &image, int levels,
+                                   bool laplacian) {
+  std::vector<cv::Mat> gaussian{image};
+  for (int k = 0; k < levels; k++) {
+    cv::Mat next;
+    cv::pyrDown(gaussian.back(), next);
+    gaussian.push_back(next);
+  }
+  if (!laplacian) {
+    return gaussian;
+  }
+  std::vector<cv::Mat> pyramid;
+  for (int k = 0; k < levels; k++) {
+    cv::Mat next, upsampled;
+    gaussian[k + 1].convertTo(next, CV_32F);
+    cv::pyrUp(next, upsampled, gaussian[k].size());
+    pyramid.push_back(laplacianLevel(gaussian[k], upsampled));
+  }
+  pyramid.push_back(gaussian.back());
+  return pyramid;
+}
+
+// Largest difference between the values of two images of the same size and
+// channels
+double maxDifference(const cv::Mat &a, const cv::Mat &b) {
+  cv::Mat fa, fb;
+  a.convertTo(fa, CV_32F);
+  b.convertTo(fb, CV_32F);
+  long values = (long)fa.total() * fa.channels();
+  const float *va = fa.ptr<float>();
+  const float *vb = fb.ptr<float>();
+  double difference = 0;
+  for (long v = 0; v < values; v++) {
+    difference = std::max(difference, (double)std::fabs(va[v] - vb[v]));
+  }
+  return difference;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 5 && argc != 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " <image_path> resize <scale|WxH> <area|bilinear|lanczos> "
+                 "[opencv]"
+              << std::endl
+              << "       " << argv[0]
+              << " <image_path> pyramid <levels> <gaussian|laplacian> [opencv]"
+              << std::endl
+              << "opencv times cv::resize or cv::pyrDown instead and prints "
+                 "its largest difference to this engine"
+              << std::endl;
+    return -1;
+  }
+
+  const std::string operation = argv[2];
+  const bool opencv = argc == 6 && std::string(argv[5]) == "opencv";
+  ResizeMode mode = AREA;
+  int levels = 0;
+  bool laplacian = false;
+  try {
+    if (operation == "resize") {
+      parseOutputSize(argv[3], cv::Size(1, 1));
+      mode = parseResizeMode(argv[4]);
+    } else if (operation == "pyramid") {
+      levels = std::stoi(argv[3]);
+      laplacian = std::string(argv[4]) == "laplacian";
+      if (levels < 1 || (!laplacian && std::string(argv[4]) != "gaussian")) {
+        throw std::invalid_argument(
+            "Invalid pyramid. Use a level count of at least 1 and 'gaussian' "
+            "or 'laplacian'");
+      }
+    } else {
+      throw std::invalid_argument(
+          "Invalid operation. Use 'resize' or 'pyramid'");
+    }
+  } catch (const std::invalid_argument &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return -1;
+  }
+  const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+  const std::string prefix = opencv ? "/opencv_" : "/parallel_";
+
+  // The result of an earlier run of the same resize on the same image
+  ResultCache cache(argv[1], std::string(opencv ? "resize_opencv "
+                                                : "resize_openmp ") +
+                                 argv[3] + " " + resizeModeName(mode));
+  const std::string resize_stem = std::string(output_dir) + prefix +
+                                  "resize_" + resizeModeName(mode) + "_result";
+  if (operation == "resize" && cache.lookup() &&
+      !cache.restore(resize_stem).empty()) {
+    cache.report();
+    return 0;
+  }
+
+  TraceScope decode("decode", "io");
+  cv::Mat image = readPixels(argv[1]);
+  if (image.empty()) {
+    std::cerr << "Error: Could not read image " << argv[1] << std::endl;
+    return -1;
+  }
+  decode.end();
+  // cv::resize and cv::pyrDown on as many threads as the engine
+  cv::setNumThreads(omp_get_max_threads());
+
+  KernelCost cost;
+  double start, end;
+  if (operation == "resize") {
+    cv::Size size = parseOutputSize(argv[3], image.size());
+    ResampleFilters filters = resizeFilters(mode, image.size(), size);
+    cost = resampleCost(image.size(), filters, image.channels(),
+                        image.elemSize1());
+    cv::Mat result;
+    start = omp_get_wtime();
+    if (opencv) {
+      cv::resize(image, result, size, 0, 0, openCVInterpolation(mode));
+    } else {
+      result = resampleImage(image, filters);
+    }
+    end = omp_get_wtime();
+
+    TraceScope encode("encode", "io");
+    std::string outputPath = resize_stem + resultExtension(result.type());
+    if (cv::imwrite(outputPath, result)) {
+      cache.store(outputPath);
+    }
+    encode.end();
+    if (opencv) {
+      std::cout << "Max difference to the resize engine: "
+                << maxDifference(result, resampleImage(image, filters))
+                << std::endl;
+    }
+  } else {
+    cost = pyramidCost(image.size(), levels, laplacian, image.channels(),
+                       image.elemSize1());
+    std::vector<cv::Mat> pyramid;
+    start = omp_get_wtime();
+    if (opencv) {
+      pyramid = openCVPyramid(image, levels, laplacian);
+    } else {
+      pyramid = gaussianPyramid(image, levels);
+      if (laplacian) {
+        pyramid = laplacianPyramid(pyramid);
+      }
+    }
+    end = omp_get_wtime();
+
+    // Level 0 of a Gaussian pyramid is the image itself
+    TraceScope encode("encode", "io");
+    std::string stem = std::string(output_dir) + prefix + "pyramid_" +
+                       argv[4] + "_";
+    for (size_t k = laplacian ? 0 : 1; k < pyramid.size(); k++) {
+      cv::imwrite(stem + std::to_string(k) + resultExtension(pyramid[k].type()),
+                  pyramid[k]);
+    }
+    encode.end();
+    if (opencv) {
+      std::vector<cv::Mat> engine = gaussianPyramid(image, levels);
+      if (laplacian) {
+        engine = laplacianPyramid(engine);
+      }
+      double difference = 0;
+      for (size_t k = 0; k < pyramid.size(); k++) {
+        difference = std::max(difference, maxDifference(pyramid[k], engine[k]));
+      }
+      std::cout << "Max difference to the resize engine: " << difference
+                << std::endl;
+    }
+  }
+
+  std::cout << "Parallel time with " << omp_get_max_threads()
+            << " threads: " << (end - start) * 1000 << " milliseconds"
+            << std::endl;
+  printRoofline(cost, end - start,
+                rooflineProbeEnabled() ? streamTriadBandwidth() : 0);
+  if (operation == "resize") {
+    cache.report();
+  }
+  writeTrace("parallel_omp resize");
+
+  return 0;
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../common/buffer_pool.hpp"
+#include "../common/gaussian_kernel.hpp"
+#include "../common/partition.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/roofline.hpp"
+
+// Separable resampling engine of the resize tools. Each axis has a filter
+// table: for every output index the source indices it reads, clamped to the
+// image like the Gaussian blur's border, and their weights. A block of output
+// rows first resamples the source rows it needs along the row into a float
+// buffer, then sums those rows into each output row, a tap at a time along
+// the whole row, and rounds to the pixel type. The same engine runs the
+// resize modes and the Gaussian pyramid, whose filter evaluates the blur only
+// at the even pixels that survive decimation.
+
+enum ResizeMode { AREA = 0, BILINEAR = 1, LANCZOS = 2 };
+
+inline ResizeMode parseResizeMode(const std::string &mode) {
+  if (mode == "area" || mode == "box") {
+    return AREA;
+  } else if (mode == "bilinear" || mode == "linear") {
+    return BILINEAR;
+  } else if (mode == "lanczos") {
+    return LANCZOS;
+  } else {
+    throw std::invalid_argument(
+        "Invalid resize mode. Use 'area', 'bilinear' or 'lanczos'");
+  }
+}
+
+inline const char *resizeModeName(ResizeMode mode) {
+  const char *names[] = {"area", "bilinear", "lanczos"};
+  return names[mode];
+}
+
+// The cv::resize interpolation closest to each mode, for the comparison
+inline int openCVInterpolation(ResizeMode mode) {
+  const int interpolations[] = {cv::INTER_AREA, cv::INTER_LINEAR,
+                                cv::INTER_LANCZOS4};
+  return interpolations[mode];
+}
+
+// Pyramid kernel, 5 taps close to the [1 4 6 4 1] / 16 of cv::pyrDown
+constexpr int PYRAMID_RADIUS = 2;
+constexpr float PYRAMID_SIGMA = 1.0f;
+
+// Output rows per block of the engine: enough that the source rows shared
+// with the next block are a small part of the work, few enough that the
+// resampled source rows stay in cache
+constexpr int RESAMPLE_BLOCK_ROWS = 32;
+
+// Weights of one axis, taps per output index. Outputs with fewer taps are
+// padded with zero weights.
+struct AxisFilter {
+  int taps = 0;
+  std::vector<int> index;     // source index of each tap, in the image
+  std::vector<float> weights; // of each tap, summing to 1 per output
+
+  int size() const { return taps > 0 ? (int)(index.size() / taps) : 0; }
+
+  // Source indices read by outputs [begin, end)
+  WorkRange sources(long begin, long end) const {
+    if (begin >= end) {
+      return {0, 0};
+    }
+    auto first = index.begin() + begin * taps;
+    auto last = index.begin() + end * taps;
+    return {*std::min_element(first, last), *std::max_element(first, last) + 1};
+  }
+};
+
+// The filter from lists of (unclamped source index, weight) per output
+inline AxisFilter
+makeAxisFilter(const std::vector<std::vector<std::pair<int, float>>> &outputs,
+               int in_size) {
+  AxisFilter filter;
+  for (const auto &contributions : outputs) {
+    filter.taps = std::max(filter.taps, (int)contributions.size());
+  }
+  for (const auto &contributions : outputs) {
+    float sum = 0;
+    for (const auto &contribution : contributions) {
+      sum += contribution.second;
+    }
+    int last = 0;
+    for (const auto &[source, weight] : contributions) {
+      last = std::min(std::max(source, 0), in_size - 1);
+      filter.index.push_back(last);
+      filter.weights.push_back(sum != 0 ? weight / sum : 0);
+    }
+    for (int t = (int)contributions.size(); t < filter.taps; t++) {
+      filter.index.push_back(last);
+      filter.weights.push_back(0);
+    }
+  }
+  return filter;
+}
+
+inline float lanczos3(float x) {
+  x = std::fabs(x);
+  if (x < 1e-6f) {
+    return 1;
+  }
+  if (x >= 3) {
+    return 0;
+  }
+  const float pi = 3.14159265358979f;
+  return 3 * std::sin(pi * x) * std::sin(pi * x / 3) / (pi * pi * x * x);
+}
+
+// Filter resizing in_size pixels to out_size. Pixel centers are aligned like
+// cv::resize does. Area averages the source pixels each output pixel covers,
+// weighted by the overlap. Bilinear interpolates the two nearest source
+// pixels. Lanczos uses a 3-lobe window, stretched by the scale when
+// shrinking so it also filters out what the smaller image cannot hold.
+inline AxisFilter resizeFilter(ResizeMode mode, int in_size, int out_size) {
+  double scale = (double)in_size / out_size;
+  std::vector<std::vector<std::pair<int, float>>> outputs(out_size);
+  for (int i = 0; i < out_size; i++) {
+    auto &contributions = outputs[i];
+    if (mode == AREA) {
+      double begin = i * scale, end = (i + 1) * scale;
+      for (int s = (int)std::floor(begin); s < end; s++) {
+        double overlap = std::min(end, s + 1.0) - std::max(begin, (double)s);
+        if (overlap > 1e-9) {
+          contributions.push_back({s, (float)overlap});
+        }
+      }
+    } else if (mode == BILINEAR) {
+      double center = (i + 0.5) * scale - 0.5;
+      int s = (int)std::floor(center);
+      float fraction = (float)(center - s);
+      contributions.push_back({s, 1 - fraction});
+      contributions.push_back({s + 1, fraction});
+    } else { // LANCZOS
+      double stretch = std::max(scale, 1.0);
+      double center = (i + 0.5) * scale;
+      int first = (int)std::floor(center - 3 * stretch);
+      int last = (int)std::ceil(center + 3 * stretch);
+      for (int s = first; s < last; s++) {
+        float weight = lanczos3((float)((s + 0.5 - center) / stretch));
+        if (weight != 0) {
+          contributions.push_back({s, weight});
+        }
+      }
+    }
+  }
+  return makeAxisFilter(outputs, in_size);
+}
+
+// One Gaussian pyramid level down, (in_size + 1) / 2 outputs like
+// cv::pyrDown: output i is the Gaussian blur of createGaussianKernel at
+// source pixel 2 i, clamped at the border like the blur tools. The blur and
+// the decimation are one pass, and the pixels decimation drops are never
+// blurred.
+inline AxisFilter pyramidFilter(int in_size) {
+  std::vector<float> kernel =
+      createGaussianKernel(PYRAMID_RADIUS, PYRAMID_SIGMA);
+  std::vector<std::vector<std::pair<int, float>>> outputs((in_size + 1) / 2);
+  for (int i = 0; i < (int)outputs.size(); i++) {
+    for (int k = -PYRAMID_RADIUS; k <= PYRAMID_RADIUS; k++) {
+      outputs[i].push_back({2 * i + k, kernel[k + PYRAMID_RADIUS]});
+    }
+  }
+  return makeAxisFilter(outputs, in_size);
+}
+
+struct ResampleFilters {
+  AxisFilter horizontal;
+  AxisFilter vertical;
+
+  cv::Size outputSize() const {
+    return cv::Size(horizontal.size(), vertical.size());
+  }
+};
+
+inline ResampleFilters resizeFilters(ResizeMode mode, cv::Size input,
+                                     cv::Size output) {
+  return {resizeFilter(mode, input.width, output.width),
+          resizeFilter(mode, input.height, output.height)};
+}
+
+inline ResampleFilters pyramidFilters(cv::Size input) {
+  return {pyramidFilter(input.width), pyramidFilter(input.height)};
+}
+
+// The output size of "<width>x<height>" or of a scale factor such as "0.25",
+// at least a pixel either way. Throws std::invalid_argument for anything
+// else, whatever the input size.
+inline cv::Size parseOutputSize(const std::string &text, cv::Size input) {
+  size_t x = text.find('x');
+  cv::Size size;
+  if (x != std::string::npos) {
+    size = cv::Size(std::stoi(text.substr(0, x)),
+                    std::stoi(text.substr(x + 1)));
+  } else {
+    double scale = std::stod(text);
+    if (!(scale > 0)) {
+      throw std::invalid_argument("Invalid scale factor " + text);
+    }
+    size = cv::Size(std::max(1, (int)std::lround(input.width * scale)),
+                    std::max(1, (int)std::lround(input.height * scale)));
+  }
+  if (size.width < 1 || size.height < 1) {
+    throw std::invalid_argument("Invalid output size " + text);
+  }
+  return size;
+}
+
+// Sizes of the Gaussian pyramid levels 0 to levels, level 0 being the input
+inline std::vector<cv::Size> pyramidSizes(cv::Size input, int levels) {
+  std::vector<cv::Size> sizes{input};
+  for (int k = 0; k < levels; k++) {
+    sizes.push_back(pyramidFilters(sizes.back()).outputSize());
+  }
+  return sizes;
+}
+
+// Output rows [begin, end) of the resample of an image in_cols wide. input
+// holds the source rows from in_first on and output the output rows from
+// out_first on, so a rank can work on the rows of its slab. The float buffers
+// come from the buffer pool, since the threads call this once per block.
+template <typename T, int CN>
+void resampleRows(const T *input, long in_first, int in_cols, T *output,
+                  long out_first, int channels,
+                  const ResampleFilters &filters, long begin, long end) {
+  const int cn = channelCount<CN>(channels);
+  // Supported images have at most 4 channels
+  constexpr int maxChannels = CN != ANY_CHANNELS ? CN : 4;
+  const AxisFilter &horizontal = filters.horizontal;
+  const AxisFilter &vertical = filters.vertical;
+  const int out_cols = horizontal.size();
+  const long in_row_values = (long)in_cols * cn;
+  const long out_row_values = (long)out_cols * cn;
+  PooledVector<float> rows, sums(out_row_values);
+
+  for (long block = begin; block < end; block += RESAMPLE_BLOCK_ROWS) {
+    long block_end = std::min(end, block + RESAMPLE_BLOCK_ROWS);
+    WorkRange sources = vertical.sources(block, block_end);
+    rows.resize((sources.end - sources.begin) * out_row_values);
+
+    // Along the rows, every source row the block reads
+    for (long s = sources.begin; s < sources.end; s++) {
+      const T *row = input + (s - in_first) * in_row_values;
+      float *resampled = rows.data() + (s - sources.begin) * out_row_values;
+      for (int x = 0; x < out_cols; x++) {
+        const int *index = horizontal.index.data() + (long)x * horizontal.taps;
+        const float *weight =
+            horizontal.weights.data() + (long)x * horizontal.taps;
+        float sum[maxChannels] = {};
+        for (int t = 0; t < horizontal.taps; t++) {
+          const T *pixel = row + (long)index[t] * cn;
+          for (int c = 0; c < cn; c++) {
+            sum[c] += pixel[c] * weight[t];
+          }
+        }
+        for (int c = 0; c < cn; c++) {
+          resampled[x * cn + c] = sum[c];
+        }
+      }
+    }
+
+    // Across the rows, a tap at a time along the whole output row
+    for (long y = block; y < block_end; y++) {
+      std::fill(sums.begin(), sums.end(), 0.0f);
+      for (int t = 0; t < vertical.taps; t++) {
+        const float *row =
+            rows.data() +
+            (vertical.index[y * vertical.taps + t] - sources.begin) *
+                out_row_values;
+        float weight = vertical.weights[y * vertical.taps + t];
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for (long v = 0; v < out_row_values; v++) {
+          sums[v] += row[v] * weight;
+        }
+      }
+      T *out = output + (y - out_first) * out_row_values;
+      for (long v = 0; v < out_row_values; v++) {
+        out[v] = roundChannel<T>(sums[v]);
+      }
+    }
+  }
+}
+
+// Laplacian level: the Gaussian level minus the next level upsampled to its
+// size, both as float, so it keeps its sign and the level is recovered
+// exactly by adding it back
+inline cv::Mat laplacianLevel(const cv::Mat &gaussian,
+                              const cv::Mat &upsampled) {
+  cv::Mat level;
+  gaussian.convertTo(level, CV_32F);
+  long values = (long)level.total() * level.channels();
+  float *difference = level.ptr<float>();
+  const float *next = upsampled.ptr<float>();
+  for (long v = 0; v < values; v++) {
+    difference[v] -= next[v];
+  }
+  return level;
+}
+
+// Every input value is read once and every output value written once. Each
+// tap is a multiply-add, along the rows for every source row and output
+// column, across the rows for every output value.
+inline KernelCost resampleCost(cv::Size input, const ResampleFilters &filters,
+                               int channels, size_t channel_bytes) {
+  double out_values =
+      (double)filters.horizontal.size() * filters.vertical.size() * channels;
+  double in_values = (double)input.width * input.height * channels;
+  double along = (double)input.height * filters.horizontal.size() * channels *
+                 filters.horizontal.taps;
+  double across = out_values * filters.vertical.taps;
+  return {(in_values + out_values) * channel_bytes, 2 * (along + across),
+          true};
+}
+
+// Every level of the pyramid, and for a Laplacian pyramid the float
+// upsampling of each level but the first and the subtraction, which reads
+// two float values and writes one per value
+inline KernelCost pyramidCost(cv::Size input, int levels, bool laplacian,
+                              int channels, size_t channel_bytes) {
+  std::vector<cv::Size> sizes = pyramidSizes(input, levels);
+  KernelCost cost;
+  for (int k = 0; k < levels; k++) {
+    KernelCost level = resampleCost(sizes[k], pyramidFilters(sizes[k]),
+                                    channels, channel_bytes);
+    cost.bytes += level.bytes;
+    cost.ops += level.ops;
+    if (laplacian) {
+      KernelCost upsample = resampleCost(
+          sizes[k + 1], resizeFilters(BILINEAR, sizes[k + 1], sizes[k]),
+          channels, sizeof(float));
+      double values = (double)sizes[k].area() * channels;
+      cost.bytes += upsample.bytes + 3 * values * sizeof(float);
+      cost.ops += upsample.ops + values;
+    }
+  }
+  return cost;
+}
@@ -0,0 +1,10 @@
+#!/bin/bash
+# Strong scalability test on data/input.jpg. Timings (median/p95 over repeated
+# runs) are merged into output/benchmark/results.csv, extra flags such as
+# --repetitions are passed through to benchmark.py
+cd "$(dirname "$0")"
+
+echo "Start strong scalability test on resize"
+python3 ../benchmark.py strong --kernels resize_openmp resize_opencv pyramid_openmp --workers 1-20 "$@"
+python3 ../benchmark.py strong --kernels resize_mpi pyramid_mpi --workers 1-10 "$@"
+echo "Finished strong scalability test on resize"
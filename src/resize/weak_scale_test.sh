@@ -0,0 +1,10 @@
+#!/bin/bash
+# Weak scalability test on data/scaled_images. Timings (median/p95 over repeated
+# runs) are merged into output/benchmark/results.csv, extra flags such as
+# --repetitions are passed through to benchmark.py
+cd "$(dirname "$0")"
+
+echo "Start weak scalability test on resize"
+python3 ../benchmark.py weak --kernels resize_openmp resize_opencv pyramid_openmp --workers 1-20 "$@"
+python3 ../benchmark.py weak --kernels resize_mpi pyramid_mpi --workers 1-10 "$@"
+echo "Finished weak scalability test on resize"
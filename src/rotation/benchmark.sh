@@ -1,12 +1,13 @@
 #!/bin/bash
 
-export PROJECT_ROOT="/Users/joseph280996/Code/School/PHPC/Project"
+export PROJECT_ROOT="$(cd "$(dirname "$0")/../.." && pwd)"
 export SEQ_OUTPUT_DIR="$PROJECT_ROOT/output/sequential"
 export PAR_OUTPUT_DIR="$PROJECT_ROOT/output/parallel"
+mkdir -p "$SEQ_OUTPUT_DIR" "$PAR_OUTPUT_DIR"
 
 echo "Start rotate image clockwise"
-mpirun -np 8 ./parallel_rotate /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg c
+mpirun --bind-to core --map-by numa -np 8 ./parallel_rotate "$PROJECT_ROOT/data/input.jpg" c
 echo "Finished rotating image clockwise"
 echo "Start rotate image counterclockwise"
-mpirun -np 8 ./parallel_rotate /Users/joseph280996/Code/School/PHPC/Project/data/input.jpg cc
+mpirun --bind-to core --map-by numa -np 8 ./parallel_rotate "$PROJECT_ROOT/data/input.jpg" cc
 echo "Finished rotating image counterclockwise"
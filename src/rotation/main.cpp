@@ -1,9 +1,22 @@
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <mpi.h>
 #include <opencv2/opencv.hpp>
 #include <string>
 
+#include "../common/batch_mpi.hpp"
+#include "../common/buffer_pool_mpi.hpp"
+#include "../common/node_comm.hpp"
+#include "../common/perf_counters_mpi.hpp"
+#include "../common/pixel_types.hpp"
+#include "../common/result_cache_mpi.hpp"
+#include "../common/roi.hpp"
+#include "../common/roofline.hpp"
+#include "../common/shared_window.hpp"
+#include "../common/stream_mpi.hpp"
+#include "../common/trace_mpi.hpp"
+
 using namespace cv;
 using namespace std;
 using namespace std::chrono;
@@ -21,101 +34,360 @@ ROTATIONTYPE parseRotationType(const string &type) {
   }
 }
 
+// A rotation only permutes values: every input value is read once and
+// written once to the output image, with no arithmetic
+KernelCost rotate_cost(int rows, int cols, size_t pixel_bytes) {
+  return {2.0 * rows * cols * pixel_bytes, 0, false};
+}
+
+template <typename T, int CN>
 void rotate_clockwise_sequential(const Mat &input, Mat &output) {
   // For clockwise rotation of 90 degrees:
   // (r, c) -> (c, new_cols - 1 - r)
   // new_rows = input.cols, new_cols = input.rows
   int rows = input.rows;
   int cols = input.cols;
-  int channels = input.channels();
+  const int cn = channelCount<CN>(input.channels());
 
   output.create(cols, rows, input.type());
 
   for (int r = 0; r < rows; r++) {
-    const uchar *in_row = input.ptr<uchar>(r);
+    const T *in_row = input.ptr<T>(r);
     for (int c = 0; c < cols; c++) {
-      for (int ch = 0; ch < channels; ch++) {
-        output.at<Vec3b>(c, rows - 1 - r)[ch] = in_row[c * channels + ch];
-      }
+      copyPixel<T, CN>(output.ptr<T>(c) + (rows - 1 - r) * cn, in_row + c * cn,
+                       cn);
     }
   }
 }
 
+template <typename T, int CN>
 void rotate_counterclockwise_sequential(const Mat &input, Mat &output) {
   // For counterclockwise rotation of 90 degrees:
   // (r, c) -> (new_rows - 1 - c, r)
   // new_rows = input.cols, new_cols = input.rows
   int rows = input.rows;
   int cols = input.cols;
-  int channels = input.channels();
+  const int cn = channelCount<CN>(input.channels());
 
   output.create(cols, rows, input.type());
 
   for (int r = 0; r < rows; r++) {
-    const uchar *in_row = input.ptr<uchar>(r);
+    const T *in_row = input.ptr<T>(r);
     for (int c = 0; c < cols; c++) {
-      for (int ch = 0; ch < channels; ch++) {
-        output.at<Vec3b>(cols - 1 - c, r)[ch] = in_row[c * channels + ch];
-      }
+      copyPixel<T, CN>(output.ptr<T>(cols - 1 - c) + r * cn, in_row + c * cn,
+                       cn);
     }
   }
 }
 
+void rotate_sequential(ROTATIONTYPE rotationtype, const Mat &input,
+                       Mat &output) {
+  dispatchPixelType(input.type(), [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    if (rotationtype == CLOCKWISE) {
+      rotate_clockwise_sequential<T, CN>(input, output);
+    } else {
+      rotate_counterclockwise_sequential<T, CN>(input, output);
+    }
+  });
+}
+
+// Each process writes a block of output rows [start_row, end_row), gathering
+// every output row from one input column. For a clockwise rotation:
+// (r, c) -> (c, out_cols - 1 - r)
+// out_rows = in_cols, out_cols = in_rows
+template <typename T, int CN>
 void rotate_parallel_clockwise(const uchar *input_data, uchar *output_data,
-                               int in_rows, int in_cols, int channels, int rank,
-                               int num_processes) {
-  // Parallel partitioning: distribute rows of the input image among processes
-  // Each process handles a subset of rows from the input image.
-  // For a clockwise rotation:
-  // (r, c) -> (c, out_cols - 1 - r)
-  // out_rows = in_cols, out_cols = in_rows
-  int out_rows = in_cols;
+                               int in_rows, int in_cols, int channels,
+                               long start_row, long end_row) {
+  const T *input_values = reinterpret_cast<const T *>(input_data);
+  T *output_values = reinterpret_cast<T *>(output_data);
+  const int cn = channelCount<CN>(channels);
   int out_cols = in_rows;
 
-  int block_size = in_rows / num_processes;
-  int start_row = rank * block_size;
-  int end_row = (rank == num_processes - 1) ? in_rows : (rank + 1) * block_size;
-
-  for (int r = start_row; r < end_row; r++) {
-    for (int c = 0; c < in_cols; c++) {
-      for (int ch = 0; ch < channels; ch++) {
-        int in_index = (r * in_cols + c) * channels + ch;
-        int out_r = c;
-        int out_c = out_cols - 1 - r;
-        int out_index = (out_r * out_cols + out_c) * channels + ch;
-        output_data[out_index] = input_data[in_index];
-      }
+  for (long out_r = start_row; out_r < end_row; out_r++) {
+    for (int out_c = 0; out_c < out_cols; out_c++) {
+      long r = out_cols - 1 - out_c;
+      long c = out_r;
+      long in_index = (r * in_cols + c) * cn;
+      long out_index = (out_r * out_cols + out_c) * cn;
+      copyPixel<T, CN>(output_values + out_index, input_values + in_index, cn);
     }
   }
 }
 
+template <typename T, int CN>
 void rotate_parallel_counterclockwise(const uchar *input_data,
                                       uchar *output_data, int in_rows,
-                                      int in_cols, int channels, int rank,
-                                      int num_processes) {
+                                      int in_cols, int channels,
+                                      long start_row, long end_row) {
   // For counterclockwise rotation:
   // (r, c) -> (out_rows - 1 - c, r)
   // out_rows = in_cols, out_cols = in_rows
+  const T *input_values = reinterpret_cast<const T *>(input_data);
+  T *output_values = reinterpret_cast<T *>(output_data);
+  const int cn = channelCount<CN>(channels);
   int out_rows = in_cols;
   int out_cols = in_rows;
 
-  int block_size = in_rows / num_processes;
-  int start_row = rank * block_size;
-  int end_row = (rank == num_processes - 1) ? in_rows : (rank + 1) * block_size;
-
-  for (int r = start_row; r < end_row; r++) {
-    for (int c = 0; c < in_cols; c++) {
-      for (int ch = 0; ch < channels; ch++) {
-        int in_index = (r * in_cols + c) * channels + ch;
-        int out_r = out_rows - 1 - c;
-        int out_c = r;
-        int out_index = (out_r * out_cols + out_c) * channels + ch;
-        output_data[out_index] = input_data[in_index];
-      }
+  for (long out_r = start_row; out_r < end_row; out_r++) {
+    for (int out_c = 0; out_c < out_cols; out_c++) {
+      long r = out_c;
+      long c = out_rows - 1 - out_r;
+      long in_index = (r * in_cols + c) * cn;
+      long out_index = (out_r * out_cols + out_c) * cn;
+      copyPixel<T, CN>(output_values + out_index, input_values + in_index, cn);
     }
   }
 }
 
+// Input columns holding the output rows [start_row, end_row)
+WorkRange rotate_input_columns(ROTATIONTYPE rotationtype, int in_cols,
+                               WorkRange out_rows) {
+  if (rotationtype == CLOCKWISE) {
+    return out_rows;
+  }
+  return {in_cols - out_rows.end, in_cols - out_rows.begin};
+}
+
+// The root sends every node leader the input columns node_columns[n] as an
+// in_rows x strip_cols image of its own, which rotates into the node's block
+// of output rows. Collective over the leaders, a no-op on the other ranks.
+void scatter_column_strips(const NodeComms &nodes, const uchar *input_data,
+                           int in_rows, int in_cols, int pixel_bytes,
+                           const vector<WorkRange> &node_columns,
+                           uchar *strip_data, long strip_cols) {
+  if (!nodes.isLeader()) {
+    return;
+  }
+  // One pixel wide column of an image with row_pixels pixels per row,
+  // resized so that consecutive columns start one pixel apart
+  auto column_type = [&](long row_pixels) {
+    MPI_Datatype column, resized;
+    MPI_Type_vector(in_rows, pixel_bytes, (int)(row_pixels * pixel_bytes),
+                    MPI_BYTE, &column);
+    MPI_Type_create_resized(column, 0, pixel_bytes, &resized);
+    MPI_Type_commit(&resized);
+    MPI_Type_free(&column);
+    return resized;
+  };
+  MPI_Datatype input_column = column_type(in_cols);
+  MPI_Datatype strip_column = column_type(strip_cols);
+  vector<int> counts, displs;
+  slabCounts(node_columns, counts, displs);
+  MPI_Scatterv(input_data, counts.data(), displs.data(), input_column,
+               strip_data, (int)strip_cols, strip_column, 0, nodes.leaders);
+  MPI_Type_free(&input_column);
+  MPI_Type_free(&strip_column);
+}
+
+// Rotate rank 0's input in the node-shared windows of workspace and hand the
+// result to save on rank 0. Returns the kernel time. Collective over
+// MPI_COMM_WORLD.
+duration<double> rotate_shared(const NodeComms &nodes, PhaseCounters &counters,
+                               SharedWorkspace &workspace, const Mat &input,
+                               ROTATIONTYPE rotationtype,
+                               const function<void(const Mat &)> &save) {
+  int rank, num_processes;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+
+  // We'll need two shared memory regions:
+  // 1) For the input image data
+  // 2) For the output (rotated) image data
+
+  // After rotation:
+  // out_rows = in_cols, out_cols = in_rows
+  int in_dims[3] = {input.rows, input.cols, input.type()};
+  // Make sure everyone has the dims and pixel type
+  MPI_Bcast(in_dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
+  int out_dims[3] = {in_dims[1], in_dims[0], in_dims[2]};
+  int in_rows = in_dims[0];
+  int in_cols = in_dims[1];
+  int pixel_bytes = CV_ELEM_SIZE(in_dims[2]);
+
+  // The output rows are split into one balanced, page aligned part per rank
+  // and each node holds the block of its ranks' parts, along with the strip
+  // of input columns it is rotated from. Each rank's part of the output is
+  // placed on its own NUMA node. Every rank reads a column strip crossing all
+  // input rows, so the input strip is only spread over the NUMA nodes by row
+  // blocks to share out the read bandwidth.
+  long out_row_bytes = (long)out_dims[1] * pixel_bytes;
+  Partition partition(out_dims[0], out_row_bytes, num_processes);
+  WorkRange slab = nodes.slab(partition);
+  long slab_rows = slab.end - slab.begin;
+  long slab_bytes = slab_rows * out_row_bytes;
+  long strip_row_bytes = slab_rows * pixel_bytes;
+  long strip_bytes = (long)in_rows * strip_row_bytes;
+  Partition node_partition(slab_rows, out_row_bytes, nodes.node_size);
+  WorkRange part = node_partition.part(nodes.node_rank);
+  WorkRange in_part = Partition(in_rows, strip_row_bytes, nodes.node_size)
+                          .part(nodes.node_rank);
+  SharedImageWindow &in_window = workspace.window(
+      0, strip_bytes,
+      {{in_part.begin * strip_row_bytes, in_part.end * strip_row_bytes}});
+  SharedImageWindow &out_window = workspace.window(
+      1, slab_bytes, {{part.begin * out_row_bytes, part.end * out_row_bytes}});
+  uchar *sharedInData = in_window.data();
+  uchar *sharedOutData = out_window.data();
+  SharedChunkCounter &next_chunk = workspace.chunkCounter();
+  NodeBarrier &node_barrier = workspace.barrier();
+
+  // Input columns and output bytes of every node, known to the leaders
+  vector<WorkRange> node_columns, node_output_bytes;
+  if (nodes.isLeader()) {
+    for (const WorkRange &node_slab : nodes.nodeSlabs(partition)) {
+      node_columns.push_back(
+          rotate_input_columns(rotationtype, in_cols, node_slab));
+      node_output_bytes.push_back(
+          {node_slab.begin * out_row_bytes, node_slab.end * out_row_bytes});
+    }
+  }
+
+  // Root scatters the column strips to the node leaders' shared memory. On a
+  // single node the strip is the whole input, which is copied as one block.
+  if (nodes.isLeader()) {
+    counters.begin("copy");
+    if (nodes.num_nodes > 1) {
+      scatter_column_strips(nodes, input.data, in_rows, in_cols, pixel_bytes,
+                            node_columns, sharedInData, slab_rows);
+    } else {
+      scatterSlabs(nodes, input.data, {{0, strip_bytes}}, sharedInData,
+                   strip_bytes);
+    }
+    counters.end();
+  }
+
+  // Ensure all processes see the initial data
+  node_barrier.wait({&in_window, &out_window});
+
+  // Start parallel timing
+  auto start_par = high_resolution_clock::now();
+
+  // Perform parallel rotation of the node's strip
+  counters.begin("kernel");
+  dispatchPixelType(in_dims[2], [&](auto pixel) {
+    using T = typename decltype(pixel)::Channel;
+    constexpr int CN = decltype(pixel)::channels;
+    runPartition(node_partition, nodes.node_rank, next_chunk.get(),
+                 [&](long begin, long end) {
+                   if (rotationtype == CLOCKWISE) {
+                     rotate_parallel_clockwise<T, CN>(
+                         sharedInData, sharedOutData, in_rows, slab_rows,
+                         CV_MAT_CN(in_dims[2]), begin, end);
+                   } else {
+                     rotate_parallel_counterclockwise<T, CN>(
+                         sharedInData, sharedOutData, in_rows, slab_rows,
+                         CV_MAT_CN(in_dims[2]), begin, end);
+                   }
+                 });
+  });
+  counters.end();
+
+  counters.begin("barrier");
+  node_barrier.wait({&in_window, &out_window});
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    MPI_Barrier(nodes.leaders);
+  }
+  counters.end();
+  auto stop_par = high_resolution_clock::now();
+
+  // Root gathers the output blocks of the other nodes, on a single node the
+  // shared block is the whole output
+  Mat output;
+  if (nodes.num_nodes > 1 && nodes.isLeader()) {
+    if (rank == 0) {
+      output.create(out_dims[0], out_dims[1], out_dims[2]);
+    }
+    counters.begin("gather");
+    gatherSlabs(nodes, sharedOutData, slab_bytes, node_output_bytes,
+                output.data);
+    counters.end();
+  }
+
+  if (rank == 0) {
+    // out_dims were computed: out_rows = in_cols, out_cols = in_rows
+    save(nodes.num_nodes > 1 ? output
+                             : Mat(out_dims[0], out_dims[1], out_dims[2],
+                                   sharedOutData));
+  }
+
+  return stop_par - start_par;
+}
+
+// The batch mode of batch_mpi.hpp, results are written as
+// <name>_<clockwise|counterclockwise>.jpg, or with the extension
+// resultExtension picks for other pixel types
+int rotate_batch(const NodeComms &nodes, PhaseCounters &counters,
+                 const string &input, ROTATIONTYPE rotationtype) {
+  string rot_str =
+      (rotationtype == CLOCKWISE) ? "clockwise" : "counterclockwise";
+  // Windows of the split images, allocated again only for a larger one
+  SharedWorkspace workspace(nodes.node);
+  auto decode = [](const string &path) { return readPixels(path); };
+  auto split = [&](Mat &image, ImagePool<Mat> &pool) {
+    // Copied out of the window, the encode overlaps the next image
+    Mat result;
+    rotate_shared(nodes, counters, workspace, image, rotationtype,
+                  [&](const Mat &shared_result) {
+                    result = pool.acquire();
+                    shared_result.copyTo(result);
+                  });
+    return result;
+  };
+  auto whole = [&](Mat &image, ImagePool<Mat> &pool) {
+    // The rotated image does not fit in place, reuse an encoded one
+    Mat output = pool.acquire();
+    TraceScope scope("kernel");
+    rotate_sequential(rotationtype, image, output);
+    return output;
+  };
+  auto encode = [&](const Mat &result, const string &path) {
+    return cv::imwrite(
+        batchOutputPath(path, rot_str, resultExtension(result.type())),
+        result);
+  };
+  int status = runBatchMPI<Mat>(input, decode, split, whole, encode);
+  workspace.free();
+  return status;
+}
+
+// The streaming mode of stream_mpi.hpp, an out-of-core transpose in tiles of
+// a band of input rows. The rotated band is a strip of output columns, so
+// each of its rows is written to its place in an output row of
+// parallel_<clockwise|counterclockwise>_result.ppm.
+int rotate_stream(const NodeComms &nodes, PhaseCounters &counters,
+                  const string &input, ROTATIONTYPE rotationtype) {
+  string rot_str =
+      (rotationtype == CLOCKWISE) ? "clockwise" : "counterclockwise";
+  // Windows of the first, largest band, reused by the others
+  SharedWorkspace workspace(nodes.node);
+  auto process = [&](StreamBand &band) {
+    Mat image;
+    if (band.data != nullptr) {
+      image = Mat(band.count, band.cols, CV_8UC(band.channels), band.data);
+    }
+    // Clockwise, input row r becomes output column rows - 1 - r
+    int out_col = rotationtype == CLOCKWISE
+                      ? band.rows - band.first - band.count
+                      : band.first;
+    return rotate_shared(nodes, counters, workspace, image, rotationtype,
+                         [&](const Mat &result) {
+                           counters.begin("encode");
+                           for (int r = 0; r < result.rows; r++) {
+                             band.writer.writePixels(r, out_col, band.count,
+                                                     result.ptr(r));
+                           }
+                           counters.end();
+                         })
+        .count();
+  };
+  int status = runStreamMPI(counters, input, rot_str, true, 0, process);
+  workspace.free();
+  return status;
+}
+
 int main(int argc, char **argv) {
   if (argc != 4) {
     cout << "Usage: " << argv[0] << " <image_path> <rotation_type> <with_sequential_flag>" << endl;
@@ -123,6 +395,10 @@ int main(int argc, char **argv) {
     cout << "               'cc' or 'counterclockwise' for counterclockwise "
             "rotation"
          << endl;
+    cout << "image_path may also be a directory or a .txt manifest of images"
+         << endl
+         << "With STREAM_BAND_BYTES set, a .ppm image is streamed in bands"
+         << endl;
     return -1;
   }
 
@@ -134,31 +410,106 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  MPI_Init(&argc, &argv);
+  // Batch mode decodes and encodes on helper threads
+  initMPIThreads(&argc, &argv);
 
-  int rank, num_processes;
+  int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
 
-  // Create shared communicator
-  MPI_Comm nodeComm;
-  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
-                      &nodeComm);
+  // Create node and node leader communicators
+  NodeComms nodes(MPI_COMM_WORLD);
+
+  // Optional hardware counters of each phase, PERF_COUNTERS=1
+  PhaseCounters counters(
+      perfCountersEnabled(MPI_COMM_WORLD),
+      {"decode", "copy", "kernel", "barrier", "gather", "encode"});
+
+  if (isBatchInput(argv[1]) || isStreamInput(argv[1])) {
+    int status = isBatchInput(argv[1])
+                     ? rotate_batch(nodes, counters, argv[1], rotationtype)
+                     : rotate_stream(nodes, counters, argv[1], rotationtype);
+    reportPhaseCounters(counters, MPI_COMM_WORLD);
+    reportBufferPoolStats(MPI_COMM_WORLD);
+    writeTraceMPI(MPI_COMM_WORLD);
+    nodes.free();
+    MPI_Finalize();
+    return status;
+  }
 
-  // We'll need two shared memory regions:
-  // 1) For the input image data
-  // 2) For the output (rotated) image data
+  // The result of an earlier run on the same image and rotation
+  string rot_str =
+      (rotationtype == CLOCKWISE) ? "clockwise" : "counterclockwise";
+  const string with_sequential_flag = argv[3];
+  ResultCache cache(argv[1], "rotate " + rot_str);
+  auto restore = [&] {
+    return !cache.restore(string(std::getenv("PAR_OUTPUT_DIR")) +
+                          "/parallel_" + rot_str + "_result")
+                .empty() &&
+           (with_sequential_flag != "true" ||
+            !cache.restore(string(std::getenv("SEQ_OUTPUT_DIR")) +
+                           "/sequential_" + rot_str + "_result")
+                 .empty());
+  };
+  if (lookupResult(cache, MPI_COMM_WORLD, restore)) {
+    if (rank == 0) {
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
 
-  MPI_Win in_win, out_win;
-  uchar *sharedInData = nullptr;
-  uchar *sharedOutData = nullptr;
+  // Only the rotation of the edited rectangle on top of the previous result,
+  // see roi.hpp
+  int dirty_done = 0;
+  if (rank == 0) {
+    DirtyRegion dirty = dirtyRegion();
+    if (!dirty.previous_path.empty()) {
+      string output_path = updateDirtyRegion(
+          argv[1], dirty, true,
+          string(std::getenv("PAR_OUTPUT_DIR")) + "/parallel_" + rot_str +
+              "_result",
+          [&](const Mat &image, Mat &result) {
+            Rect rect = dirty.rect & Rect(0, 0, image.cols, image.rows);
+            if (rect.empty()) {
+              return rect;
+            }
+            Mat rotated;
+            rotate_sequential(rotationtype, image(rect), rotated);
+            // (r, c) -> (c, out_cols - 1 - r) clockwise and
+            // (r, c) -> (out_rows - 1 - c, r) counterclockwise
+            Rect target_rect =
+                rotationtype == CLOCKWISE
+                    ? Rect(image.rows - rect.y - rect.height, rect.x,
+                           rect.height, rect.width)
+                    : Rect(rect.y, image.cols - rect.x - rect.width,
+                           rect.height, rect.width);
+            Mat target = result(target_rect);
+            rotated.copyTo(target);
+            return target_rect;
+          });
+      if (!output_path.empty()) {
+        dirty_done = 1;
+      }
+    }
+  }
+  MPI_Bcast(&dirty_done, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (dirty_done) {
+    if (rank == 0) {
+      cache.report();
+    }
+    nodes.free();
+    MPI_Finalize();
+    return 0;
+  }
 
-  int in_dims[3] = {0, 0, 0}; // rows, cols, channels
-  int out_dims[3] = {0, 0, 0};
+  Mat input;
 
   if (rank == 0) {
     // Read image
-    Mat input = imread(argv[1]);
+    counters.begin("decode");
+    input = readPixels(argv[1]);
+    counters.end();
     if (input.empty()) {
       cout << "Error: Could not read the image." << endl;
       MPI_Abort(MPI_COMM_WORLD, 1);
@@ -166,109 +517,69 @@ int main(int argc, char **argv) {
     }
 
     // Compute sequential rotation
+    PooledBuffer seqBuffer;
     Mat seqOutput;
     auto start_seq = high_resolution_clock::now();
-    const string with_sequential_flag = argv[3];
     if (with_sequential_flag == "true") {
-      if (rotationtype == CLOCKWISE) {
-        rotate_clockwise_sequential(input, seqOutput);
-      } else {
-        rotate_counterclockwise_sequential(input, seqOutput);
-      }
+      // Rotate into a pooled buffer, create() keeps a matching Mat
+      seqBuffer = PooledBuffer(input.total() * input.elemSize());
+      seqOutput = Mat(input.cols, input.rows, input.type(), seqBuffer.data());
+      rotate_sequential(rotationtype, input, seqOutput);
       auto stop_seq = high_resolution_clock::now();
       cout << "Sequential time: "
            << duration_cast<microseconds>(stop_seq - start_seq).count()
            << " microseconds" << endl;
+      printRoofline(rotate_cost(input.rows, input.cols, input.elemSize()),
+                    duration<double>(stop_seq - start_seq).count());
 
-      string rot_str =
-          (rotationtype == CLOCKWISE) ? "clockwise" : "counterclockwise";
       const char *output_dir = std::getenv("SEQ_OUTPUT_DIR");
-      std::string outputPath =
-          std::string(output_dir) + "/sequential_" + rot_str + "_result.jpg";
+      std::string outputPath = std::string(output_dir) + "/sequential_" +
+                               rot_str + "_result" +
+                               resultExtension(input.type());
       cv::imwrite(outputPath, seqOutput);
     }
-
-    // Set dimensions
-    in_dims[0] = input.rows;
-    in_dims[1] = input.cols;
-    in_dims[2] = input.channels();
-
-    // After rotation:
-    // out_rows = in_cols, out_cols = in_rows
-    out_dims[0] = in_dims[1]; // out rows
-    out_dims[1] = in_dims[0]; // out cols
-    out_dims[2] = in_dims[2];
-  }
-  // Make sure everyone has the dims
-  MPI_Bcast(in_dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
-  MPI_Bcast(out_dims, 3, MPI_INT, 0, MPI_COMM_WORLD);
-  // We'll allocate shared memory for input image and copy data
-  // We'll also allocate shared memory for output image
-  size_t in_total_size = (rank == 0) ? in_dims[0] * in_dims[1] * in_dims[2] : 0;
-  size_t out_total_size =
-      (rank == 0) ? out_dims[0] * out_dims[1] * out_dims[2] : 0;
-
-  MPI_Win_allocate_shared(in_total_size, 1, MPI_INFO_NULL, nodeComm,
-                          &sharedInData, &in_win);
-  MPI_Win_allocate_shared(out_total_size, 1, MPI_INFO_NULL, nodeComm,
-                          &sharedOutData, &out_win);
-
-  if (rank != 0) {
-    MPI_Aint in_shared_size, out_shared_size;
-    int in_disp_unit, out_disp_unit;
-    MPI_Win_shared_query(in_win, 0, &in_shared_size, &in_disp_unit,
-                         &sharedInData);
-    MPI_Win_shared_query(out_win, 0, &out_shared_size, &out_disp_unit,
-                         &sharedOutData);
-  }
-
-  if (rank == 0) {
-    Mat image = imread(argv[1]);
-
-    memcpy(sharedInData, image.data, in_total_size);
   }
 
-  int in_rows = in_dims[0];
-  int in_cols = in_dims[1];
-  int in_ch = in_dims[2];
-
-  // Ensure all processes see the initial data
-  MPI_Barrier(MPI_COMM_WORLD);
-
-  // Start parallel timing
-  auto start_par = high_resolution_clock::now();
-
-  // Perform parallel rotation
-  if (rotationtype == CLOCKWISE) {
-    rotate_parallel_clockwise(sharedInData, sharedOutData, in_rows, in_cols,
-                              in_ch, rank, num_processes);
-  } else {
-    rotate_parallel_counterclockwise(sharedInData, sharedOutData, in_rows,
-                                     in_cols, in_ch, rank, num_processes);
+  // The windows of the one image, released before MPI_Finalize
+  SharedWorkspace workspace(nodes.node);
+  duration<double> elapsed = rotate_shared(
+      nodes, counters, workspace, input, rotationtype, [&](const Mat &result) {
+        const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
+        std::string outputPath = std::string(output_dir) + "/parallel_" +
+                                 rot_str + "_result" +
+                                 updatableResultExtension(result.type());
+        counters.begin("encode");
+        bool success = cv::imwrite(outputPath, result);
+        counters.end();
+        if (success) {
+          cache.store(outputPath);
+        }
+      });
+
+  // Bandwidth ceiling of every rank streaming at the same time
+  double stream_gbps = 0;
+  if (rooflineProbeEnabled()) {
+    double rank_gbps = streamTriadBandwidth();
+    MPI_Reduce(&rank_gbps, &stream_gbps, 1, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
   }
 
-  MPI_Barrier(MPI_COMM_WORLD);
-
   if (rank == 0) {
-    auto stop_par = high_resolution_clock::now();
     cout << "Parallel time: "
-         << duration_cast<microseconds>(stop_par - start_par).count()
-         << " microseconds" << endl;
-
-    // out_dims were computed: out_rows = in_cols, out_cols = in_rows
-
-    Mat result(out_dims[0], out_dims[1], CV_8UC(out_dims[2]), sharedOutData);
-    string rot_str =
-        (rotationtype == CLOCKWISE) ? "clockwise" : "counterclockwise";
-    const char *output_dir = std::getenv("PAR_OUTPUT_DIR");
-    std::string outputPath =
-        std::string(output_dir) + "/parallel_" + rot_str + "_result.jpg";
-    cv::imwrite(outputPath, result);
+         << duration_cast<microseconds>(elapsed).count() << " microseconds"
+         << endl;
+    printRoofline(rotate_cost(input.rows, input.cols, input.elemSize()),
+                  elapsed.count(), stream_gbps);
+  }
+  if (rank == 0) {
+    cache.report();
   }
+  reportPhaseCounters(counters, MPI_COMM_WORLD);
+  reportBufferPoolStats(MPI_COMM_WORLD);
+  writeTraceMPI(MPI_COMM_WORLD);
 
-  MPI_Win_free(&in_win);
-  MPI_Win_free(&out_win);
-  MPI_Comm_free(&nodeComm);
+  workspace.free();
+  nodes.free();
   MPI_Finalize();
   return 0;
 }